@@ -0,0 +1,185 @@
+# SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+# SPDX-License-Identifier: MIT
+#
+# Generate UI assets (subset fonts and prerendered images) for zq3_lvgl.c
+#
+# This runs at build time (see app/CMakeLists.txt). It reads the manifest in
+# app/assets/assets.txt and writes zq3_assets.c and zq3_assets.h, plus one
+# <name>.c file per font when fonts are enabled.
+#
+# Images: each image is a coverage mask (see app/assets/wifi.txt) that gets
+# blended onto the background color and stored as RGB565. That's the format
+# LVGL draws in, so showing the image is a plain copy with no conversion or
+# alpha blending. (With CONFIG_LV_COLOR_16_SWAP=y, the byte swap for the
+# display happens once for the whole frame in the flush callback, so images
+# should NOT be pre-swapped.)
+#
+# Fonts: lv_font_conv makes compressed LVGL fonts with just the glyphs that
+# the UI needs. "ui" fonts only get the characters from the string literals
+# in app/src/zq3_ui_text.h. For each font, this prints the bitmap size next to
+# the size of an uncompressed printable ASCII font (like LVGL's built-in
+# Montserrat fonts), so you can see the flash savings in the build log.
+#
+# Usage: gen_assets.py [--fonts <lv_font_conv> <ttf dir>] <manifest>
+#        <ui text header> <output dir>
+
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+
+ASCII_RANGE = "0x20-0x7E"
+COVERAGE = {" ": 0, ".": 1 / 3, "+": 2 / 3, "#": 1}
+
+
+def read_manifest(path):
+    fonts, images = [], []
+    for n, line in enumerate(open(path), start=1):
+        line = line.split("#", 1)[0].strip()
+        if not line:
+            continue
+        fields = line.split()
+        if fields[0] == "font" and len(fields) == 6:
+            name, ttf, size, bpp, glyphs = fields[1:]
+            if glyphs not in ("ascii", "ui"):
+                sys.exit(f"ERR: {path}:{n}: glyphs must be ascii or ui")
+            fonts.append((name, ttf, int(size), int(bpp), glyphs))
+        elif fields[0] == "image" and len(fields) == 5:
+            name, mask, fg, bg = fields[1:]
+            images.append((name, mask, int(fg, 16), int(bg, 16)))
+        else:
+            sys.exit(f"ERR: {path}:{n}: expected a font or image line")
+    return fonts, images
+
+def ui_chars(header):
+    # Characters from the C string literals in the UI text header
+    text = open(header).read()
+    chars = set()
+    for lit in re.findall(r'"((?:[^"\\]|\\.)*)"', text):
+        chars.update(lit.encode("ascii").decode("unicode_escape"))
+    chars.discard("\n")
+    return "".join(sorted(chars))
+
+def read_mask(path):
+    rows = []
+    for line in open(path):
+        line = line.rstrip("\n")
+        if line.startswith("|") and line.endswith("|"):
+            rows.append([COVERAGE[c] for c in line[1:-1]])
+    if not rows or any(len(r) != len(rows[0]) for r in rows):
+        sys.exit(f"ERR: {path}: mask rows must all be the same width")
+    return rows
+
+def rgb565(fg, bg, a):
+    # Blend foreground over background, then pack as little-endian RGB565
+    ch = []
+    for shift in (16, 8, 0):
+        f, b = (fg >> shift) & 0xFF, (bg >> shift) & 0xFF
+        ch.append(round(b + (f - b) * a))
+    r, g, b = ch
+    v = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3)
+    return bytes((v & 0xFF, v >> 8))
+
+def c_bytes(data):
+    rows = []
+    for i in range(0, len(data), 12):
+        rows.append("\t" + " ".join(f"0x{b:02x}," for b in data[i:i+12]))
+    return "\n".join(rows)
+
+def font_conv(tool, ttf, size, bpp, glyphs, name, output, compress=True):
+    cmd = [tool, "--font", ttf, "--size", str(size), "--bpp", str(bpp),
+        "--format", "lvgl", "--lv-include", "lvgl.h", "--lv-font-name", name,
+        "-o", output]
+    cmd += ["-r", ASCII_RANGE] if glyphs is None else ["--symbols", glyphs]
+    if not compress:
+        cmd.append("--no-compress")
+    subprocess.run(cmd, check=True, stdout=subprocess.DEVNULL)
+
+def bitmap_size(c_file):
+    # Count the bytes in lv_font_conv's glyph_bitmap[] array
+    text = open(c_file).read()
+    m = re.search(r"glyph_bitmap\[\]\s*=\s*\{(.*?)\};", text, re.S)
+    return len(re.findall(r"0x[0-9a-fA-F]+", m.group(1))) if m else 0
+
+def main(argv):
+    tool = ttf_dir = None
+    if argv[:1] == ["--fonts"]:
+        if len(argv) < 3:
+            sys.exit("ERR: --fonts needs <lv_font_conv> <ttf dir>")
+        tool, ttf_dir = argv[1], argv[2]
+        argv = argv[3:]
+    if len(argv) != 3:
+        sys.exit("usage: gen_assets.py [--fonts <lv_font_conv> <ttf dir>] "
+            "<manifest> <ui text header> <output dir>")
+    manifest, ui_header, out_dir = argv
+    assets_dir = os.path.dirname(os.path.abspath(manifest))
+    fonts, images = read_manifest(manifest)
+    os.makedirs(out_dir, exist_ok=True)
+
+    h = [
+        "/* Generated by app/scripts/gen_assets.py -- DO NOT EDIT */",
+        "#ifndef ZQ3_ASSETS_H",
+        "#define ZQ3_ASSETS_H",
+        "",
+        "#include <lvgl.h>",
+        "",
+    ]
+    c = [
+        "/* Generated by app/scripts/gen_assets.py -- DO NOT EDIT */",
+        "#include <lvgl.h>",
+        "#include \"zq3_assets.h\"",
+        "",
+    ]
+    for name, mask, fg, bg in images:
+        rows = read_mask(os.path.join(assets_dir, mask))
+        w, hgt = len(rows[0]), len(rows)
+        data = b"".join(rgb565(fg, bg, a) for row in rows for a in row)
+        h.append(f"extern const lv_image_dsc_t {name};")
+        c += [
+            f"/* {mask}: {w}x{hgt} RGB565, fg {fg:06X}, bg {bg:06X} */",
+            f"static const uint8_t {name}_map[] = {{",
+            c_bytes(data),
+            "};",
+            "",
+            f"const lv_image_dsc_t {name} = {{",
+            "\t.header.magic = LV_IMAGE_HEADER_MAGIC,",
+            "\t.header.cf = LV_COLOR_FORMAT_RGB565,",
+            f"\t.header.w = {w},",
+            f"\t.header.h = {hgt},",
+            f"\t.header.stride = {w * 2},",
+            f"\t.data_size = sizeof({name}_map),",
+            f"\t.data = {name}_map,",
+            "};",
+            "",
+        ]
+
+    if tool:
+        h.append("")
+        ui = ui_chars(ui_header)
+        for name, ttf, size, bpp, glyphs in fonts:
+            ttf_path = os.path.join(ttf_dir, ttf)
+            symbols = ui if glyphs == "ui" else None
+            output = os.path.join(out_dir, f"{name}.c")
+            font_conv(tool, ttf_path, size, bpp, symbols, name, output)
+            with tempfile.TemporaryDirectory() as tmp:
+                full = os.path.join(tmp, "full.c")
+                font_conv(tool, ttf_path, size, bpp, None, "full", full,
+                    compress=False)
+                before = bitmap_size(full)
+            after = bitmap_size(output)
+            count = len(symbols) if symbols else 95
+            print(f"{name}: {count} glyphs, {after} bytes of bitmaps "
+                f"(full uncompressed ASCII: {before} bytes)")
+            h.append(f"LV_FONT_DECLARE({name});")
+
+    h += ["", "#endif /* ZQ3_ASSETS_H */"]
+    with open(os.path.join(out_dir, "zq3_assets.h"), "w") as f:
+        f.write("\n".join(h) + "\n")
+    with open(os.path.join(out_dir, "zq3_assets.c"), "w") as f:
+        f.write("\n".join(c))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,89 @@
+# SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+# SPDX-License-Identifier: MIT
+#
+# Generate the CA certificate table header for zq3_cert.c
+#
+# This runs at build time (see app/CMakeLists.txt). It reads the manifest in
+# app/certs/certs.txt, converts each PEM certificate to DER, and writes a C
+# header with one const array per certificate plus a table keyed by broker
+# hostname. Doing the base64 decoding here means mbed TLS doesn't need to do
+# PEM parsing on the device.
+#
+# Usage: gen_certs.py [--pem] <manifest> <output header>
+#   --pem: embed NUL terminated PEM text instead of DER (for comparing the two)
+
+import base64
+import os
+import sys
+
+
+def pem_to_der(text, path):
+    lines = [s.strip() for s in text.splitlines()]
+    try:
+        begin = lines.index("-----BEGIN CERTIFICATE-----")
+        end = lines.index("-----END CERTIFICATE-----")
+    except ValueError:
+        sys.exit(f"ERR: {path}: missing BEGIN/END CERTIFICATE line")
+    return base64.b64decode("".join(lines[begin+1:end]), validate=True)
+
+def read_manifest(path):
+    entries = []
+    for n, line in enumerate(open(path), start=1):
+        line = line.split("#", 1)[0].strip()
+        if not line:
+            continue
+        fields = line.split()
+        if len(fields) != 3:
+            sys.exit(f"ERR: {path}:{n}: expected <host> <tag> <file>")
+        host, tag, pem = fields
+        entries.append((host, int(tag), pem))
+    tags = [e[1] for e in entries]
+    if len(tags) != len(set(tags)):
+        sys.exit(f"ERR: {path}: sec_tag numbers must be unique")
+    return entries
+
+def c_bytes(data):
+    rows = []
+    for i in range(0, len(data), 12):
+        rows.append("\t" + " ".join(f"0x{b:02x}," for b in data[i:i+12]))
+    return "\n".join(rows)
+
+def main(argv):
+    pem_mode = "--pem" in argv
+    argv = [a for a in argv if a != "--pem"]
+    if len(argv) != 2:
+        sys.exit("usage: gen_certs.py [--pem] <manifest> <output header>")
+    manifest, output = argv
+    certs_dir = os.path.dirname(os.path.abspath(manifest))
+    out = [
+        "/* Generated by app/scripts/gen_certs.py -- DO NOT EDIT */",
+        "#ifndef ZQ3_CERT_TABLE_H",
+        "#define ZQ3_CERT_TABLE_H",
+        "",
+        f"#define ZQ3_CERT_FORMAT \"{'PEM' if pem_mode else 'DER'}\"",
+        "",
+    ]
+    rows = []
+    for i, (host, tag, pem) in enumerate(read_manifest(manifest)):
+        path = os.path.join(certs_dir, pem)
+        text = open(path).read()
+        der = pem_to_der(text, path)
+        # mbed TLS wants PEM buffers to include the terminating NUL
+        data = (text.encode("ascii") + b"\0") if pem_mode else der
+        out.append(f"/* {pem} (DER: {len(der)} bytes) */")
+        out.append(f"static const uint8_t zq3_cert_{i}[] = {{")
+        out.append(c_bytes(data))
+        out.append("};")
+        out.append("")
+        rows.append(f"\t{{\"{host}\", {tag}, zq3_cert_{i}, sizeof(zq3_cert_{i})}},")
+    out.append("static const zq3_cert_entry zq3_cert_table[] = {")
+    out.extend(rows)
+    out.append("};")
+    out.append("")
+    out.append("#endif /* ZQ3_CERT_TABLE_H */")
+    with open(output, "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -8,17 +8,38 @@
  * https://github.com/zephyrproject-rtos/zephyr/blob/main/subsys/net/l2/wifi/wifi_shell.c
  */
 
+#include <stdlib.h>                   // atoi()
 #include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/input/input.h>       // INPUT_KEY_ENTER, ...
 #include <zephyr/net/mqtt.h>
 #include <zephyr/net/wifi_mgmt.h>     // NET_EVENT_WIFI_CONNECT_RESULT, ...
 #include <zephyr/settings/settings.h>
 #include <zephyr/shell/shell.h>
+#include <zephyr/sys/reboot.h>
 #include "zq3.h"
+#include "zq3_bind.h"
+#include "zq3_broker.h"
+#include "zq3_cert.h"
+#include "zq3_conn.h"
+#include "zq3_cred.h"
+#include "zq3_disp.h"
+#include "zq3_echo.h"
+#include "zq3_fsm.h"
+#include "zq3_idle.h"
+#include "zq3_input.h"
+#include "zq3_keepalive.h"
+#include "zq3_lan.h"
 #include "zq3_mqtt.h"
 #include "zq3_lvgl.h"
-#include "zq3_url.h"
+#include "zq3_ota.h"
+#include "zq3_persist.h"
+#include "zq3_tls.h"
+#include "zq3_ui_text.h"
 #include "zq3_wifi.h"
 
+LOG_MODULE_REGISTER(zq3, CONFIG_ZQ3_LOG_LEVEL);
+
 
 /*
 * STATIC GLOBALS AND CONSTANTS
@@ -26,19 +47,102 @@
 
 // Context for wifi status, mqtt config, and mqtt status
 static zq3_context ZCtx = {
-	.ssid = {'\0'},
-	.psk =  {'\0'},
 	.mqtt_ok = false,
-	.state = OFFLINE,
-	.keypress = false,
-	.got_0 = false,
-	.got_1 = false,
 	.toggle = UNKNOWN,
+	.snapshot = UNKNOWN,
+	.publish_pending = false,
 };
 
+// Connection state machine (see zq3_fsm.c). Only the main loop may run it.
+// Wifi events and shell commands come from other threads, so they go
+// through FsmQueue.
+static zq3_fsm Fsm;
+static k_tid_t MainThread;
+typedef struct {
+	zq3_fsm_event ev;
+	int arg;
+} fsm_msg;
+K_MSGQ_DEFINE(FsmQueue, sizeof(fsm_msg), 8, 4);
+
 // MQTT context struct (initialized by zq3_mqtt_init())
 static zq3_mqtt_context MCtx;
 
+// GUI context struct (initialized by zq3_lvgl_init())
+static zq3_lvgl_context LCtx;
+
+// Ranked list of MQTT brokers (zq3/url, zq3/url1, ...)
+static zq3_broker_context BCtx;
+
+// Wifi networks (zq3/ssid, zq3/ssid1, ...), scan cache, and roaming state
+static zq3_wifi_context Wifi;
+
+// Broker connect pipeline (DNS, TCP, TLS, CONNECT in a worker thread)
+static zq3_conn_context Conn;
+
+// Toggle values we published that haven't come back from the broker yet
+static zq3_echo_context Echo;
+
+// Runtime settings waiting to be written to NVM flash (toggle, rotation)
+static zq3_persist_context Persist;
+
+// Firmware update over MQTT (if zq3/ota is set and CONFIG_ZQ3_OTA=y)
+static zq3_ota_context Ota;
+
+// Button gestures (BOOT button, plus any keys from app/inputs.overlay)
+static zq3_input_context Input;
+
+// Ping interval learned for each wifi network
+static zq3_keepalive_context Keepalive;
+
+// Backlight dimming and display sleep
+static zq3_idle_context Idle;
+
+// Local LAN control endpoint (UDP)
+static zq3_lan_context LanCtx;
+
+// Widgets from the zq3/layout setting and their feed bindings
+static zq3_bind_context Bind;
+
+// Hash of the broker and topics in the last SUBSCRIBE that got a SUBACK
+// (0 = nothing yet this boot), and of the one waiting for its SUBACK
+static uint32_t SubHash = 0;
+static uint32_t SubHashPending = 0;
+
+// Time spent in the MQTT event handler for PUBLISH events (`aio log`)
+static struct {
+	uint32_t count;
+	uint64_t cyc;
+	uint32_t max_cyc;
+} PubTime;
+
+
+/*
+* STATE MACHINE EVENTS
+*/
+
+// Queue an event for the main loop (from other threads)
+static void fsm_post(zq3_fsm_event ev, int arg) {
+	fsm_msg msg = {.ev = ev, .arg = arg};
+	if (k_msgq_put(&FsmQueue, &msg, K_NO_WAIT) != 0) {
+		LOG_ERR("state machine queue is full (%s)",
+			zq3_fsm_event_name(ev));
+	}
+}
+
+// Send an event to the state machine. Returns false if the current state
+// ignores it. Only the main loop may run the state machine, so if the MQTT
+// event handler ever gets called from another thread, its events get queued
+// (and count as handled).
+static bool fsm_event(zq3_fsm_event ev, int arg) {
+	if (k_current_get() != MainThread) {
+		LOG_WRN("%s from thread %p", zq3_fsm_event_name(ev),
+			(void *)k_current_get());
+		fsm_post(ev, arg);
+		return true;
+	}
+	return zq3_fsm_dispatch(&Fsm, ev, arg, k_uptime_get());
+}
+
 
 /*
 * NETWORK EVENT HANDLERS
@@ -53,84 +157,165 @@ static zq3_mqtt_context MCtx;
 // - https://docs.zephyrproject.org/latest/doxygen/html/structmqtt__topic.html
 // - https://docs.zephyrproject.org/latest/doxygen/html/structmqtt__binstr.html
 //
-static void mq_handler(struct mqtt_client *client, const struct mqtt_evt *e) {
+static void mq_event(struct mqtt_client *client, const struct mqtt_evt *e) {
+	if (e->type != MQTT_EVT_DISCONNECT) {
+		zq3_keepalive_rx(&Keepalive, e->type == MQTT_EVT_PINGRESP);
+	}
 	switch (e->type) {
 	case MQTT_EVT_CONNACK:
-		ZCtx.state = CONNACK;
+		zq3_mqtt_connack(&MCtx, &e->param.connack);
+		if (Wifi.net >= 0) {
+			zq3_keepalive_start(&Keepalive, Wifi.net,
+				Wifi.nets[Wifi.net].ssid);
+		}
+		fsm_event(ZQ3_EV_CONNACK, e->param.connack.session_present_flag);
+		break;
+	case MQTT_EVT_PUBACK:
+		// Broker got one of our QoS 1 publishes
+		zq3_mqtt_puback(&MCtx);
 		break;
 	case MQTT_EVT_DISCONNECT:
-		printk("DISCONNECT\n");
-		ZCtx.state = MQTT_ERR;
-		ZCtx.toggle = UNKNOWN;   // because we're no longer subscribed
+		LOG_INF("DISCONNECT");
+		// If a QoS 1 publish didn't get its PUBACK, send the toggle state
+		// again on the next connection (which may be a different broker)
+		if (MCtx.inflight > 0) {
+			ZCtx.publish_pending = true;
+		}
+		if (!ZCtx.publish_pending) {
+			ZCtx.toggle = UNKNOWN;   // because we're no longer subscribed
+		}
+		zq3_echo_clear(&Echo);
+		fsm_event(ZQ3_EV_MQTT_ERR, 0);
 		break;
 	case MQTT_EVT_PUBLISH:
 		// This happens when the broker informs us that somebody published a
 		// message to a topic we have subscribed to. The parameter, e->param,
 		// will be of type mqtt_publish_param.
 
-		// First extract topic from the param struct and check for match
+		// Get the topic and the payload data.
+		// CAUTION: You can't get the payload data from the payload struct.
+		// Instead you have to call this function (see mqtt_evt_type docs).
 		const struct mqtt_publish_message *m = &e->param.publish.message;
 		const uint8_t *topic = m->topic.topic.utf8;
 		uint32_t t_len = m->topic.topic.size;
-		if (t_len >= sizeof(MCtx.topic) || memcmp(topic, MCtx.topic, t_len)) {
-			printk("ignoring unknown topic (len = %d)\n", t_len);
+		uint8_t buf[ZQ3_BIND_PAYLOAD_MAX] = {0};
+		uint32_t payload_len = m->payload.len;
+		int count = 0;
+		bool ota = zq3_ota_match(&Ota, topic, t_len);
+		if (ota) {
+			// Firmware chunks are too big for buf, so the OTA code copies
+			// them from the socket to flash itself
+			zq3_ota_receive(&Ota, &MCtx.client, topic, t_len, payload_len);
+		} else {
+			count = mqtt_read_publish_payload(&MCtx.client, buf, sizeof(buf));
+		}
+
+		// Our subscriptions are QoS 1 (so the broker can queue messages for
+		// our persistent session), so QoS 1 messages need a PUBACK
+		if (m->topic.qos == MQTT_QOS_1_AT_LEAST_ONCE) {
+			const struct mqtt_puback_param ack = {
+				.message_id = e->param.publish.message_id,
+			};
+			mqtt_publish_qos1_ack(&MCtx.client, &ack);
+		}
+		if (ota) {
 			return;
 		}
 
-		// Second, get the payload data and parse it.
-		// CAUTION: You can't get the payload data from the payload struct.
-		// Instead you have to call this function (see mqtt_evt_type docs).
-		uint8_t buf[32] = {0};
-		uint32_t payload_len = m->payload.len;
-		int count = mqtt_read_publish_payload(&MCtx.client, buf, sizeof(buf));
+		// Messages for other topics go to the layout widget bindings
+		if (t_len >= sizeof(MCtx.topic) || memcmp(topic, MCtx.topic, t_len)) {
+			if (count < 0 || count != payload_len) {
+				LOG_ERR("unexpected payload length: %d", count);
+			} else if (zq3_bind_dispatch(&Bind, topic, t_len, buf, count)) {
+				LOG_DBG("ignoring unknown topic (len = %d)", t_len);
+			}
+			return;
+		}
 		if (count != 1 || count != payload_len) {
-			printk("ERR: unexpected payload length: %d\n", count);
+			LOG_ERR("unexpected payload length: %d", count);
 			return;
 		}
 
-		// Parse payload data for expected messages: "1" or "0"
+		// Parse payload data for expected messages: "1" or "0". The value
+		// goes in a latest-value-wins mailbox, so if several arrive before
+		// the main loop gets to them, the last one counts.
 		switch((char)buf[0]) {
 		case '0':
-			printk("PUB GOT 0\n");
-			ZCtx.got_0 = true;
-			break;
 		case '1':
-			printk("PUB GOT 1\n");
-			ZCtx.got_1 = true;
+			// Skip echoes of our own publishes, and values from other
+			// clients that our own later publish is going to replace
+			switch (zq3_echo_check(&Echo, buf[0], k_uptime_get())) {
+			case ZQ3_ECHO_OURS:
+				LOG_INF("PUB GOT %c (echo)", buf[0]);
+				break;
+			case ZQ3_ECHO_STALE:
+				LOG_INF("PUB GOT %c (stale)", buf[0]);
+				break;
+			default:
+				LOG_INF("PUB GOT %c", buf[0]);
+				zq3_mbox_put(&ZCtx.remote, buf, count);
+			}
 			break;
 		default:
-			printk("PUB GOT unknown value\n");
+			LOG_INF("PUB GOT unknown value");
 		}
 		break;
 	case MQTT_EVT_SUBACK:
-		ZCtx.state = SUBACK;
+		SubHash = SubHashPending;
+		fsm_event(ZQ3_EV_SUBACK, 0);
 		break;
 	case MQTT_EVT_PINGRESP:
-		// This can be useful, but it's noisy
-		//printk("PINGRESP\n");
+		// This can be useful, but it's noisy (CONFIG_ZQ3_LOG_LEVEL_DBG=y)
+		LOG_DBG("PINGRESP");
 		break;
 	default:
 		break;
 	}
 }
 
+// Time PUBLISH events, since that's where most of the event logging happens
+static void mq_handler(struct mqtt_client *client, const struct mqtt_evt *e) {
+	if (e->type != MQTT_EVT_PUBLISH) {
+		mq_event(client, e);
+		return;
+	}
+	uint32_t start = k_cycle_get_32();
+	mq_event(client, e);
+	uint32_t cyc = k_cycle_get_32() - start;
+	PubTime.count++;
+	PubTime.cyc += cyc;
+	PubTime.max_cyc = MAX(PubTime.max_cyc, cyc);
+}
+
 // Handle network manager events (wifi up / wifi down)
 static void net_callback(
 	struct net_mgmt_event_callback *cb,
 	uint32_t mgmt_event,
 	struct net_if *iface
 ) {
+	const struct wifi_status *status = cb->info;
 	switch(mgmt_event) {
+	case NET_EVENT_WIFI_SCAN_RESULT:
+		zq3_wifi_scan_result(&Wifi, cb->info);
+		break;
+	case NET_EVENT_WIFI_SCAN_DONE:
+		LOG_INF("NET_EVENT_WIFI_SCAN_DONE");
+		zq3_wifi_scan_done(&Wifi);
+		break;
 	case NET_EVENT_WIFI_CONNECT_RESULT:
-		printk("NET_EVENT_WIFI_CONNECT_RESULT\n");
-		ZCtx.state = WIFI_UP;
+		LOG_INF("NET_EVENT_WIFI_CONNECT_RESULT: %d", status->status);
+		if (zq3_wifi_connect_result(&Wifi, status->status)) {
+			fsm_post(ZQ3_EV_WIFI_UP, 0);
+		}
 		break;
 	case NET_EVENT_WIFI_DISCONNECT_RESULT:
-		printk("NET_EVENT_WIFI_DISCONNECT_RESULT\n");
-		ZCtx.state = WIFI_ERR;
+		// The wifi manager reconnects by itself after a drop or to roam
+		LOG_INF("NET_EVENT_WIFI_DISCONNECT_RESULT");
+		fsm_post(zq3_wifi_disconnected(&Wifi) ?
+			ZQ3_EV_WIFI_DOWN : ZQ3_EV_WIFI_FAIL, 0);
 		break;
 	default:
-		printk("net: unknown event\n");
+		LOG_WRN("net: unknown event");
 	}
 }
 
@@ -139,46 +324,262 @@ static void net_callback(
 * SHELL COMMANDS
 */
 
-// Connect to Wifi
+// Connect to Wifi (the main loop does it, since it owns the wifi manager)
 static int cmd_wifi_up(const struct shell *shell, size_t argc, char *argv[]) {
-	return zq3_wifi_connect(ZCtx.ssid, ZCtx.psk);
+	zq3_wifi_request(&Wifi, ZQ3_WIFI_REQ_UP);
+	return 0;
 }
 
 // Disconnect from Wifi
 static int cmd_wifi_dn(const struct shell *shell, size_t argc, char *argv[]) {
-	return zq3_wifi_disconnect();
+	zq3_wifi_request(&Wifi, ZQ3_WIFI_REQ_DOWN);
+	return 0;
 }
 
-// Connect to MQTT broker
+// Show Wifi networks, signal strength, and scored APs from the scan cache
+static int cmd_wifi(const struct shell *shell, size_t argc, char *argv[]) {
+	zq3_wifi_print(&Wifi);
+	return 0;
+}
+
+// Connect to MQTT broker (the main loop starts the connect pipeline)
 static int cmd_up(const struct shell *shell, size_t argc, char *argv[]) {
-	int err = zq3_mqtt_connect(&MCtx);
-	if (err) {
-		ZCtx.state = MQTT_ERR;
-		return err;
+	if (Fsm.state >= CONNECTING) {
+		return -EALREADY;
 	}
-	ZCtx.state = CONNWAIT;
+	fsm_post(ZQ3_EV_MQTT_UP, 0);
 	return 0;
 }
 
-// Disconnect from MQTT broker
+// Disconnect from MQTT broker (or cancel a connection that's coming up) and
+// stay disconnected
 static int cmd_dn(const struct shell *shell, size_t argc, char *argv[]) {
-	int err = zq3_mqtt_disconnect(&MCtx);
+	fsm_post(ZQ3_EV_MQTT_DOWN, 0);
+	return 0;
+}
+
+// Show the connect worker and stage timing for the last connection attempt
+static int cmd_conn(const struct shell *shell, size_t argc, char *argv[]) {
+	zq3_conn_print(&Conn);
+	return 0;
+}
+
+// Show messages received vs. redraws for the toggle and layout widgets
+static int cmd_feeds(const struct shell *shell, size_t argc, char *argv[]) {
+	printk("%-6s %-16s %5d msgs, %5d redraws\n", "toggle", "(zq3/url)",
+		ZCtx.remote.puts, ZCtx.remote.takes);
+	printk("toggle echoes skipped %d, stale %d, expired %d\n", Echo.echoes,
+		Echo.stale, Echo.expired);
+	zq3_bind_print(&Bind);
+	return 0;
+}
+
+// List MQTT brokers (* marks the one in use)
+static int cmd_broker(const struct shell *shell, size_t argc, char *argv[]) {
+	zq3_broker_print(&BCtx);
+	return 0;
+}
+
+// Show LAN control status
+static int cmd_lan(const struct shell *shell, size_t argc, char *argv[]) {
+	zq3_lan_print(&LanCtx);
+	return 0;
+}
+
+// Benchmark chart widget memory and redraw time at different message rates
+static int cmd_chart(const struct shell *shell, size_t argc, char *argv[]) {
+	return zq3_bind_bench(&Bind);
+}
+
+// Show input stats, or measure input latency: input [rounds]
+static int cmd_input(const struct shell *shell, size_t argc, char *argv[]) {
+	if (argc < 2) {
+		zq3_input_print(&Input);
+		return 0;
+	}
+	int rounds = atoi(argv[1]);
+	if (rounds < 1) {
+		return -EINVAL;
+	}
+	return zq3_input_bench(&Input, rounds);
+}
+
+// Show display power state, wake latency, and average backlight level
+static int cmd_idle(const struct shell *shell, size_t argc, char *argv[]) {
+	zq3_idle_print(&Idle);
+	return 0;
+}
+
+// Show or change the display rotation: rot [0|90|180|270]
+static int cmd_rot(const struct shell *shell, size_t argc, char *argv[]) {
+	if (argc < 2) {
+		printk("Display rotation: %d\n", zq3_disp_rotation());
+		return 0;
+	}
+	int err = zq3_disp_request(atoi(argv[1]));
 	if (err) {
-		ZCtx.state = MQTT_ERR;
 		return err;
 	}
-	ZCtx.state = MQTT_ERR;  // CAUTION: WIFI_UP would trigger a reconnect
+	return zq3_persist_set(&Persist, "zq3/rot", argv[1], strlen(argv[1]) + 1);
+}
+
+// Show unsaved settings, flash write counts, and flash write latency
+static int cmd_persist(const struct shell *shell, size_t argc, char *argv[]) {
+	zq3_persist_print(&Persist);
+	return 0;
+}
+
+// Show the learned ping interval and ping stats
+static int
+cmd_keepalive(const struct shell *shell, size_t argc, char *argv[]) {
+	zq3_keepalive_print(&Keepalive);
+	return 0;
+}
+
+// Show OTA transfer progress, throughput, and RAM use
+static int cmd_ota(const struct shell *shell, size_t argc, char *argv[]) {
+	zq3_ota_print(&Ota);
+	return 0;
+}
+
+// Show PUBLISH handler time, and compare printk to deferred logging for the
+// same message: log [rounds]
+static int cmd_log(const struct shell *shell, size_t argc, char *argv[]) {
+	if (PubTime.count > 0) {
+		printk("PUBLISH handler: %d events, avg %d us, max %d us\n",
+			PubTime.count,
+			(int)(k_cyc_to_us_floor64(PubTime.cyc) / PubTime.count),
+			(int)k_cyc_to_us_floor32(PubTime.max_cyc));
+	} else {
+		printk("PUBLISH handler: no events yet\n");
+	}
+	if (argc < 2) {
+		return 0;
+	}
+	int rounds = atoi(argv[1]);
+	if (rounds < 1) {
+		return -EINVAL;
+	}
+	// Each message takes a few dozen bytes of the deferred log buffer. Past
+	// about half of it (leaving room for other modules), LOG_INF() would
+	// drop messages and this would time the drop path.
+	int max = CONFIG_LOG_BUFFER_SIZE / 64;
+	if (rounds > max) {
+		printk("%d rounds is the most that fits (CONFIG_LOG_BUFFER_SIZE)\n",
+			max);
+		rounds = max;
+	}
+	uint32_t start = k_cycle_get_32();
+	for (int i = 0; i < rounds; i++) {
+		printk("PUB GOT %c\n", '1');
+	}
+	uint32_t printk_cyc = k_cycle_get_32() - start;
+	start = k_cycle_get_32();
+	for (int i = 0; i < rounds; i++) {
+		LOG_INF("PUB GOT %c", '1');
+	}
+	uint32_t log_cyc = k_cycle_get_32() - start;
+	// Let the log thread catch up before printing the results
+	k_msleep(100);
+	printk("printk: %d us/msg, LOG_INF: %d us/msg (%d rounds)\n",
+		(int)(k_cyc_to_us_floor32(printk_cyc) / rounds),
+		(int)(k_cyc_to_us_floor32(log_cyc) / rounds), rounds);
+	return 0;
+}
+
+// Write unsaved settings to flash, then reboot
+static int cmd_reboot(const struct shell *shell, size_t argc, char *argv[]) {
+	int err = zq3_persist_flush(&Persist);
+	if (err) {
+		printk("ERR: flush before reboot: %d\n", err);
+	}
+	LOG_PANIC();   // print log messages that are still queued
+	sys_reboot(SYS_REBOOT_COLD);
+	return 0;
+}
+
+// Measure status message draw time for each font
+static int cmd_fonts(const struct shell *shell, size_t argc, char *argv[]) {
+	zq3_lvgl_font_bench(&LCtx);
+	return 0;
+}
+
+// Measure CA cert parsing time and mbed TLS heap use
+static int cmd_certs(const struct shell *shell, size_t argc, char *argv[]) {
+	zq3_cert_bench();
+	return 0;
+}
+
+// Benchmark TLS handshakes for each TLS profile: bench [rounds]
+static int cmd_bench(const struct shell *shell, size_t argc, char *argv[]) {
+	int rounds = (argc > 1) ? atoi(argv[1]) : 5;
+	if (rounds < 1) {
+		return -EINVAL;
+	}
+	// MQTT_ERR is the only state where the main loop leaves the MQTT client
+	// alone while wifi is up (you get there with `aio dn`)
+	if (Fsm.state != MQTT_ERR) {
+		printk("ERR: disconnect with `aio dn` first\n");
+		return -EBUSY;
+	}
+	return zq3_tls_bench(&MCtx, rounds);
+}
+
+// Start provisioning a TLS credential (see tools/provision_cred.py)
+static int
+cmd_cred_begin(const struct shell *shell, size_t argc, char *argv[])
+{
+	return zq3_cred_begin();
+}
+
+// Append hex encoded DER data to the credential being provisioned
+static int cmd_cred_hex(const struct shell *shell, size_t argc, char *argv[]) {
+	for (int i = 1; i < argc; i++) {
+		int err = zq3_cred_append_hex(argv[i]);
+		if (err) {
+			return err;
+		}
+	}
 	return 0;
 }
 
+// Save the credential being provisioned as zq3/cred/<name>
+static int
+cmd_cred_save(const struct shell *shell, size_t argc, char *argv[])
+{
+	return zq3_cred_save(argv[1]);
+}
+
+// Only use flash credentials for one broker hostname
+static int
+cmd_cred_host(const struct shell *shell, size_t argc, char *argv[])
+{
+	return zq3_cred_set_host(argv[1]);
+}
+
+// Delete zq3/cred/<name>
+static int cmd_cred_del(const struct shell *shell, size_t argc, char *argv[]) {
+	return zq3_cred_delete(argv[1]);
+}
+
+// List TLS credentials saved in flash
+static int
+cmd_cred_list(const struct shell *shell, size_t argc, char *argv[])
+{
+	return zq3_cred_list();
+}
+
 // Reload settings. (you can use this after `settings write ...`)
 static int cmd_reload(const struct shell *shell, size_t argc, char *argv[]) {
 	// Clear wifi and MQTT settings from context struct
-	memset(ZCtx.ssid, 0, sizeof(ZCtx.ssid));
-	memset(ZCtx.psk, 0, sizeof(ZCtx.psk));
-	ZCtx.mqtt_ok = false;
+	zq3_wifi_clear(&Wifi);
+	zq3_broker_init(&BCtx);
+	zq3_lan_set_token(&LanCtx, "", 0);
 	// Load saved settings
-	return settings_load();
+	int err = settings_load();
+	ZCtx.mqtt_ok = zq3_broker_first(&BCtx, &MCtx) == 0;
+	zq3_lan_open(&LanCtx);
+	return err;
 }
 
 
@@ -199,61 +600,389 @@ static int cmd_reload(const struct shell *shell, size_t argc, char *argv[]) {
 static int
 set_cb(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg)
 {
+	if (strcmp("otamap", key) == 0) {
+		// Chunks of an unfinished firmware update (the app writes this)
+		return zq3_ota_load(&Ota, len, read_cb, cb_arg);
+	}
 	char buf[256];
 	if (len >= sizeof(buf)) {
-		printk("setting value for key '%s' is too big: %d\n", key, len);
+		LOG_ERR("setting value for key '%s' is too big: %d", key, len);
 		return -EMSGSIZE;
 	}
 	int rc = read_cb(cb_arg, buf, sizeof(buf));
 	if (rc < 0) {
-		printk("ERR: settings read_cb(%s) = %d\n", key, rc);
+		LOG_ERR("settings read_cb(%s) = %d", key, rc);
 		return rc;
 	}
 	buf[sizeof(buf)-1] = '\0';  // make sure string is null terminated
 	int vlen = strlen(buf);
-	if (strcmp("url", key) == 0) {
-		// Parse MQTT URL and save components to context struct
+	if (strncmp("url", key, 3) == 0) {
+		// Save MQTT broker URL to the broker list (zq3/url is rank 0, then
+		// zq3/url1, zq3/url2, ...). The URL gets parsed when the broker
+		// connection manager picks it.
 		if (vlen >= ZQ3_MQTT_URL_MAX_LEN) {
-			printk("ERR: setting for '%s' is too long: %d\n", key, vlen);
+			LOG_ERR("setting for '%s' is too long: %d", key, vlen);
 			return -EOVERFLOW;
 		}
-		int err = zq3_url_parse(&MCtx, buf);
+		int rank = (key[3] == '\0') ? 0 : atoi(&key[3]);
+		if (rank == 0 && key[3] != '\0') {
+			LOG_ERR("bad broker url key '%s'", key);
+			return -EINVAL;
+		}
+		int err = zq3_broker_set_url(&BCtx, rank, buf);
 		if (err) {
-			printk("ERR settings: failed to parse url: %d\n", err);
-			ZCtx.mqtt_ok = false;
 			return err;
 		}
-		// Success
-		ZCtx.mqtt_ok = true;
-	} else if (strcmp("ssid", key) == 0) {
-		// Save Wifi SSID to context struct
-		if (vlen >= sizeof(ZCtx.ssid)) {
-			printk("ERR: setting for '%s' is too long: %d\n", key, vlen);
-			return -EOVERFLOW;
+	} else if (strncmp("ssid", key, 4) == 0 || strncmp("psk", key, 3) == 0) {
+		// Save Wifi SSID or passphrase to the network list (zq3/ssid and
+		// zq3/psk are network 0, then zq3/ssid1 and zq3/psk1, ...)
+		int err = zq3_wifi_set(&Wifi, key, buf, vlen);
+		if (err) {
+			return err;
 		}
-		memset(ZCtx.ssid, 0, sizeof(ZCtx.ssid));
-		memcpy(ZCtx.ssid, buf, vlen);
-	} else if (strcmp("psk", key) == 0) {
-		// Save Wifi passphrase to context struct
-		if (vlen >= sizeof(ZCtx.psk)) {
-			printk("ERR: setting for '%s' is too long: %d\n", key, vlen);
-			return -EOVERFLOW;
+	} else if (strcmp("cid", key) == 0) {
+		// MQTT client id for persistent sessions (app writes this itself)
+		int err = zq3_mqtt_set_client_id(&MCtx, buf, vlen);
+		if (err) {
+			LOG_ERR("setting for '%s' is bad: %d", key, err);
+			return err;
 		}
-		memset(ZCtx.psk, 0, sizeof(ZCtx.psk));
-		memcpy(ZCtx.psk, buf, vlen);
+	} else if (strcmp("mqttv", key) == 0) {
+		// MQTT protocol version: "5" for MQTT 5.0, otherwise MQTT 3.1.1
+		int err = zq3_mqtt_set_version(&MCtx, strcmp(buf, "5") == 0);
+		if (err) {
+			return err;
+		}
+	} else if (strcmp("tls", key) == 0) {
+		// Select TLS profile (compat, rsa, or ecdsa)
+		int err = zq3_tls_set_profile(buf);
+		if (err) {
+			return err;
+		}
+	} else if (strcmp("layout", key) == 0) {
+		// Dashboard layout (widgets bound to feeds, used at boot)
+		int err = zq3_bind_set_layout(&Bind, buf, vlen);
+		if (err) {
+			LOG_ERR("setting for '%s' is too long: %d", key, vlen);
+			return err;
+		}
+	} else if (strcmp("rot", key) == 0) {
+		// Display rotation in degrees (0, 90, 180, or 270)
+		int err = zq3_disp_request(atoi(buf));
+		if (err) {
+			return err;
+		}
+		zq3_persist_loaded(&Persist, "zq3/rot", buf, vlen);
+	} else if (strcmp("lantok", key) == 0) {
+		// Shared secret for LAN control (empty or missing means disabled)
+		int err = zq3_lan_set_token(&LanCtx, buf, vlen);
+		if (err) {
+			LOG_ERR("setting for '%s' is too long: %d", key, vlen);
+			return err;
+		}
+	} else if (strncmp("ka", key, 2) == 0) {
+		// Learned ping interval for a wifi network (the app writes these)
+		int err = zq3_keepalive_set(&Keepalive, key, buf, vlen);
+		if (err) {
+			return err;
+		}
+	} else if (strcmp("ota", key) == 0) {
+		// Topic prefix for firmware updates (empty or missing means disabled)
+		int err = zq3_ota_set_prefix(&Ota, buf, vlen);
+		if (err) {
+			LOG_ERR("setting for '%s' is too long: %d", key, vlen);
+			return err;
+		}
+	} else if (strcmp("toggle", key) == 0) {
+		// Restore toggle state snapshot (the app writes this key itself)
+		switch (buf[0]) {
+		case '0':
+			ZCtx.snapshot = OFF;
+			break;
+		case '1':
+			ZCtx.snapshot = ON;
+			break;
+		default:
+			ZCtx.snapshot = UNKNOWN;
+		}
+		zq3_persist_loaded(&Persist, "zq3/toggle", buf, vlen);
 	}
-	printk("Settings SET: '%s'\n", key);
+	LOG_INF("Settings SET: '%s'", key);
 	return 0;
 }
 
 
 /*
-* KEYPAD BUTTON PRESS CALLBACK
+* TOGGLE STATE SNAPSHOT
 */
 
-// Callback to handle keypad input events
-static void keypad_pressed_callback(lv_event_t *event) {
-	ZCtx.keypress = true;
+// Save toggle state so a reconnect (or the next boot) can show the toggle
+// switch right away instead of waiting for the broker. The flash write
+// happens later (see zq3_persist.c), so quick toggling costs one write.
+static void save_snapshot(zq3_toggle toggle) {
+	if (toggle == UNKNOWN || toggle == ZCtx.snapshot) {
+		return;
+	}
+	const char *value = (toggle == ON) ? "1" : "0";
+	if (zq3_persist_set(&Persist, "zq3/toggle", value, 2) == 0) {
+		ZCtx.snapshot = toggle;
+	}
+}
+
+
+/*
+* STATE MACHINE HOOKS (zq3_fsm.c calls these from the main loop)
+*/
+
+// Uptime when the broker got asked for the toggle value
+static int64_t sync_start = 0;
+
+static int fsm_wifi_connect(void *arg) {
+	LOG_INF("starting wifi connection");
+	int err = zq3_wifi_connect(&Wifi);
+	if (err) {
+		LOG_ERR("wifi connect: %d", err);
+	}
+	return err;
+}
+
+// Attempt to connect to the MQTT broker (once). DNS, TCP, TLS and CONNECT
+// run in the worker thread, and the progress events come back in the main
+// loop.
+static void fsm_connect(void *arg) {
+	zq3_conn_start(&Conn);
+}
+
+static void fsm_cancel(void *arg) {
+	zq3_conn_cancel(&Conn);
+}
+
+// Drop what's left of an MQTT connection (after an error, or from before
+// wifi went down). If the connect worker owns the client, cancel it, and
+// zq3_conn_poll() drops the connection if it came up anyway.
+static void fsm_drop(void *arg) {
+	if (zq3_conn_busy(&Conn)) {
+		zq3_conn_cancel(&Conn);
+	} else {
+		zq3_mqtt_abort(&MCtx);
+	}
+}
+
+static void fsm_disconnect(void *arg) {
+	zq3_mqtt_disconnect(&MCtx);
+}
+
+static void fsm_first_broker(void *arg) {
+	zq3_broker_first(&BCtx, &MCtx);
+}
+
+// Line up the next broker. Subscribing and publishing the pending toggle
+// state happen through the usual CONNACK -> READY sequence.
+static int64_t fsm_failover(void *arg) {
+	if (!ZCtx.mqtt_ok) {
+		return -1;   // bad settings, so retrying won't help
+	}
+	return zq3_broker_failover(&BCtx, &MCtx);
+}
+
+// List the topics to subscribe to besides the toggle topic (layout widget
+// and OTA topics), and return how many there are
+static int sub_topics(const char *extra[ZQ3_MQTT_MAX_TOPICS - 1]) {
+	// Topics for layout widgets depend on which broker this is
+	int n = zq3_bind_topics(&Bind, (const char *)MCtx.topic);
+	memcpy(extra, Bind.topics, n * sizeof(extra[0]));
+	if (zq3_ota_filter(&Ota)) {
+		extra[n++] = zq3_ota_filter(&Ota);
+	}
+	return n;
+}
+
+// FNV-1a hash of the broker hostname and the topics to subscribe to
+static uint32_t sub_topics_hash(void) {
+	const char *extra[ZQ3_MQTT_MAX_TOPICS - 1];
+	int n = sub_topics(extra);
+	const char *strs[ZQ3_MQTT_MAX_TOPICS + 1] = {
+		(const char *)MCtx.hostname, (const char *)MCtx.topic,
+	};
+	memcpy(&strs[2], extra, n * sizeof(extra[0]));
+	uint32_t h = 2166136261u;
+	for (int i = 0; i < n + 2; i++) {
+		// The NUL goes in too, so {"ab", "c"} and {"a", "bc"} differ
+		const char *p = strs[i];
+		do {
+			h = (h ^ (uint8_t)*p) * 16777619u;
+		} while (*p++);
+	}
+	return h ? h : 1;
+}
+
+// Check if a resumed session still has our subscriptions. That's only known
+// if we subscribed to the same topics on the same broker earlier this boot.
+// Otherwise (after a reboot with a new zq3/layout, say) subscribe again,
+// which is harmless for topics the session already has.
+static bool fsm_subscribed(void *arg) {
+	return SubHash == sub_topics_hash();
+}
+
+// Subscribe to the topic (plus layout widget and OTA topics). If the broker
+// kept our persistent session with the same subscriptions, we're still
+// subscribed, and any QoS 1 messages we missed are on the way.
+static int fsm_subscribe(void *arg, bool resumed) {
+	if (resumed) {
+		LOG_INF("Resuming MQTT session (no SUBSCRIBE needed)");
+		return 0;
+	}
+	const char *extra[ZQ3_MQTT_MAX_TOPICS - 1];
+	int n = sub_topics(extra);
+	// Until the SUBACK, the broker's session may not have any of them
+	SubHash = 0;
+	SubHashPending = sub_topics_hash();
+	return zq3_mqtt_subscribe(&MCtx, extra, n);
+}
+
+// Subscribed (or resumed a session), so ask the broker for current values,
+// since retained values may have changed while we were away. With an
+// unpublished local change (e.g. from before a failover), the state machine
+// skips asking for the toggle value, since the local change wins.
+static int fsm_sync(void *arg, bool get_toggle) {
+	// Current values for the layout widgets (these don't hold up the sync,
+	// since widgets just update when they arrive)
+	for (int i = 0; i < Bind.count; i++) {
+		if (strlen(Bind.b[i].topic) > 0) {
+			zq3_mqtt_get_topic(&MCtx, Bind.b[i].topic);
+		}
+	}
+	sync_start = k_uptime_get();
+	if (!get_toggle) {
+		return 0;
+	}
+	int err = zq3_mqtt_get(&MCtx);
+	if (err) {
+		return err;
+	}
+	// If there's a saved value from last time, show it now rather than
+	// making the user stare at "Connecting..." until the broker answers. The
+	// answer will correct it if needed.
+	if (ZCtx.toggle == UNKNOWN && ZCtx.snapshot != UNKNOWN) {
+		ZCtx.toggle = ZCtx.snapshot;
+		zq3_lvgl_set_toggle(&LCtx, ZCtx.toggle == ON);
+		zq3_lvgl_show_toggle(&LCtx);
+	}
+	return 0;
+}
+
+static bool fsm_pending(void *arg) {
+	return ZCtx.publish_pending;
+}
+
+// MQTT is up and ready: click means toggle the switch and publish its new
+// value.
+//
+// This will apply the following transformations to .toggle:
+//   UKNOWN becomes ON
+//   OFF    becomes ON
+//   ON     becomes OFF
+static void fsm_toggle(void *arg) {
+	bool new_state = ZCtx.toggle != ON;
+	ZCtx.toggle = new_state ? ON : OFF;
+	ZCtx.publish_pending = true;
+}
+
+// Update the GUI when the Wifi/MQTT connection state changes
+static void fsm_entered(void *arg, zq3_state from, zq3_state to) {
+	LOG_INF("[%s]", zq3_fsm_state_name(to));
+	switch (to) {
+	case OFFLINE:
+		// This happens when wifi disconnects for some reason
+		zq3_idle_activity(&Idle);
+		zq3_lvgl_wifi_status(&LCtx, false);
+		zq3_lvgl_show_message(&LCtx, ZQ3_MSG_OFFLINE);
+		break;
+	case WIFI_ERR:
+		zq3_idle_activity(&Idle);
+		zq3_lvgl_wifi_status(&LCtx, false);
+		zq3_lvgl_show_message(&LCtx, ZQ3_MSG_WIFI_ERR);
+		break;
+	case WIFIWAIT:
+		zq3_lvgl_wifi_status(&LCtx, false);
+		zq3_lvgl_show_message(&LCtx, ZQ3_MSG_CONNECTING);
+		break;
+	case CONNECTING:
+		// Light up the wifi icon in the statusbar
+		zq3_lvgl_wifi_status(&LCtx, true);
+		break;
+	case MQTT_ERR:
+		// Problem with MQTT settings, broker unreachable, etc. (the state
+		// machine set a timer if it's going to try the next broker)
+		zq3_lvgl_show_message(&LCtx,
+			Fsm.timer_at ? ZQ3_MSG_MQTT_RETRY : ZQ3_MSG_MQTT_ERR);
+		break;
+	case READY:
+		LOG_INF("sync took %d ms", (int)(k_uptime_get() - sync_start));
+		zq3_broker_ready(&BCtx);
+		zq3_idle_activity(&Idle);
+
+		// Reaching the broker proves a new OTA image works, so keep it
+		zq3_ota_confirm(&Ota);
+
+		// If the broker didn't answer in time, fall back to the value saved
+		// in NVM flash (which may also be UNKNOWN/not-checked)
+		if (ZCtx.toggle == UNKNOWN) {
+			ZCtx.toggle = ZCtx.snapshot;
+		}
+		zq3_lvgl_set_toggle(&LCtx, ZCtx.toggle == ON);
+
+		// Show the toggle switch in place of the status message
+		zq3_lvgl_show_toggle(&LCtx);
+		break;
+	default:
+		break;
+	}
+}
+
+static const zq3_fsm_ops FsmOps = {
+	.wifi_connect = fsm_wifi_connect,
+	.connect = fsm_connect,
+	.cancel = fsm_cancel,
+	.drop = fsm_drop,
+	.disconnect = fsm_disconnect,
+	.first_broker = fsm_first_broker,
+	.failover = fsm_failover,
+	.subscribed = fsm_subscribed,
+	.subscribe = fsm_subscribe,
+	.sync = fsm_sync,
+	.pending = fsm_pending,
+	.toggle = fsm_toggle,
+	.entered = fsm_entered,
+};
+
+
+/*
+* BUTTON HANDLERS (these run in the main loop, see zq3_input.c)
+*/
+
+// Look at each new press first. If the display is asleep, the press just
+// wakes it up.
+static bool input_filter(const zq3_input_event *ev) {
+	return zq3_idle_press(&Idle, ev->at);
+}
+
+// Main action: connect, retry, cancel, or flip the toggle switch (see the
+// PRESS rows in zq3_fsm.c)
+static void on_click(const zq3_input_event *ev) {
+	if (!fsm_event(ZQ3_EV_PRESS, 0)) {
+		LOG_INF("Button clicked (NOP)");
+	}
+}
+
+// Long press: rotate the display 90 degrees clockwise (and save it)
+static void on_long_press(const zq3_input_event *ev) {
+	int degrees = (zq3_disp_rotation() + 90) % 360;
+	char value[4];
+	snprintk(value, sizeof(value), "%d", degrees);
+	if (zq3_disp_request(degrees) == 0) {
+		zq3_persist_set(&Persist, "zq3/rot", value, strlen(value) + 1);
+	}
 }
 
 
@@ -261,6 +990,23 @@ static void keypad_pressed_callback(lv_event_t *event) {
 * STATIC CALLBACK MACROS (shell & settings)
 */
 
+// These macros add the `aio cred *` shell commands for provisioning TLS
+// credentials (DER certs and keys) to NVM flash.
+//
+SHELL_STATIC_SUBCMD_SET_CREATE(cred_cmds,
+	SHELL_CMD(begin, NULL, "Start new credential", cmd_cred_begin),
+	SHELL_CMD_ARG(hex, NULL, "Append DER data: hex <hex>", cmd_cred_hex,
+		2, 8),
+	SHELL_CMD_ARG(save, NULL, "Save: save <ca0|ca1|ca2|crt|key>",
+		cmd_cred_save, 2, 0),
+	SHELL_CMD_ARG(host, NULL, "Only use for broker: host <hostname>",
+		cmd_cred_host, 2, 0),
+	SHELL_CMD_ARG(del, NULL, "Delete: del <ca0|ca1|ca2|crt|key|host>",
+		cmd_cred_del, 2, 0),
+	SHELL_CMD(list, NULL, "List saved credentials", cmd_cred_list),
+	SHELL_SUBCMD_SET_END
+);
+
 // These macros add the `aio *` shell commands for controlling the MQTT broker
 // connection in the Zephyr shell over USB serial. MQTT broker config gets
 // read from 'zq3/url' setting stored in NVM flash (`settings write ...`).
@@ -268,9 +1014,32 @@ static void keypad_pressed_callback(lv_event_t *event) {
 SHELL_STATIC_SUBCMD_SET_CREATE(aio_cmds,
 	SHELL_CMD(wifi_up, NULL, "Wifi connect", cmd_wifi_up),
 	SHELL_CMD(wifi_dn, NULL, "Wifi disconnect", cmd_wifi_dn),
+	SHELL_CMD(wifi, NULL, "Wifi networks and scan cache", cmd_wifi),
 	SHELL_CMD(up, NULL, "AIO MQTT broker connect", cmd_up),
 	SHELL_CMD(dn, NULL, "AIO MQTT broker disconnect", cmd_dn),
 	SHELL_CMD(reload, NULL, "Reload settings", cmd_reload),
+	SHELL_CMD(broker, NULL, "List MQTT brokers", cmd_broker),
+	SHELL_CMD(conn, NULL, "Broker connect stage timing", cmd_conn),
+	SHELL_CMD(lan, NULL, "LAN control status", cmd_lan),
+	SHELL_CMD(chart, NULL, "Benchmark chart widget redraws", cmd_chart),
+	SHELL_CMD(feeds, NULL, "Messages vs. redraws per feed", cmd_feeds),
+	SHELL_CMD_ARG(input, NULL, "Input stats or latency: input [rounds]",
+		cmd_input, 1, 1),
+	SHELL_CMD(idle, NULL, "Display power stats", cmd_idle),
+	SHELL_CMD_ARG(rot, NULL, "Display rotation: rot [0|90|180|270]",
+		cmd_rot, 1, 1),
+	SHELL_CMD(persist, NULL, "Unsaved settings and flash writes",
+		cmd_persist),
+	SHELL_CMD(reboot, NULL, "Save settings and reboot", cmd_reboot),
+	SHELL_CMD(keepalive, NULL, "Learned ping interval", cmd_keepalive),
+	SHELL_CMD(ota, NULL, "Firmware update status", cmd_ota),
+	SHELL_CMD_ARG(log, NULL, "Logging latency: log [rounds]", cmd_log,
+		1, 1),
+	SHELL_CMD(fonts, NULL, "Benchmark font rendering", cmd_fonts),
+	SHELL_CMD(certs, NULL, "Benchmark CA cert parsing", cmd_certs),
+	SHELL_CMD(cred, &cred_cmds, "TLS credentials in NVM flash", NULL),
+	SHELL_CMD_ARG(bench, NULL, "Benchmark TLS profiles: bench [rounds]",
+		cmd_bench, 1, 1),
 	SHELL_SUBCMD_SET_END
 );
 
@@ -284,162 +1053,188 @@ SETTINGS_STATIC_HANDLER_DEFINE(zq3, "zq3", NULL, set_cb, NULL, NULL);
 
 int main(void) {
 	// Inits
+	MainThread = k_current_get();
 	struct net_mgmt_event_callback net_status;
-	zq3_lvgl_context LCtx;
-	zq3_lvgl_init(&LCtx, keypad_pressed_callback);
+	zq3_lvgl_init(&LCtx);
+	zq3_disp_init();
+	zq3_idle_init(&Idle);
+	zq3_input_init(&Input, input_filter);
+	zq3_input_on(&Input, INPUT_KEY_ENTER, ZQ3_INPUT_CLICK, on_click);
+	zq3_input_on(&Input, INPUT_KEY_ENTER, ZQ3_INPUT_LONG, on_long_press);
+	// Optional extra button and touch pad (see app/inputs.overlay). The
+	// touch pad needs a double-tap so a brush of the hand doesn't count.
+	zq3_input_on(&Input, INPUT_KEY_1, ZQ3_INPUT_CLICK, on_click);
+	zq3_input_on(&Input, INPUT_KEY_1, ZQ3_INPUT_LONG, on_long_press);
+	zq3_input_on(&Input, INPUT_KEY_0, ZQ3_INPUT_DOUBLE, on_click);
 	SHELL_CMD_REGISTER(aio, &aio_cmds, "Adafruit IO MQTT commands", NULL);
 	zq3_mqtt_init(&MCtx, mq_handler);
+	zq3_broker_init(&BCtx);
+	zq3_echo_init(&Echo);
+	zq3_persist_init(&Persist);
+	zq3_keepalive_init(&Keepalive);
+	zq3_ota_init(&Ota);
+	zq3_wifi_init(&Wifi);
+	zq3_lan_init(&LanCtx);
+	zq3_conn_init(&Conn, &MCtx);
+	zq3_lan_add_wake_fd(&LanCtx, zq3_input_fd());
+	zq3_lan_add_wake_fd(&LanCtx, zq3_conn_fd());
 	settings_subsys_init();
 
 	// Get settings from NVM flash using the Settings API
-	printk("Loading Settings\n");
+	LOG_INF("Loading Settings");
 	settings_load();
 
-	// Register to get updates about wifi connection status
+	// Rotate the display if zq3/rot differs from the devicetree rotation
+	zq3_disp_apply();
+
+	// Start with the most preferred broker
+	ZCtx.mqtt_ok = zq3_broker_first(&BCtx, &MCtx) == 0;
+
+	// Make the widgets for the dashboard layout (if zq3/layout is set)
+	zq3_bind_init(&Bind, &LCtx);
+
+	// Listen for LAN control requests (if zq3/lantok is set)
+	zq3_lan_open(&LanCtx);
+
+	// Make a stable MQTT client id the first time the app runs
+	if (MCtx.client.client_id.size == 0) {
+		if (zq3_mqtt_default_client_id(&MCtx) == 0) {
+			settings_save_one("zq3/cid", MCtx.client_id_buf,
+				strlen(MCtx.client_id_buf) + 1);
+		}
+	}
+	LOG_INF("MQTT client id: %s", MCtx.client_id_buf);
+
+	// Register to get updates about wifi scans and connection status
 	net_mgmt_init_event_callback(&net_status, net_callback,
+		NET_EVENT_WIFI_SCAN_RESULT | NET_EVENT_WIFI_SCAN_DONE |
 		NET_EVENT_WIFI_CONNECT_RESULT | NET_EVENT_WIFI_DISCONNECT_RESULT);
 	net_mgmt_add_event_callback(&net_status);
 
 	// Event loop
-	zq3_state prev_state = ZCtx.state;
+	zq3_fsm_init(&Fsm, &FsmOps, NULL, CONFIG_ZQ3_BROKER_TIMEOUT_MS,
+		CONFIG_ZQ3_SYNC_TIMEOUT_MS);
 	zq3_toggle prev_toggle = ZCtx.toggle;
 	zq3_lvgl_timer_handler();
-	const char *offline_message = "Press\nBOOT button\nto connect";
-	zq3_lvgl_show_message(&LCtx, offline_message);
+	zq3_lvgl_show_message(&LCtx, ZQ3_MSG_OFFLINE);
 	while(1) {
 		int err;
-		// Update GUI when Wifi/MQTT connection state changes
-		if (prev_state != ZCtx.state) {
-			prev_state = ZCtx.state;
-			switch(ZCtx.state) {
-			case OFFLINE:
-				// This happens when wifi disconnects for some reason
-				printk("[OFFLINE]\n");
-				zq3_lvgl_wifi_status(&LCtx, false);
-				zq3_lvgl_show_message(&LCtx, offline_message);
-				break;
-			case WIFI_ERR:
-				printk("[WIFI_ERR]\n");
-				zq3_lvgl_wifi_status(&LCtx, false);
-				zq3_lvgl_show_message(&LCtx, "Wifi Error\n(check settings)");
-				break;
-			case WIFIWAIT:
-				printk("[WIFIWAIT]\n");
-				zq3_lvgl_show_message(&LCtx, "Connecting...");
-				break;
-			case WIFI_UP:
-				// Light up the wifi icon in the statusbar
-				printk("[WIFI_UP]\n");
-				zq3_lvgl_wifi_status(&LCtx, true);
-				// Attempt to connect to the MQTT broker (once)
-				int err = zq3_mqtt_connect(&MCtx);
-				if (err) {
-					ZCtx.state = MQTT_ERR;
-				} else {
-					ZCtx.state = CONNWAIT;
-				}
-				break;
-			case MQTT_ERR:
-				// Problem with MQTT settings, broker unreachable, etc.
-				printk("[MQTT_ERR]\n");
-				zq3_lvgl_show_message(&LCtx, "MQTT Error\n(check settings)");
-				break;
-			case CONNWAIT:
-				// MQTT is connecting... just wait silently
-				printk("[CONWAIT]\n");
-				break;
-			case CONNACK:
-				// MQTT connected, so subscribe to topic
-				printk("[CONNACK]\n");
-				err = zq3_mqtt_subscribe(&MCtx);
-				if (err) {
-					ZCtx.state = MQTT_ERR;
-				} else {
-					ZCtx.state = SUBWAIT;
-				}
-				break;
-			case SUBWAIT:
-				printk("[SUBWAIT]\n");
-				break;
-			case SUBACK:
-				printk("[SUBACK]\n");
-				ZCtx.state = READY;
-				break;
-			case READY:
-				printk("[READY]\n");
+		// Handle events from the wifi and shell threads
+		fsm_msg msg;
+		while (k_msgq_get(&FsmQueue, &msg, K_NO_WAIT) == 0) {
+			fsm_event(msg.ev, msg.arg);
+		}
 
-				// Reset toggle switch state to UNKNOWN/not-checked. It would
-				// be possible to ask the broker for the topic's old value, but
-				// I'm skipping that to keep the code simpler.
-				ZCtx.toggle = UNKNOWN;
-				zq3_lvgl_set_toggle(&LCtx, false);
+		// Give up on a broker that accepted the connection but went quiet,
+		// or stop waiting for the broker to send the toggle value
+		int64_t now = k_uptime_get();
+		if (Fsm.timer_at && now >= Fsm.timer_at) {
+			if (Fsm.state == CONNWAIT || Fsm.state == SUBWAIT) {
+				LOG_ERR("broker timeout");
+			} else if (Fsm.state == SYNCWAIT) {
+				LOG_INF("sync: no answer from broker, using saved value");
+			}
+		}
+		zq3_fsm_poll(&Fsm, now);
 
-				// Show the toggle switch in place of the status message
-				zq3_lvgl_show_toggle(&LCtx);
+		// Follow the connect pipeline. Stale events (from before a
+		// cancel, or after wifi went down) get ignored.
+		zq3_conn_event cev;
+		while (zq3_conn_poll(&Conn, &cev)) {
+			if (Fsm.state != CONNECTING) {
+				continue;
+			}
+			switch (cev.stage) {
+			case ZQ3_CONN_RESOLVE:
+				zq3_lvgl_show_progress(&LCtx, ZQ3_MSG_RESOLVE);
 				break;
+			case ZQ3_CONN_CREDS:
+				zq3_lvgl_show_progress(&LCtx, ZQ3_MSG_CREDS);
+				break;
+			case ZQ3_CONN_OPEN:
+				zq3_lvgl_show_progress(&LCtx, ZQ3_MSG_OPEN);
+				break;
+			default:
+				fsm_event(ZQ3_EV_CONN_DONE, cev.err);
 			}
 		}
 
 		// Maintain MQTT connection
-		if (ZCtx.state >= CONNWAIT) {
+		if (Fsm.state >= CONNWAIT) {
 			// Respond to incoming MQTT messages if needed
 			zq3_mqtt_poll(&MCtx);
-			// Keep the connection up with pings
-			zq3_mqtt_keepalive(&MCtx);
-		}
-
-		// If keypad press callback set the button press flag, handle it
-		if (ZCtx.keypress) {
-			ZCtx.keypress = false;
-			switch(ZCtx.state) {
-			case WIFI_ERR:
-				// Retry from error state (maybe after changing settings)...
-				// fall through to the OFFLINE case
-			case OFFLINE:
-				// Attempt to start a wifi connection
-				printk("starting wifi connection\n");
-				err = zq3_wifi_connect(ZCtx.ssid, ZCtx.psk);
-				if (err) {
-					ZCtx.state = WIFI_ERR;
-					printk("ERR: wifi connect: %d\n", err);
-				} else {
-					ZCtx.state = WIFIWAIT;
-				}
-				break;
-			case MQTT_ERR:
-				// Trigger an MQTT connection retry attempt (maybe after
-				// changing settings, fixing the MQTT broker, or whatever)
-				ZCtx.state = WIFI_UP;
-				break;
-			case READY:
-				// MQTT is up and ready: key press means toggle the switch
-				// and publish its new value.
-				//
-				// This will apply the following transformations to .toggle:
-				//   UKNOWN becomes ON
-				//   OFF    becomes ON
-				//   ON     becomes OFF
-				bool new_state = ZCtx.toggle != ON;
-				ZCtx.toggle = new_state ? ON : OFF;
-				printk("Publishing toggle state: %d\n", new_state ? 1 : 0);
-				err = zq3_mqtt_publish(&MCtx, new_state);
-				if (err) {
-					ZCtx.state = MQTT_ERR;
-				}
-				break;
-			default:
-				printk("Keypad pressed (NOP)\n");
+		}
+		if (Fsm.state > CONNWAIT) {
+			// Keep the connection up with pings, and notice when a ping
+			// doesn't come back (the router forgot the connection)
+			if (zq3_keepalive_poll(&Keepalive, &MCtx)) {
+				fsm_event(ZQ3_EV_MQTT_ERR, 0);
 			}
 		}
 
+		// After failing over, go back to the preferred broker once the
+		// fallback connection has been up for a while (but not with an
+		// unpublished toggle change)
+		if (Fsm.state == READY && zq3_broker_should_failback(&BCtx) &&
+			fsm_event(ZQ3_EV_FAILBACK, 0))
+		{
+			LOG_INF("Trying preferred broker again");
+		}
+
+		// Connect to the next AP after a failure, or roam to a better AP
+		// before the signal gets too weak to use
+		err = zq3_wifi_poll(&Wifi);
+		if (err == ZQ3_WIFI_ROAM) {
+			fsm_event(ZQ3_EV_ROAM, 0);
+			zq3_wifi_roam(&Wifi);
+		} else if (err < 0) {
+			fsm_event(ZQ3_EV_WIFI_FAIL, 0);
+		}
+
+		// Run handlers for button presses, clicks, and long presses
+		zq3_input_poll(&Input);
+
+		// Handle LAN control requests. A toggle change from the LAN shows up
+		// right away and gets mirrored to MQTT by the publish code below.
+		zq3_lan_poll(&LanCtx, &ZCtx);
+
 		// Check if MQTT message requested a change to the toggle state
-		if (ZCtx.got_0) {
-			ZCtx.got_0 = false;
-			ZCtx.toggle = OFF;
+		// (only the newest value counts). A local change that hasn't been
+		// published yet is newer than anything from the broker, so it wins.
+		uint8_t remote;
+		bool got_value = zq3_mbox_take(&ZCtx.remote, &remote, 1) > 0;
+		if (got_value && !ZCtx.publish_pending) {
+			ZCtx.toggle = (remote == '1') ? ON : OFF;
 		}
-		if (ZCtx.got_1) {
-			ZCtx.got_1 = false;
-			ZCtx.toggle = ON;
+		if (got_value) {
+			fsm_event(ZQ3_EV_VALUE, 0);
+		}
+
+		// Publish the toggle state if it changed locally. If too many QoS 1
+		// publishes are waiting for PUBACK (MQTT 5 Receive Maximum), leave
+		// it pending and try again on the next pass through the loop.
+		if (Fsm.state == READY && ZCtx.publish_pending) {
+			bool on = ZCtx.toggle == ON;
+			err = zq3_mqtt_publish(&MCtx, on);
+			if (err == 0) {
+				LOG_INF("Published toggle state: %d", on ? 1 : 0);
+				ZCtx.publish_pending = false;
+				zq3_echo_sent(&Echo, on ? '1' : '0', k_uptime_get());
+			} else if (err != -EBUSY) {
+				fsm_event(ZQ3_EV_MQTT_ERR, 0);
+			}
+		}
+
+		// Update layout widgets that got new values
+		zq3_bind_apply(&Bind);
+
+		// Verify a finished firmware download a piece at a time, and reboot
+		// into it when the sender asks
+		if (zq3_ota_poll(&Ota, &MCtx, Fsm.state == READY) == ZQ3_OTA_BOOT) {
+			LOG_INF("Rebooting into new firmware");
+			zq3_persist_flush(&Persist);
+			LOG_PANIC();
+			sys_reboot(SYS_REBOOT_COLD);
 		}
 
 		// Update toggle button widget if toggle stated has changed
@@ -456,10 +1251,26 @@ int main(void) {
 				zq3_lvgl_set_toggle(&LCtx, true);
 				break;
 			}
+			save_snapshot(ZCtx.toggle);
+			zq3_idle_activity(&Idle);
 		}
 
-		// Call LVGL then sleep until time for the next tick
+		// Change the display rotation if `aio rot` or `aio reload` asked,
+		// and run `aio fonts`
+		zq3_disp_apply();
+		zq3_lvgl_apply(&LCtx);
+
+		// Dim the backlight or sleep the display when idle (or wake it up)
+		zq3_idle_update(&Idle);
+
+		// Write changed settings to flash in the background once they've
+		// settled (or right away if the display is idle)
+		zq3_persist_poll(&Persist, Idle.state != ZQ3_IDLE_ON);
+
+		// Call LVGL then sleep until time for the next tick (or until a LAN
+		// control packet or input event arrives, so they don't wait for the
+		// tick)
 		uint32_t holdoff_ms = zq3_lvgl_timer_handler();
-		k_msleep(holdoff_ms);
+		zq3_lan_wait(&LanCtx, holdoff_ms);
 	}
 }
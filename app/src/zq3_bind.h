@@ -0,0 +1,84 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_BIND_H
+#define ZQ3_BIND_H
+
+#include <lvgl.h>
+#include <zephyr/sys/atomic.h>
+#include "zq3_lvgl.h"
+#include "zq3_mbox.h"
+#include "zq3_series.h"
+
+
+#define ZQ3_BIND_TOPIC_LEN (48)    // same as zq3_mqtt_context.topic
+#define ZQ3_BIND_PAYLOAD_MAX (128) // biggest payload the app reads
+
+typedef struct zq3_binding zq3_binding;
+
+// A widget type knows how to make its LVGL widget, how to decode an MQTT
+// payload into the binding's value, and how to show the value on the widget.
+// The optional tick function runs on every pass through the main loop (for
+// widgets that change over time, like charts).
+typedef struct {
+	const char *name;   // keyword in the zq3/layout setting
+	lv_obj_t *(*create)(zq3_binding *b, lv_obj_t *parent);
+	bool (*decode)(zq3_binding *b, const uint8_t *buf, size_t len);
+	void (*apply)(zq3_binding *b);
+	void (*tick)(zq3_binding *b);
+} zq3_widget_type;
+
+// One widget bound to one feed
+struct zq3_binding {
+	const zq3_widget_type *type;
+	char feed[24];                   // feed name from zq3/layout
+	char topic[ZQ3_BIND_TOPIC_LEN];  // topic prefix from zq3/url + feed
+	lv_obj_t *obj;                   // LVGL widget
+	int32_t min;                     // value range (slider, gauge, chart)
+	int32_t max;
+	int32_t value;                   // last decoded value
+	char text[32];                   // label text (static, no allocation)
+	zq3_series *series;              // chart data (NULL for other types)
+	zq3_mbox mbox;                   // latest payload, for types with apply
+};
+
+// Chart benchmark progress. It runs one chart column per pass through the
+// main loop, so LVGL and MQTT keep going while it runs.
+typedef struct {
+	zq3_binding *b;                        // chart (NULL = not running)
+	int rate;                              // index into the rates table
+	int col;                               // columns done at this rate
+	int64_t t;                             // simulated time (ms)
+	uint32_t samples;
+	uint64_t add_cyc;
+	uint64_t draw_cyc;
+} zq3_bind_bench_state;
+
+typedef struct {
+	char layout[128];                      // zq3/layout setting
+	zq3_binding b[CONFIG_ZQ3_BIND_MAX];    // bindings in layout order
+	int count;                             // number of bindings in use
+	char layout_topic[ZQ3_BIND_TOPIC_LEN]; // for pushing a new layout
+	const char *topics[CONFIG_ZQ3_BIND_MAX + 1]; // list to subscribe to
+	atomic_t bench_req;                    // `aio chart` asked for a bench
+	zq3_bind_bench_state bench;
+} zq3_bind_context;
+
+int zq3_bind_set_layout(zq3_bind_context *bind, const char *layout, int len);
+
+int zq3_bind_init(zq3_bind_context *bind, zq3_lvgl_context *lctx);
+
+int zq3_bind_topics(zq3_bind_context *bind, const char *main_topic);
+
+int zq3_bind_dispatch(zq3_bind_context *bind, const uint8_t *topic,
+	size_t t_len, const uint8_t *buf, size_t len);
+
+void zq3_bind_apply(zq3_bind_context *bind);
+
+int zq3_bind_bench(zq3_bind_context *bind);
+
+void zq3_bind_print(zq3_bind_context *bind);
+
+
+#endif /* ZQ3_BIND_H */
@@ -0,0 +1,127 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * MQTT broker connection manager (ranked broker list with failover)
+ *
+ * The broker urls come from settings. zq3/url is rank 0 (most preferred),
+ * then zq3/url1, zq3/url2, and so on. When a connection attempt fails or an
+ * established connection drops, the main loop calls zq3_broker_failover() to
+ * load the next broker's url into the MQTT context. After every broker has
+ * failed, the delay before starting over from rank 0 backs off exponentially.
+ *
+ * Once connected to a lower ranked broker, zq3_broker_should_failback() says
+ * when it's time to try the preferred broker again.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include "zq3_broker.h"
+#include "zq3_mqtt.h"
+
+LOG_MODULE_REGISTER(zq3_broker, CONFIG_ZQ3_BROKER_LOG_LEVEL);
+
+
+// Maximum delay between rounds of connection attempts
+#define BACKOFF_MAX_MS (60 * 1000)
+
+
+void zq3_broker_init(zq3_broker_context *bctx) {
+	memset(bctx->urls, 0, sizeof(bctx->urls));
+	bctx->current = 0;
+	bctx->failures = 0;
+	bctx->ready_since = 0;
+}
+
+// Save a broker url from settings (rank 0 is zq3/url, rank 1 is zq3/url1...)
+int zq3_broker_set_url(zq3_broker_context *bctx, int rank, const char *url) {
+	if (rank < 0 || rank >= CONFIG_ZQ3_BROKER_MAX) {
+		LOG_ERR("broker rank %d is too big (CONFIG_ZQ3_BROKER_MAX)",
+			rank);
+		return -EDOM;
+	}
+	if (strlen(url) >= sizeof(bctx->urls[rank])) {
+		return -EOVERFLOW;
+	}
+	memset(bctx->urls[rank], 0, sizeof(bctx->urls[rank]));
+	strcpy(bctx->urls[rank], url);
+	return 0;
+}
+
+// Load the url for a broker rank into the MQTT context
+static int select(zq3_broker_context *bctx, zq3_mqtt_context *mctx, int rank) {
+	int err = zq3_mqtt_set_url(mctx, bctx->urls[rank]);
+	if (err) {
+		LOG_ERR("bad url for broker %d: %d", rank, err);
+		return err;
+	}
+	bctx->current = rank;
+	LOG_INF("Using broker %d: %s", rank, mctx->hostname);
+	return 0;
+}
+
+// Load the most preferred broker that has a valid url
+int zq3_broker_first(zq3_broker_context *bctx, zq3_mqtt_context *mctx) {
+	bctx->failures = 0;
+	for (int i = 0; i < CONFIG_ZQ3_BROKER_MAX; i++) {
+		if (strlen(bctx->urls[i]) > 0 && select(bctx, mctx, i) == 0) {
+			return 0;
+		}
+	}
+	return -ENOENT;
+}
+
+// Load the next broker after a failure and return how long to wait (ms)
+// before connecting to it. Moving down the list is immediate. Wrapping
+// around to the top of the list waits with exponential backoff.
+//
+uint32_t zq3_broker_failover(zq3_broker_context *bctx, zq3_mqtt_context *mctx) {
+	bctx->failures++;
+	int rank = bctx->current;
+	for (int i = 0; i < CONFIG_ZQ3_BROKER_MAX; i++) {
+		rank = (rank + 1) % CONFIG_ZQ3_BROKER_MAX;
+		if (strlen(bctx->urls[rank]) == 0) {
+			continue;
+		}
+		bool wrapped = rank <= bctx->current;
+		if (select(bctx, mctx, rank) != 0) {
+			continue;
+		}
+		if (!wrapped) {
+			return 0;
+		}
+		// Every broker failed at least once, so slow down
+		int round = bctx->failures / CONFIG_ZQ3_BROKER_MAX;
+		uint32_t delay = 1000 << MIN(round, 6);
+		return MIN(delay, BACKOFF_MAX_MS);
+	}
+	return BACKOFF_MAX_MS;
+}
+
+// Call this when a connection is ready to use
+void zq3_broker_ready(zq3_broker_context *bctx) {
+	bctx->failures = 0;
+	bctx->ready_since = k_uptime_get();
+}
+
+// Check if it's time to try switching back to a more preferred broker
+bool zq3_broker_should_failback(zq3_broker_context *bctx) {
+	if (CONFIG_ZQ3_BROKER_FAILBACK_S == 0 || bctx->current == 0) {
+		return false;
+	}
+	int64_t ready_ms = k_uptime_get() - bctx->ready_since;
+	return ready_ms >= CONFIG_ZQ3_BROKER_FAILBACK_S * 1000LL;
+}
+
+// Print the broker list (without passwords)
+void zq3_broker_print(zq3_broker_context *bctx) {
+	for (int i = 0; i < CONFIG_ZQ3_BROKER_MAX; i++) {
+		if (strlen(bctx->urls[i]) == 0) {
+			continue;
+		}
+		// Skip "mqtt[s]://user:pass@" to avoid printing the password
+		const char *host = strchr(bctx->urls[i], '@');
+		host = host ? host + 1 : bctx->urls[i];
+		printk("%c %d: %s\n", (i == bctx->current) ? '*' : ' ', i, host);
+	}
+}
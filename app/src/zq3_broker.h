@@ -0,0 +1,36 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_BROKER_H
+#define ZQ3_BROKER_H
+
+#include "zq3_mqtt.h"
+
+
+// Ranked list of MQTT broker urls from the zq3/url, zq3/url1, ... settings.
+// Rank 0 is the preferred broker (e.g. a local mosquitto bridge), and the
+// others are fallbacks (e.g. io.adafruit.com).
+typedef struct {
+	char urls[CONFIG_ZQ3_BROKER_MAX][ZQ3_MQTT_URL_MAX_LEN];
+	int current;           // rank of the broker currently loaded into mctx
+	int failures;          // consecutive failed attempts (for backoff)
+	int64_t ready_since;   // uptime when the current connection became ready
+} zq3_broker_context;
+
+void zq3_broker_init(zq3_broker_context *bctx);
+
+int zq3_broker_set_url(zq3_broker_context *bctx, int rank, const char *url);
+
+int zq3_broker_first(zq3_broker_context *bctx, zq3_mqtt_context *mctx);
+
+uint32_t zq3_broker_failover(zq3_broker_context *bctx, zq3_mqtt_context *mctx);
+
+void zq3_broker_ready(zq3_broker_context *bctx);
+
+bool zq3_broker_should_failback(zq3_broker_context *bctx);
+
+void zq3_broker_print(zq3_broker_context *bctx);
+
+
+#endif /* ZQ3_BROKER_H */
@@ -0,0 +1,125 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * CA certificate store (lazy per-host registration of build-time DER certs)
+ *
+ * Docs & Refs:
+ * https://docs.zephyrproject.org/latest/doxygen/html/group__tls__credentials.html
+ * zephyr/include/zephyr/net/tls_credentials.h
+ * mbedtls/include/mbedtls/x509_crt.h
+ * mbedtls/include/mbedtls/memory_buffer_alloc.h
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/tls_credentials.h>
+#include <mbedtls/x509_crt.h>
+#if defined(CONFIG_MBEDTLS_MEMORY_DEBUG)
+#include <mbedtls/memory_buffer_alloc.h>
+#endif
+#include "zq3_cert.h"
+#include "zq3_cert_table.h"  /* generated by app/scripts/gen_certs.py */
+
+LOG_MODULE_REGISTER(zq3_cert, CONFIG_ZQ3_CERT_LOG_LEVEL);
+
+
+#define CERT_COUNT (sizeof(zq3_cert_table)/sizeof(zq3_cert_table[0]))
+
+// Bitmask of zq3_cert_table entries that are currently registered with the
+// TLS credential store
+static uint32_t registered = 0;
+BUILD_ASSERT(CERT_COUNT <= 32, "too many certs for registered bitmask");
+
+
+// Register the CA certs for one broker hostname and write their tags to the
+// tags array. Certs for other hostnames get unregistered, so mbed TLS only
+// has to parse the chain that matters for this connection. Certs are
+// registered the first time they're needed, rather than at boot.
+// Returns the number of tags, or a negative error code.
+//
+int zq3_cert_register(const char *hostname, sec_tag_t *tags, int max_tags) {
+	if (hostname == NULL || tags == NULL) {
+		return -EINVAL;
+	}
+	// Use exact hostname matches if there are any, otherwise use "*" certs
+	const char *want = "*";
+	for (int i = 0; i < CERT_COUNT; i++) {
+		if (strcmp(zq3_cert_table[i].host, hostname) == 0) {
+			want = hostname;
+			break;
+		}
+	}
+	int count = 0;
+	for (int i = 0; i < CERT_COUNT; i++) {
+		const zq3_cert_entry *e = &zq3_cert_table[i];
+		uint32_t bit = BIT(i);
+		if (strcmp(e->host, want) != 0) {
+			// Cert is for some other broker
+			if (registered & bit) {
+				tls_credential_delete(e->tag, TLS_CREDENTIAL_CA_CERTIFICATE);
+				registered &= ~bit;
+			}
+			continue;
+		}
+		if (count >= max_tags) {
+			LOG_ERR("too many CA certs for '%s'", hostname);
+			return -ENOMEM;
+		}
+		if (!(registered & bit)) {
+			int err = tls_credential_add(e->tag,
+				TLS_CREDENTIAL_CA_CERTIFICATE, e->data, e->len);
+			if (err && err != -EEXIST) {
+				LOG_ERR("tls_credential_add(%d, ...) = %d", e->tag, err);
+				return err;
+			}
+			registered |= bit;
+		}
+		tags[count++] = e->tag;
+	}
+	if (count == 0) {
+		LOG_WRN("no CA certs for '%s' (check certs.txt)", hostname);
+	}
+	return count;
+}
+
+// Reset the mbed TLS heap high water mark (needs CONFIG_MBEDTLS_MEMORY_DEBUG)
+void zq3_cert_heap_reset(void) {
+#if defined(CONFIG_MBEDTLS_MEMORY_DEBUG)
+	mbedtls_memory_buffer_alloc_max_reset();
+#endif
+}
+
+// Get the mbed TLS heap high water mark in bytes (0 if not available)
+size_t zq3_cert_heap_peak(void) {
+	size_t used = 0;
+#if defined(CONFIG_MBEDTLS_MEMORY_DEBUG)
+	size_t blocks = 0;
+	mbedtls_memory_buffer_alloc_max_get(&used, &blocks);
+#endif
+	return used;
+}
+
+// Measure how long mbed TLS takes to parse each cert in the table and how
+// much mbed TLS heap the parsed certs use. Build once with the default DER
+// table and once with CONFIG_ZQ3_CERT_PEM=y to compare the two formats.
+//
+void zq3_cert_bench(void) {
+	mbedtls_x509_crt chain;
+	mbedtls_x509_crt_init(&chain);
+	zq3_cert_heap_reset();
+	uint32_t total_us = 0;
+	printk("Parsing %d %s certs:\n", CERT_COUNT, ZQ3_CERT_FORMAT);
+	for (int i = 0; i < CERT_COUNT; i++) {
+		const zq3_cert_entry *e = &zq3_cert_table[i];
+		uint32_t start = k_cycle_get_32();
+		int err = mbedtls_x509_crt_parse(&chain, e->data, e->len);
+		uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+		total_us += us;
+		printk("  tag %d (%s): %d bytes, %d us, err = %d\n",
+			e->tag, e->host, e->len, us, err);
+	}
+	printk("Total: %d us, mbedTLS heap peak %d bytes\n",
+		total_us, zq3_cert_heap_peak());
+	mbedtls_x509_crt_free(&chain);
+}
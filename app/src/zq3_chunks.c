@@ -0,0 +1,133 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Chunk bitmap for OTA transfers
+ *
+ * Chunks can arrive in any order and more than once (the sender resends
+ * after a dropped connection). The bitmap says which chunks are already in
+ * flash, so duplicates get skipped, and which sectors already hold chunks,
+ * so each sector gets erased once, right before its first chunk.
+ *
+ * zq3_ota.c saves the map every so often. After a reboot, the chunks the
+ * saved map has are kept. Chunks written after the last save get written
+ * again with the same bytes, which NOR flash allows (bits only go 1 -> 0),
+ * and a sector the saved map has nothing in gets erased again.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include "zq3_chunks.h"
+
+
+#define BIT_OF(n) (1u << ((n) % 8))
+
+// Start a new image (forgets the chunks of the old one)
+int zq3_chunks_begin(zq3_chunks *map, uint32_t size, uint32_t chunk,
+	const uint8_t *sha256, uint32_t slot_size)
+{
+	if (chunk < 256 || chunk > ZQ3_CHUNKS_SECTOR || (chunk & (chunk - 1)) ||
+		size == 0 || size > slot_size)
+	{
+		return -EINVAL;
+	}
+	uint32_t chunks = (size + chunk - 1) / chunk;
+	if (chunks > CONFIG_ZQ3_OTA_MAX_CHUNKS) {
+		return -EINVAL;
+	}
+	memset(map, 0, sizeof(*map));
+	map->size = size;
+	map->chunk = chunk;
+	map->chunks = chunks;
+	memcpy(map->sha256, sha256, sizeof(map->sha256));
+	return 0;
+}
+
+// Check if a begin message is for the image in the map
+bool zq3_chunks_same(zq3_chunks *map, uint32_t size, uint32_t chunk,
+	const uint8_t *sha256)
+{
+	return map->size == size && map->chunk == chunk &&
+		memcmp(map->sha256, sha256, sizeof(map->sha256)) == 0;
+}
+
+bool zq3_chunks_has(zq3_chunks *map, uint32_t n) {
+	return map->bitmap[n / 8] & BIT_OF(n);
+}
+
+// First chunk we still need (chunks, if we have them all)
+uint32_t zq3_chunks_next(zq3_chunks *map) {
+	for (uint32_t n = 0; n < map->chunks; n++) {
+		if (!zq3_chunks_has(map, n)) {
+			return n;
+		}
+	}
+	return map->chunks;
+}
+
+// Check a chunk before writing it. Returns 1 if its sector needs erasing
+// first (at *erase_off), 0 if it can just be written, -ENOENT if it's not
+// part of the image, -EALREADY if it's already in flash, or -EMSGSIZE if
+// it's the wrong size (all chunks but the last are exactly chunk bytes).
+int zq3_chunks_want(zq3_chunks *map, uint32_t n, uint32_t len,
+	uint32_t *erase_off)
+{
+	if (n >= map->chunks) {
+		return -ENOENT;
+	}
+	if (zq3_chunks_has(map, n)) {
+		return -EALREADY;
+	}
+	uint32_t off = n * map->chunk;
+	uint32_t want = map->size - off < map->chunk ? map->size - off :
+		map->chunk;
+	if (len != want) {
+		return -EMSGSIZE;
+	}
+	// Erase the sector if this is the first chunk to land in it
+	uint32_t per_sector = ZQ3_CHUNKS_SECTOR / map->chunk;
+	uint32_t first = n - (n % per_sector);
+	for (uint32_t i = first; i < first + per_sector && i < map->chunks; i++) {
+		if (zq3_chunks_has(map, i)) {
+			return 0;
+		}
+	}
+	*erase_off = first * map->chunk;
+	return 1;
+}
+
+// Call once a chunk is written
+void zq3_chunks_mark(zq3_chunks *map, uint32_t n) {
+	if (n < map->chunks && !zq3_chunks_has(map, n)) {
+		map->bitmap[n / 8] |= BIT_OF(n);
+		map->received++;
+	}
+}
+
+// Load a saved map. A map that doesn't add up gets ignored (-EINVAL), so
+// the transfer starts over.
+int zq3_chunks_load(zq3_chunks *map, const void *buf, int len) {
+	zq3_chunks saved;
+	if (len != sizeof(saved)) {
+		return -EINVAL;
+	}
+	memcpy(&saved, buf, sizeof(saved));
+	uint32_t count = 0;
+	for (uint32_t n = 0; n < CONFIG_ZQ3_OTA_MAX_CHUNKS; n++) {
+		if (zq3_chunks_has(&saved, n)) {
+			if (n >= saved.chunks) {
+				return -EINVAL;
+			}
+			count++;
+		}
+	}
+	uint32_t chunk = saved.chunk;
+	if (chunk == 0 || chunk > ZQ3_CHUNKS_SECTOR ||
+		saved.chunks != (saved.size + chunk - 1) / chunk ||
+		saved.chunks > CONFIG_ZQ3_OTA_MAX_CHUNKS || count != saved.received)
+	{
+		return -EINVAL;
+	}
+	*map = saved;
+	return 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_CHUNKS_H
+#define ZQ3_CHUNKS_H
+
+// This doesn't depend on Zephyr, so the host side test (sim/zq3_ota_test.c)
+// checks the same bitmap, erase, and resume logic as the firmware.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// Flash erase size for the ESP32-S3's SPI flash
+#define ZQ3_CHUNKS_SECTOR (4096)
+
+// Which chunks of an OTA image are in flash. This gets saved as is (see
+// zq3_ota.c), so a transfer can pick up where it left off after a reboot.
+typedef struct {
+	uint32_t size;                       // image size in bytes
+	uint32_t chunk;                      // chunk size in bytes
+	uint32_t chunks;                     // number of chunks in the image
+	uint32_t received;                   // chunks written so far
+	uint8_t sha256[32];                  // expected image hash
+	uint8_t bitmap[(CONFIG_ZQ3_OTA_MAX_CHUNKS + 7) / 8]; // chunks written
+} zq3_chunks;
+
+int zq3_chunks_begin(zq3_chunks *map, uint32_t size, uint32_t chunk,
+	const uint8_t *sha256, uint32_t slot_size);
+
+bool zq3_chunks_same(zq3_chunks *map, uint32_t size, uint32_t chunk,
+	const uint8_t *sha256);
+
+int zq3_chunks_want(zq3_chunks *map, uint32_t n, uint32_t len,
+	uint32_t *erase_off);
+
+void zq3_chunks_mark(zq3_chunks *map, uint32_t n);
+
+bool zq3_chunks_has(zq3_chunks *map, uint32_t n);
+
+uint32_t zq3_chunks_next(zq3_chunks *map);
+
+int zq3_chunks_load(zq3_chunks *map, const void *buf, int len);
+
+
+#endif /* ZQ3_CHUNKS_H */
@@ -0,0 +1,184 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Broker connect pipeline that runs off the UI thread
+ *
+ * Connecting to a broker takes a DNS lookup, then TCP connect, TLS handshake
+ * and MQTT CONNECT (all inside Zephyr's mqtt_connect()). Together these can
+ * block for several seconds, which is too long for the main loop because
+ * LVGL and the buttons stop working. So, a worker thread runs the stages and
+ * sends a progress event as each one starts, then a DONE event with the
+ * result. CONNACK still arrives in the main loop through zq3_mqtt_poll().
+ *
+ * The worker's priority is lower than the main thread's, so LVGL keeps
+ * animating while the TLS handshake crunches numbers.
+ *
+ * Cancelling takes effect between stages. A stage that's already running
+ * (mqtt_connect() in particular) can't be interrupted, but the main loop
+ * doesn't have to wait for it. If the connection comes up after a cancel,
+ * the DONE event says so, and zq3_conn_poll() drops it in the main loop.
+ * (mqtt_abort() runs the MQTT event handler, which belongs to the main loop,
+ * so the worker can't do it.) While the worker is busy, it owns the MQTT
+ * client, so the main loop must not touch it until zq3_conn_busy() is false.
+ *
+ * Docs & Refs:
+ * https://docs.zephyrproject.org/latest/kernel/services/threads/index.html
+ * https://docs.zephyrproject.org/latest/kernel/services/data_passing/message_queues.html
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <sys/eventfd.h>
+#include "zq3_conn.h"
+#include "zq3_mqtt.h"
+
+LOG_MODULE_REGISTER(zq3_conn, CONFIG_ZQ3_CONN_LOG_LEVEL);
+
+
+K_THREAD_STACK_DEFINE(conn_stack, CONFIG_ZQ3_CONN_STACK_SIZE);
+static struct k_thread conn_thread;
+static K_SEM_DEFINE(start_sem, 0, 1);
+static K_SEM_DEFINE(dropped_sem, 0, 1);
+K_MSGQ_DEFINE(event_q, sizeof(zq3_conn_event), 8, 4);
+static int wake_fd = -1;
+
+static const char *stage_names[ZQ3_CONN_STAGES] = {
+	"resolve", "creds", "open", "done",
+};
+
+
+static bool cancelled(zq3_conn_context *conn, uint32_t job) {
+	return (uint32_t)atomic_get(&conn->job) != job ||
+		(uint32_t)atomic_get(&conn->cancel) == job;
+}
+
+// Tell the main loop about a stage change
+static void report(uint32_t job, zq3_conn_stage stage, int err, bool open) {
+	zq3_conn_event ev = {job, stage, err, open};
+	k_msgq_put(&event_q, &ev, K_FOREVER);
+	if (wake_fd >= 0) {
+		eventfd_write(wake_fd, 1);
+	}
+}
+
+// Run one connection attempt, stage by stage
+static int run(zq3_conn_context *conn, uint32_t job) {
+	int (*const stages[ZQ3_CONN_DONE])(zq3_mqtt_context *) = {
+		zq3_mqtt_resolve, zq3_mqtt_creds, zq3_mqtt_open,
+	};
+	memset(conn->stage_ms, 0, sizeof(conn->stage_ms));
+	for (int s = 0; s < ZQ3_CONN_DONE; s++) {
+		if (cancelled(conn, job)) {
+			return -ECANCELED;
+		}
+		report(job, s, 0, false);
+		uint32_t start = k_uptime_get_32();
+		int err = stages[s](conn->mctx);
+		conn->stage_ms[s] = k_uptime_get_32() - start;
+		if (err) {
+			return err;
+		}
+	}
+	if (cancelled(conn, job)) {
+		// Too late to stop the handshake, so the main loop has to drop the
+		// connection
+		return -EISCONN;
+	}
+	return 0;
+}
+
+static void worker(void *p1, void *p2, void *p3) {
+	zq3_conn_context *conn = p1;
+	while (1) {
+		k_sem_take(&start_sem, K_FOREVER);
+		uint32_t job = atomic_get(&conn->job);
+		int err = run(conn, job);
+		bool open = (err == -EISCONN);
+		if (open) {
+			err = -ECANCELED;
+		}
+		LOG_INF("Connect %s: %d (resolve %d ms, creds %d ms, open %d ms)",
+			(err == -ECANCELED) ? "cancelled" : "finished", err,
+			conn->stage_ms[ZQ3_CONN_RESOLVE], conn->stage_ms[ZQ3_CONN_CREDS],
+			conn->stage_ms[ZQ3_CONN_OPEN]);
+		report(job, ZQ3_CONN_DONE, err, open);
+		if (open) {
+			// Keep the client until the main loop has dropped the
+			// connection, so the next attempt doesn't start on top of it
+			k_sem_take(&dropped_sem, K_FOREVER);
+		}
+		atomic_set(&conn->done, job);
+	}
+}
+
+// Start the worker thread. The MQTT context must stay the same for good.
+int zq3_conn_init(zq3_conn_context *conn, zq3_mqtt_context *mctx) {
+	memset(conn, 0, sizeof(*conn));
+	conn->mctx = mctx;
+	wake_fd = eventfd(0, EFD_NONBLOCK);
+	if (wake_fd < 0) {
+		LOG_ERR("conn eventfd: %d", -errno);
+	}
+	k_thread_create(&conn_thread, conn_stack,
+		K_THREAD_STACK_SIZEOF(conn_stack), worker, conn, NULL, NULL,
+		CONFIG_ZQ3_CONN_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(&conn_thread, "zq3_conn");
+	return 0;
+}
+
+// Start connecting to the broker loaded in the MQTT context. If an older
+// attempt is still running, it gets cancelled and the new one starts when
+// the worker is done with it.
+int zq3_conn_start(zq3_conn_context *conn) {
+	atomic_inc(&conn->job);
+	k_sem_give(&start_sem);
+	return 0;
+}
+
+// Cancel the current connection attempt. The worker still sends a DONE
+// event (with -ECANCELED, unless the attempt already finished).
+void zq3_conn_cancel(zq3_conn_context *conn) {
+	atomic_set(&conn->cancel, atomic_get(&conn->job));
+}
+
+// Check if the worker owns the MQTT client (started or running an attempt)
+bool zq3_conn_busy(zq3_conn_context *conn) {
+	return atomic_get(&conn->done) != atomic_get(&conn->job);
+}
+
+// Get the next progress event for the latest attempt. Events for older,
+// superseded attempts get skipped. The main loop calls this each time around.
+//
+// If a cancelled attempt connected anyway, this drops the connection before
+// returning (or skipping) its DONE event. The MQTT event handler sees the
+// DISCONNECT, so this must only be called from the main loop.
+bool zq3_conn_poll(zq3_conn_context *conn, zq3_conn_event *ev) {
+	eventfd_t unused;
+	if (wake_fd >= 0) {
+		eventfd_read(wake_fd, &unused);
+	}
+	while (k_msgq_get(&event_q, ev, K_NO_WAIT) == 0) {
+		if (ev->open) {
+			zq3_mqtt_abort(conn->mctx);
+			k_sem_give(&dropped_sem);
+		}
+		if (ev->job == (uint32_t)atomic_get(&conn->job)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Get the eventfd that becomes readable when there are progress events
+int zq3_conn_fd(void) {
+	return wake_fd;
+}
+
+// Print stage timing for the last connection attempt
+void zq3_conn_print(zq3_conn_context *conn) {
+	printk("Connect worker: %s\n", zq3_conn_busy(conn) ? "busy" : "idle");
+	for (int s = 0; s < ZQ3_CONN_DONE; s++) {
+		printk("%-8s %5d ms\n", stage_names[s], conn->stage_ms[s]);
+	}
+}
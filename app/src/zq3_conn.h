@@ -0,0 +1,54 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_CONN_H
+#define ZQ3_CONN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/sys/atomic.h>
+#include "zq3_mqtt.h"
+
+
+// Stages of a broker connection attempt, in order
+typedef enum {
+	ZQ3_CONN_RESOLVE,    // DNS lookup for the broker hostname
+	ZQ3_CONN_CREDS,      // register TLS credentials for the broker
+	ZQ3_CONN_OPEN,       // TCP connect, TLS handshake, send MQTT CONNECT
+	ZQ3_CONN_DONE,       // finished (err says how it went)
+	ZQ3_CONN_STAGES,
+} zq3_conn_stage;
+
+// Progress event from the connect worker
+typedef struct {
+	uint32_t job;        // which connection attempt this is about
+	zq3_conn_stage stage; // stage that just started (or DONE)
+	int err;             // result, for DONE (-ECANCELED if cancelled)
+	bool open;           // cancelled, but connected anyway (poll drops it)
+} zq3_conn_event;
+
+typedef struct {
+	zq3_mqtt_context *mctx;
+	atomic_t job;        // latest connection attempt (bumped by start)
+	atomic_t done;       // latest attempt the worker finished
+	atomic_t cancel;     // attempt to cancel
+	uint32_t stage_ms[ZQ3_CONN_DONE]; // time in each stage (last attempt)
+} zq3_conn_context;
+
+int zq3_conn_init(zq3_conn_context *conn, zq3_mqtt_context *mctx);
+
+int zq3_conn_start(zq3_conn_context *conn);
+
+void zq3_conn_cancel(zq3_conn_context *conn);
+
+bool zq3_conn_busy(zq3_conn_context *conn);
+
+bool zq3_conn_poll(zq3_conn_context *conn, zq3_conn_event *ev);
+
+int zq3_conn_fd(void);
+
+void zq3_conn_print(zq3_conn_context *conn);
+
+
+#endif /* ZQ3_CONN_H */
@@ -0,0 +1,311 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * TLS credential store in NVM flash (provisioned with `aio cred ...`)
+ *
+ * This lets you rotate CA certs, or add a client cert and key for mutual TLS,
+ * without building new firmware. Credentials are DER blobs saved under the
+ * zq3/cred/ settings subtree:
+ *
+ *   zq3/cred/ca0, ca1, ca2   CA certificates
+ *   zq3/cred/crt             client certificate (for mutual TLS)
+ *   zq3/cred/key             client private key (for mutual TLS)
+ *   zq3/cred/host            optional: only use these creds for this broker
+ *
+ * Nothing gets read at boot. At connect time, the credentials are streamed
+ * from flash straight into a fixed size static pool (no heap allocation) and
+ * registered with the TLS credential store. If there are no CA certs in
+ * flash, zq3_mqtt_connect() falls back to the build-time certs (zq3_cert.c).
+ *
+ * Docs & Refs:
+ * https://docs.zephyrproject.org/latest/services/storage/settings/index.html
+ * https://docs.zephyrproject.org/latest/doxygen/html/group__settings.html
+ * https://docs.zephyrproject.org/latest/doxygen/html/group__tls__credentials.html
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/tls_credentials.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/util.h>  /* hex2bin() */
+#include "zq3_cred.h"
+
+LOG_MODULE_REGISTER(zq3_cred, CONFIG_ZQ3_CRED_LOG_LEVEL);
+
+
+// TLS sec_tag numbers for credentials from flash (build-time certs use the
+// tags from app/certs/certs.txt, so keep these out of that range)
+#define CRED_TAG_BASE (100)
+#define CRED_TAG_CLIENT (CRED_TAG_BASE + 3)
+
+typedef struct {
+	const char *name;                  // settings key below zq3/cred/
+	sec_tag_t tag;                     // TLS credential tag
+	enum tls_credential_type type;     // TLS credential type
+} cred_slot;
+
+static const cred_slot slots[] = {
+	{"ca0", CRED_TAG_BASE + 0, TLS_CREDENTIAL_CA_CERTIFICATE},
+	{"ca1", CRED_TAG_BASE + 1, TLS_CREDENTIAL_CA_CERTIFICATE},
+	{"ca2", CRED_TAG_BASE + 2, TLS_CREDENTIAL_CA_CERTIFICATE},
+	// The TLS credential API calls our own certificate a "server" cert, but
+	// it's the same thing for a client doing mutual TLS
+	{"crt", CRED_TAG_CLIENT, TLS_CREDENTIAL_SERVER_CERTIFICATE},
+	{"key", CRED_TAG_CLIENT, TLS_CREDENTIAL_PRIVATE_KEY},
+};
+#define SLOT_COUNT (sizeof(slots)/sizeof(slots[0]))
+#define SLOT_CRT (3)
+#define SLOT_KEY (4)
+
+// Static pool for credential data. This holds either the credentials loaded
+// from flash for the current connection, or (while provisioning) the data
+// for one credential that hasn't been saved yet.
+static uint8_t pool[CONFIG_ZQ3_CRED_POOL_SIZE] __aligned(4);
+static size_t pool_len = 0;
+static bool staging = false;
+
+// Credentials loaded from flash into the pool (NULL if missing)
+static const uint8_t *slot_data[SLOT_COUNT];
+static size_t slot_len[SLOT_COUNT];
+static uint32_t registered = 0;    // bitmask of slots added to TLS store
+static char host[48];              // zq3/cred/host value ("" means any)
+
+
+// Find the slot index for a settings key name, or return -1
+static int find_slot(const char *name) {
+	for (int i = 0; i < SLOT_COUNT; i++) {
+		if (strcmp(slots[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Remove all of our credentials from the TLS credential store. This has to
+// happen before the pool gets reused, because the store keeps pointers.
+static void unregister_all(void) {
+	for (int i = 0; i < SLOT_COUNT; i++) {
+		if (registered & BIT(i)) {
+			tls_credential_delete(slots[i].tag, slots[i].type);
+		}
+		slot_data[i] = NULL;
+		slot_len[i] = 0;
+	}
+	registered = 0;
+	pool_len = 0;
+}
+
+// Settings callback for settings_load_subtree_direct(). This reads each
+// credential directly from flash into the next free spot in the pool.
+static int
+load_cb(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg,
+	void *param)
+{
+	if (strcmp(key, "host") == 0) {
+		if (len >= sizeof(host)) {
+			LOG_ERR("zq3/cred/host is too long: %d", len);
+			return 0;
+		}
+		memset(host, 0, sizeof(host));
+		read_cb(cb_arg, host, sizeof(host) - 1);
+		return 0;
+	}
+	int i = find_slot(key);
+	if (i < 0) {
+		LOG_WRN("ignoring unknown credential 'zq3/cred/%s'", key);
+		return 0;
+	}
+	size_t offset = ROUND_UP(pool_len, 4);
+	if (offset + len > sizeof(pool)) {
+		LOG_ERR("zq3/cred/%s doesn't fit (CONFIG_ZQ3_CRED_POOL_SIZE)",
+			key);
+		return 0;
+	}
+	int rc = read_cb(cb_arg, &pool[offset], len);
+	if (rc < 0) {
+		LOG_ERR("settings read_cb(zq3/cred/%s) = %d", key, rc);
+		return 0;
+	}
+	slot_data[i] = &pool[offset];
+	slot_len[i] = rc;
+	pool_len = offset + rc;
+	return 0;
+}
+
+// Load credentials for a connection to hostname and register them with the
+// TLS credential store. This writes the tags to use for the connection into
+// the tags array and returns the number of tags (0 means nothing in flash
+// applies to this broker), or a negative error code.
+//
+int zq3_cred_register(const char *hostname, sec_tag_t *tags, int max_tags) {
+	if (hostname == NULL || tags == NULL) {
+		return -EINVAL;
+	}
+	// Reload from flash each time, since provisioning may have reused the
+	// pool or changed the saved credentials since the last connection
+	unregister_all();
+	staging = false;
+	memset(host, 0, sizeof(host));
+	int err = settings_load_subtree_direct("zq3/cred", load_cb, NULL);
+	if (err) {
+		LOG_ERR("loading zq3/cred = %d", err);
+		return err;
+	}
+	if (strlen(host) > 0 && strcmp(host, hostname) != 0) {
+		// Credentials are for some other broker
+		unregister_all();
+		return 0;
+	}
+	int count = 0;
+	for (int i = 0; i < SLOT_COUNT; i++) {
+		if (slot_data[i] == NULL) {
+			continue;
+		}
+		err = tls_credential_add(slots[i].tag, slots[i].type,
+			slot_data[i], slot_len[i]);
+		if (err) {
+			LOG_ERR("tls_credential_add(%d, ...) = %d", slots[i].tag,
+				err);
+			continue;
+		}
+		registered |= BIT(i);
+		// Client cert and key share one tag, which is added after the loop
+		if (slots[i].type == TLS_CREDENTIAL_CA_CERTIFICATE) {
+			if (count >= max_tags) {
+				return -ENOMEM;
+			}
+			tags[count++] = slots[i].tag;
+		}
+	}
+	bool crt = registered & BIT(SLOT_CRT);
+	bool key = registered & BIT(SLOT_KEY);
+	if (crt && key) {
+		if (count >= max_tags) {
+			return -ENOMEM;
+		}
+		tags[count++] = CRED_TAG_CLIENT;
+	} else if (crt || key) {
+		LOG_WRN("mutual TLS needs both zq3/cred/crt and zq3/cred/key");
+	}
+	return count;
+}
+
+// Check if zq3_cred_register() found any CA certs in flash. If not, the
+// caller should use the build-time CA certs.
+bool zq3_cred_has_ca(void) {
+	for (int i = 0; i < SLOT_COUNT; i++) {
+		bool is_ca = slots[i].type == TLS_CREDENTIAL_CA_CERTIFICATE;
+		if (is_ca && (registered & BIT(i))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/*
+* PROVISIONING (used by `aio cred ...` shell commands)
+*/
+
+// Start provisioning a new credential
+int zq3_cred_begin(void) {
+	unregister_all();
+	staging = true;
+	return 0;
+}
+
+// Append a string of hex digits to the credential being provisioned
+int zq3_cred_append_hex(const char *hex) {
+	if (!staging) {
+		printk("ERR: use `aio cred begin` first\n");
+		return -EINVAL;
+	}
+	size_t hexlen = strlen(hex);
+	size_t len = hexlen / 2;
+	if (hexlen == 0 || hexlen % 2 != 0) {
+		printk("ERR: hex data needs an even number of digits\n");
+		return -EINVAL;
+	}
+	if (pool_len + len > sizeof(pool)) {
+		printk("ERR: credential too big (CONFIG_ZQ3_CRED_POOL_SIZE)\n");
+		return -ENOMEM;
+	}
+	if (hex2bin(hex, hexlen, &pool[pool_len], len) != len) {
+		printk("ERR: bad hex data\n");
+		return -EINVAL;
+	}
+	pool_len += len;
+	return 0;
+}
+
+// Save the credential being provisioned to flash as zq3/cred/<name>
+int zq3_cred_save(const char *name) {
+	char key[sizeof("zq3/cred/") + 4];
+	if (find_slot(name) < 0) {
+		printk("ERR: name must be one of: ca0, ca1, ca2, crt, key\n");
+		return -EINVAL;
+	}
+	if (!staging || pool_len == 0) {
+		printk("ERR: nothing to save (use begin and hex first)\n");
+		return -EINVAL;
+	}
+	snprintk(key, sizeof(key), "zq3/cred/%s", name);
+	int err = settings_save_one(key, pool, pool_len);
+	if (err) {
+		printk("ERR: settings_save_one(%s) = %d\n", key, err);
+		return err;
+	}
+	printk("Saved %s (%d bytes)\n", key, pool_len);
+	staging = false;
+	pool_len = 0;
+	return 0;
+}
+
+// Limit flash credentials to one broker hostname
+int zq3_cred_set_host(const char *hostname) {
+	if (strlen(hostname) >= sizeof(host)) {
+		return -EDOM;
+	}
+	return settings_save_one("zq3/cred/host", hostname, strlen(hostname) + 1);
+}
+
+// Delete zq3/cred/<name> from flash
+int zq3_cred_delete(const char *name) {
+	char key[sizeof("zq3/cred/") + 4];
+	if (find_slot(name) < 0 && strcmp(name, "host") != 0) {
+		return -EINVAL;
+	}
+	snprintk(key, sizeof(key), "zq3/cred/%s", name);
+	return settings_delete(key);
+}
+
+// Print one zq3/cred/* entry without reading the credential data
+static int
+list_cb(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg,
+	void *param)
+{
+	printk("  zq3/cred/%s: %d bytes\n", key, len);
+	return 0;
+}
+
+// List credentials saved in flash
+int zq3_cred_list(void) {
+	return settings_load_subtree_direct("zq3/cred", list_cb, NULL);
+}
+
+
+/*
+* SETTINGS HANDLER
+*/
+
+// Credentials are only read at connect time, so settings_load() at boot
+// should skip them. Without this handler, the zq3 handler in main.c would
+// see the zq3/cred/* keys and complain that they're too big.
+static int
+set_cb(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(zq3_cred, "zq3/cred", NULL, set_cb, NULL, NULL);
@@ -0,0 +1,28 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_CRED_H
+#define ZQ3_CRED_H
+
+#include <zephyr/net/tls_credentials.h>  /* sec_tag_t */
+
+
+int zq3_cred_register(const char *hostname, sec_tag_t *tags, int max_tags);
+
+bool zq3_cred_has_ca(void);
+
+int zq3_cred_begin(void);
+
+int zq3_cred_append_hex(const char *hex);
+
+int zq3_cred_save(const char *name);
+
+int zq3_cred_set_host(const char *hostname);
+
+int zq3_cred_delete(const char *name);
+
+int zq3_cred_list(void);
+
+
+#endif /* ZQ3_CRED_H */
@@ -0,0 +1,181 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * ST7789V panel control: runtime rotation (zq3/rot setting) and sleep
+ *
+ * The devicetree (mipi_st7789v.dtsi) sets the rotation that the display
+ * driver uses at boot. To change it without building new firmware, this
+ * sends MADCTL (36h) to the panel, switches the LVGL resolution, and takes
+ * over LVGL's flush callback so the RAM window offsets match the rotation.
+ *
+ * For 90° and 270°, MADCTL's MV bit makes the panel swap rows and columns
+ * as the pixels arrive. So, LVGL always renders plain row-major frames at
+ * the rotated resolution, and flushing them needs no software rotation.
+ *
+ * Docs & Refs:
+ * https://docs.zephyrproject.org/latest/doxygen/html/group__mipi__dbi__interface.html
+ * https://docs.lvgl.io/9.2/porting/display.html
+ * https://newhavendisplay.com/content/datasheets/ST7789V.pdf (MADCTL, CASET)
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/drivers/display.h>
+#include <zephyr/drivers/mipi_dbi.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/byteorder.h>
+#include <lvgl.h>
+#include "zq3_disp.h"
+
+LOG_MODULE_REGISTER(zq3_disp, CONFIG_ZQ3_DISP_LOG_LEVEL);
+
+
+// ST7789V commands
+#define CMD_SLPIN (0x10)
+#define CMD_SLPOUT (0x11)
+#define CMD_CASET (0x2A)
+#define CMD_RASET (0x2B)
+#define CMD_RAMWR (0x2C)
+#define CMD_MADCTL (0x36)
+
+#define DISP_NODE DT_CHOSEN(zephyr_display)
+
+// Geometry for each rotation of the Feather TFT's 240x135 panel. These are
+// the values from the comment in mipi_st7789v.dtsi (madctl_encoder.py shows
+// how the MADCTL bits work out).
+static const zq3_disp_geometry geometry[] = {
+	{  0, 0x0C, 52, 40, 135, 240},  // top left by Boot button
+	{ 90, 0x6C, 40, 53, 240, 135},  // top left by battery jack
+	{180, 0xCC, 53, 40, 135, 240},  // top left by SDA pin
+	{270, 0xAC, 40, 52, 240, 135},  // top left by Adafruit logo
+};
+
+static const struct device *display = DEVICE_DT_GET(DISP_NODE);
+static const struct device *dbi = DEVICE_DT_GET(DT_PARENT(DISP_NODE));
+static const struct mipi_dbi_config dbi_config =
+	MIPI_DBI_CONFIG_DT(DISP_NODE, SPI_OP_MODE_MASTER | SPI_WORD_SET(8), 0);
+
+static const zq3_disp_geometry *current = NULL;
+static atomic_t pending = ATOMIC_INIT(-1);  // requested rotation (-1 = none)
+
+
+// Find the geometry for a rotation, or return NULL
+static const zq3_disp_geometry *find(int degrees) {
+	for (int i = 0; i < ARRAY_SIZE(geometry); i++) {
+		if (geometry[i].degrees == degrees) {
+			return &geometry[i];
+		}
+	}
+	return NULL;
+}
+
+// Send a command with two big-endian 16-bit parameters (CASET or RASET)
+static int set_range(uint8_t cmd, uint16_t start, uint16_t end) {
+	uint16_t range[2] = {sys_cpu_to_be16(start), sys_cpu_to_be16(end)};
+	return mipi_dbi_command_write(dbi, &dbi_config, cmd, (uint8_t *)range,
+		sizeof(range));
+}
+
+// LVGL flush callback. This does the same job as the one from Zephyr's LVGL
+// module, except that the RAM window offsets come from the current rotation
+// rather than from devicetree.
+static void flush_cb(lv_display_t *disp, const lv_area_t *area, uint8_t *px) {
+	uint16_t w = lv_area_get_width(area);
+	uint16_t h = lv_area_get_height(area);
+	uint16_t x = area->x1 + current->x_offset;
+	uint16_t y = area->y1 + current->y_offset;
+	struct display_buffer_descriptor desc = {
+		.buf_size = w * h * 2,
+		.width = w,
+		.height = h,
+		.pitch = w,
+	};
+	if (IS_ENABLED(CONFIG_LV_COLOR_16_SWAP)) {
+		lv_draw_sw_rgb565_swap(px, w * h);
+	}
+	int err = set_range(CMD_CASET, x, x + w - 1);
+	err = err ? err : set_range(CMD_RASET, y, y + h - 1);
+	err = err ? err : mipi_dbi_command_write(dbi, &dbi_config, CMD_RAMWR,
+		NULL, 0);
+	err = err ? err : mipi_dbi_write_display(dbi, &dbi_config, px, &desc,
+		PIXEL_FORMAT_RGB_565);
+	if (err) {
+		LOG_ERR("display flush = %d", err);
+	}
+	lv_display_flush_ready(disp);
+}
+
+// Take over LVGL's flush callback. The panel is still in the devicetree
+// rotation at this point, which matches CONFIG_ZQ3_ROTATION.
+int zq3_disp_init(void) {
+	current = find(CONFIG_ZQ3_ROTATION);
+	if (current == NULL || !device_is_ready(dbi)) {
+		LOG_ERR("display rotation setup failed");
+		return -ENODEV;
+	}
+	lv_display_set_flush_cb(lv_display_get_default(), flush_cb);
+	return 0;
+}
+
+// Ask for a new rotation (0, 90, 180, or 270). This is safe to call from
+// the shell or settings handler. The change happens in zq3_disp_apply().
+int zq3_disp_request(int degrees) {
+	if (find(degrees) == NULL) {
+		LOG_ERR("rotation must be 0, 90, 180, or 270");
+		return -EINVAL;
+	}
+	atomic_set(&pending, degrees);
+	return 0;
+}
+
+// Apply a requested rotation. The main loop calls this, since it owns LVGL.
+// The display stays blanked while the panel's RAM still has the old frame.
+void zq3_disp_apply(void) {
+	int degrees = atomic_set(&pending, -1);
+	const zq3_disp_geometry *g = find(degrees);
+	if (g == NULL || current == NULL || g == current) {
+		return;
+	}
+	display_blanking_on(display);
+	int err = mipi_dbi_command_write(dbi, &dbi_config, CMD_MADCTL,
+		&g->madctl, 1);
+	if (err) {
+		LOG_ERR("MADCTL = %d", err);
+		display_blanking_off(display);
+		return;
+	}
+	current = g;
+	lv_display_t *disp = lv_display_get_default();
+	lv_display_set_resolution(disp, g->width, g->height);
+	lv_obj_invalidate(lv_screen_active());
+	lv_refr_now(disp);
+	display_blanking_off(display);
+	printk("Display rotation: %d (%dx%d)\n", g->degrees, g->width, g->height);
+}
+
+// Put the panel to sleep (display off + SLPIN), or wake it up (SLPOUT +
+// display on). The panel keeps its frame memory while it sleeps, so waking
+// only needs a redraw of whatever changed in the meantime.
+int zq3_disp_sleep(bool sleep) {
+	int err;
+	if (sleep) {
+		display_blanking_on(display);
+		err = mipi_dbi_command_write(dbi, &dbi_config, CMD_SLPIN, NULL, 0);
+	} else {
+		err = mipi_dbi_command_write(dbi, &dbi_config, CMD_SLPOUT, NULL, 0);
+		// Datasheet: wait 5 ms after SLPOUT before the next command
+		k_msleep(5);
+		lv_refr_now(lv_display_get_default());
+		display_blanking_off(display);
+	}
+	if (err) {
+		LOG_ERR("%s = %d", sleep ? "SLPIN" : "SLPOUT", err);
+	}
+	return err;
+}
+
+// Get the current rotation in degrees
+int zq3_disp_rotation(void) {
+	return current ? current->degrees : CONFIG_ZQ3_ROTATION;
+}
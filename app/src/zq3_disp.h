@@ -0,0 +1,33 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_DISP_H
+#define ZQ3_DISP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// Panel geometry for one rotation (see mipi_st7789v.dtsi)
+typedef struct {
+	uint16_t degrees;   // clockwise rotation: 0, 90, 180, or 270
+	uint8_t madctl;     // MADCTL (36h) parameter
+	uint16_t x_offset;  // first visible column in panel RAM
+	uint16_t y_offset;  // first visible row in panel RAM
+	uint16_t width;     // LVGL horizontal resolution
+	uint16_t height;    // LVGL vertical resolution
+} zq3_disp_geometry;
+
+int zq3_disp_init(void);
+
+int zq3_disp_request(int degrees);
+
+void zq3_disp_apply(void);
+
+int zq3_disp_sleep(bool sleep);
+
+int zq3_disp_rotation(void);
+
+
+#endif /* ZQ3_DISP_H */
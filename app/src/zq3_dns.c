@@ -9,21 +9,19 @@
  * https://docs.zephyrproject.org/apidoc/latest/group__ip__4__6.html (net_addr_ntop)
  */
 
+#include <zephyr/logging/log.h>
 #include <zephyr/net/socket.h>
 #include "zq3.h"
 
+LOG_MODULE_REGISTER(zq3_dns, CONFIG_ZQ3_DNS_LOG_LEVEL);
 
-#define TLS_PORTSTR     ("8883")
-#define TLS_PORT        (8883)
-#define NON_TLS_PORTSTR ("1883")
-#define NON_TLS_PORT    (1883)
 
 // Resolve hostname to IPv4 IP (IPv6 not supported)
 // This requires CONFIG_POSIX_API=y and CONFIG_NET_SOCKETS_POSIX_NAMES=y.
 //
 int zq3_dns_resolve(
 	const uint8_t *name,
-	bool tls,
+	uint16_t port,
 	struct sockaddr_storage *addr
 ) {
 	if (name == NULL || addr == NULL) {
@@ -34,13 +32,14 @@ int zq3_dns_resolve(
 		.ai_family = AF_INET,
 		.ai_socktype = SOCK_STREAM
 	};
-	printk("Attempting DNS lookup for '%s'\n", name);
-	const char * service = tls ? TLS_PORTSTR : NON_TLS_PORTSTR;
+	LOG_INF("Attempting DNS lookup for '%s'", name);
+	char service[6];
+	snprintk(service, sizeof(service), "%d", port);
 	int err = getaddrinfo(name, service, &hint, &res);
 	if (err) {
 		switch(err) {
 		case DNS_EAI_SYSTEM:
-			printk("ERR: DNS_EAI_SYSTEM: Is wifi connected?\n");
+			LOG_ERR("DNS_EAI_SYSTEM: Is wifi connected?");
 			break;
 		case DNS_EAI_CANCELED:
 			// This happened to me while testing on a wifi router bridged to
@@ -48,16 +47,16 @@ int zq3_dns_resolve(
 			// that case, the DNS resolver still works fine for IP address
 			// strings, but it can't do hostnames. Solution: use wifi network
 			// that provides access to gateway router and DNS server.
-			printk("ERR: DNS_EAI_SYSTEM: Did DHCP give you a DNS server?\n");
+			LOG_ERR("DNS_EAI_SYSTEM: Did DHCP give you a DNS server?");
 			break;
 		default:
 			// Look for enum with EAI_* in include/zephyr/net/dns_resolve.h
-			printk("ERR: DNS fail %d\n", err);
+			LOG_ERR("DNS fail %d", err);
 		}
 	} else if (!res || !(res->ai_addr) || (res->ai_family != AF_INET)) {
 		// This shouldn't happen, but check anyway because null pointer
 		// dereference hard faults are no fun.
-		printk("ERR: DNS result struct was damaged\n");
+		LOG_ERR("DNS result struct was damaged");
 	} else {
 		// At this point, we can trust that res and res->ai_addr are not NULL
 		// and that the result is an IPv4 address.
@@ -75,13 +74,13 @@ int zq3_dns_resolve(
 		struct sockaddr_in *dst = (struct sockaddr_in *)addr;
 		dst->sin_family = AF_INET;
 		dst->sin_addr.s_addr = src->sin_addr.s_addr;
-		// Set TLS or non-TLS port with network byte order conversion function
-		dst->sin_port = htons(tls ? TLS_PORT : NON_TLS_PORT);
+		// Set the broker port with network byte order conversion function
+		dst->sin_port = htons(port);
 
 		// Debug print the DNS lookup result
 		char ip_str[INET_ADDRSTRLEN];  // max length IPv4 address string
 		net_addr_ntop(AF_INET, &dst->sin_addr, ip_str, sizeof(ip_str));
-		printk("DNS IPv4 result: %s\n", ip_str);
+		LOG_INF("DNS IPv4 result: %s", ip_str);
 	}
 	// IMPORTANT: always free getaddrinfo() result to avoid memory leak
 	freeaddrinfo(res);
@@ -7,7 +7,7 @@
 
 int zq3_dns_resolve(
 	const uint8_t *name,
-	bool tls,
+	uint16_t port,
 	struct sockaddr_storage *addr
 );
 
@@ -0,0 +1,80 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Echo suppression for our own toggle publishes
+ *
+ * We subscribe to the same topic we publish the toggle state to, so the
+ * broker sends each of our publishes back to us. Those echoes used to go
+ * through the same path as changes from other clients. That meant wasted
+ * work, and an echo of the first of two quick presses could undo the
+ * second one.
+ *
+ * Each value we publish goes in a small ring, oldest first. MQTT keeps
+ * messages on one topic in order, so when a value comes in:
+ *
+ * - If it matches the oldest pending value, it's our echo. Skip it.
+ * - If it doesn't match, another client published it, and the broker put it
+ *   ahead of our pending publish. Our publish comes later, so it wins (last
+ *   writer in broker order). Skip it too.
+ * - If nothing is pending, another client published it. Use it.
+ *
+ * Pending values expire after CONFIG_ZQ3_ECHO_TIMEOUT_MS in case an echo
+ * never comes (like when the broker drops our publish).
+ *
+ * This works the same way for MQTT 3.1.1 and MQTT 5, so the app doesn't use
+ * the MQTT 5 no-local subscription option. Adafruit IO only speaks 3.1.1.
+ */
+
+#include <zephyr/kernel.h>
+#include "zq3_echo.h"
+
+
+void zq3_echo_init(zq3_echo_context *echo) {
+	memset(echo, 0, sizeof(*echo));
+}
+
+// Forget pending values (the connection dropped)
+void zq3_echo_clear(zq3_echo_context *echo) {
+	echo->head = 0;
+	echo->count = 0;
+}
+
+static void pop(zq3_echo_context *echo) {
+	echo->head = (echo->head + 1) % CONFIG_ZQ3_ECHO_PENDING;
+	echo->count--;
+}
+
+// Remember a value we just published. If the ring is full, the oldest
+// pending value gets dropped.
+void zq3_echo_sent(zq3_echo_context *echo, uint8_t value, int64_t now) {
+	if (echo->count == CONFIG_ZQ3_ECHO_PENDING) {
+		pop(echo);
+		echo->expired++;
+	}
+	int i = (echo->head + echo->count) % CONFIG_ZQ3_ECHO_PENDING;
+	echo->ring[i].value = value;
+	echo->ring[i].at = now;
+	echo->count++;
+}
+
+// Decide what to do with a value that came in on the toggle topic
+zq3_echo_result
+zq3_echo_check(zq3_echo_context *echo, uint8_t value, int64_t now) {
+	while (echo->count > 0 &&
+		now - echo->ring[echo->head].at >= CONFIG_ZQ3_ECHO_TIMEOUT_MS)
+	{
+		pop(echo);
+		echo->expired++;
+	}
+	if (echo->count == 0) {
+		return ZQ3_ECHO_FOREIGN;
+	}
+	if (echo->ring[echo->head].value == value) {
+		pop(echo);
+		echo->echoes++;
+		return ZQ3_ECHO_OURS;
+	}
+	echo->stale++;
+	return ZQ3_ECHO_STALE;
+}
@@ -0,0 +1,41 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_ECHO_H
+#define ZQ3_ECHO_H
+
+#include <stdint.h>
+
+
+// What an incoming toggle value turned out to be
+typedef enum {
+	ZQ3_ECHO_FOREIGN,  // somebody else published it (use it)
+	ZQ3_ECHO_OURS,     // echo of our own publish (skip it)
+	ZQ3_ECHO_STALE,    // somebody else's, but our later publish wins (skip)
+} zq3_echo_result;
+
+// Values we published but haven't seen echoed yet, oldest first
+typedef struct {
+	struct {
+		uint8_t value;
+		int64_t at;         // uptime of the publish (ms)
+	} ring[CONFIG_ZQ3_ECHO_PENDING];
+	int head;               // index of the oldest pending value
+	int count;
+	uint32_t echoes;        // echoes skipped
+	uint32_t stale;         // foreign values skipped (our publish came later)
+	uint32_t expired;       // pending values that never came back
+} zq3_echo_context;
+
+void zq3_echo_init(zq3_echo_context *echo);
+
+void zq3_echo_clear(zq3_echo_context *echo);
+
+void zq3_echo_sent(zq3_echo_context *echo, uint8_t value, int64_t now);
+
+zq3_echo_result
+zq3_echo_check(zq3_echo_context *echo, uint8_t value, int64_t now);
+
+
+#endif /* ZQ3_ECHO_H */
@@ -0,0 +1,367 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Table-driven connection state machine
+ *
+ * All the connection state changes happen here, in one table of
+ * transitions. Each row says: in these states, on this event, if the guard
+ * agrees, run the action, then go to the next state (or to the fail state
+ * if the action returned an error). The first matching row wins. Events
+ * with no matching row get ignored, which is how stale events (like a
+ * DISCONNECT from a connection that was already dropped) stay harmless.
+ *
+ * Entering a state is an event too (ZQ3_EV_ENTER), so the things that
+ * happen on entry, like starting the broker timeout, are rows in the same
+ * table. Each state can have one timer. When it runs out, zq3_fsm_poll()
+ * sends ZQ3_EV_TIMEOUT.
+ *
+ * The actions don't touch hardware. They call the hooks in zq3_fsm_ops,
+ * which the firmware wires to the wifi, connect worker, and MQTT modules
+ * (see main.c), and sim/zq3_fsm_sim.c fakes with a virtual clock. So this
+ * file builds unchanged for both, and the bench tests the real table.
+ *
+ * Only one thread may call zq3_fsm_dispatch() and zq3_fsm_poll(). In the
+ * firmware that's the main loop. Other threads (wifi events, shell
+ * commands) queue their events for it.
+ */
+
+#include <stddef.h>
+#include "zq3_fsm.h"
+
+
+#define S(x) (1u << (x))
+#define ANY (0xffffffffu)
+#define STAY (ZQ3_STATES)
+#define CONNECTED (S(CONNWAIT) | S(SUBWAIT) | S(SYNCWAIT) | S(READY))
+
+typedef bool (*guard_fn)(zq3_fsm *fsm);
+typedef int (*action_fn)(zq3_fsm *fsm);
+
+typedef struct {
+	uint32_t from;          // mask of states this row applies to
+	zq3_fsm_event event;
+	guard_fn guard;         // NULL = always
+	action_fn action;       // NULL = nothing to do
+	zq3_state to;           // next state (STAY = no change)
+	zq3_state fail;         // next state if the action fails
+} transition;
+
+static const char *const state_names[ZQ3_STATES] = {
+	"OFFLINE", "WIFI_ERR", "WIFIWAIT", "MQTT_ERR", "CONNECTING", "CONNWAIT",
+	"SUBWAIT", "SYNCWAIT", "READY",
+};
+
+static const char *const event_names[ZQ3_EVENTS] = {
+	"ENTER", "TIMEOUT", "PRESS", "WIFI_UP", "WIFI_DOWN", "WIFI_FAIL", "ROAM",
+	"MQTT_UP", "MQTT_DOWN", "CONN_DONE", "CONNACK", "SUBACK", "VALUE",
+	"MQTT_ERR", "FAILBACK",
+};
+
+
+/*
+* GUARDS
+*/
+
+// Event argument is set (CONN_DONE error)
+static bool arg_set(zq3_fsm *fsm) {
+	return fsm->arg != 0;
+}
+
+// A local toggle change is waiting to be published
+static bool pending(zq3_fsm *fsm) {
+	return fsm->ops->pending(fsm->ops_arg);
+}
+
+static bool not_pending(zq3_fsm *fsm) {
+	return !pending(fsm);
+}
+
+// The broker kept our session (CONNACK), and it has the topics we want
+static bool resumed(zq3_fsm *fsm) {
+	return fsm->arg != 0 && fsm->ops->subscribed(fsm->ops_arg);
+}
+
+static bool resumed_pending(zq3_fsm *fsm) {
+	return resumed(fsm) && pending(fsm);
+}
+
+
+/*
+* ACTIONS
+*/
+
+static int wifi_connect(zq3_fsm *fsm) {
+	return fsm->ops->wifi_connect(fsm->ops_arg);
+}
+
+static int connect(zq3_fsm *fsm) {
+	fsm->ops->connect(fsm->ops_arg);
+	return 0;
+}
+
+// `aio up`: connect, and keep trying other brokers after errors
+static int mqtt_up(zq3_fsm *fsm) {
+	fsm->failover = true;
+	return connect(fsm);
+}
+
+// `aio up` without wifi: join wifi first (WIFI_UP connects)
+static int join(zq3_fsm *fsm) {
+	fsm->failover = true;
+	return wifi_connect(fsm);
+}
+
+// `aio up` while wifi is coming back: just keep trying after errors
+static int rearm(zq3_fsm *fsm) {
+	fsm->failover = true;
+	return 0;
+}
+
+// Retry by hand, starting over from the most preferred broker
+static int retry(zq3_fsm *fsm) {
+	fsm->failover = true;
+	fsm->ops->first_broker(fsm->ops_arg);
+	return connect(fsm);
+}
+
+// Cancel a connection that's coming up and stay disconnected (the worker's
+// CONN_DONE moves on to MQTT_ERR)
+static int cancel(zq3_fsm *fsm) {
+	fsm->failover = false;
+	fsm->ops->cancel(fsm->ops_arg);
+	return 0;
+}
+
+// `aio dn`: disconnect and stay disconnected
+static int mqtt_down(zq3_fsm *fsm) {
+	fsm->failover = false;
+	fsm->timer_at = 0;
+	if (fsm->state != MQTT_ERR) {
+		fsm->ops->disconnect(fsm->ops_arg);
+	}
+	return 0;
+}
+
+static int disconnect(zq3_fsm *fsm) {
+	fsm->ops->disconnect(fsm->ops_arg);
+	return 0;
+}
+
+static int failback(zq3_fsm *fsm) {
+	fsm->ops->disconnect(fsm->ops_arg);
+	fsm->ops->first_broker(fsm->ops_arg);
+	return connect(fsm);
+}
+
+// Entering WIFIWAIT: drop a connection left over from before wifi went down
+static int drop(zq3_fsm *fsm) {
+	fsm->ops->drop(fsm->ops_arg);
+	return 0;
+}
+
+static int stop_worker(zq3_fsm *fsm) {
+	fsm->ops->cancel(fsm->ops_arg);
+	return 0;
+}
+
+// Entering MQTT_ERR: drop what's left of the connection (so a retry doesn't
+// start on top of it), then with failover on, try the next broker after a
+// delay
+static int retry_later(zq3_fsm *fsm) {
+	fsm->ops->drop(fsm->ops_arg);
+	if (!fsm->failover) {
+		return 0;
+	}
+	int64_t delay = fsm->ops->failover(fsm->ops_arg);
+	if (delay >= 0) {
+		fsm->timer_at = fsm->now + delay;
+	}
+	return 0;
+}
+
+static int broker_timer(zq3_fsm *fsm) {
+	fsm->timer_at = fsm->now + fsm->broker_timeout_ms;
+	return 0;
+}
+
+static int sync_timer(zq3_fsm *fsm) {
+	fsm->timer_at = fsm->now + fsm->sync_timeout_ms;
+	return 0;
+}
+
+static int subscribe(zq3_fsm *fsm) {
+	return fsm->ops->subscribe(fsm->ops_arg, false);
+}
+
+static int sync(zq3_fsm *fsm) {
+	return fsm->ops->sync(fsm->ops_arg, true);
+}
+
+// Skip asking for the toggle value: the unpublished local change wins
+static int sync_widgets(zq3_fsm *fsm) {
+	return fsm->ops->sync(fsm->ops_arg, false);
+}
+
+// The broker kept our session with the same topics, so we're still
+// subscribed. Retained values may have changed while we were offline, so
+// ask for them like after a SUBACK.
+static int resume(zq3_fsm *fsm) {
+	int err = fsm->ops->subscribe(fsm->ops_arg, true);
+	return err ? err : sync(fsm);
+}
+
+static int resume_widgets(zq3_fsm *fsm) {
+	int err = fsm->ops->subscribe(fsm->ops_arg, true);
+	return err ? err : sync_widgets(fsm);
+}
+
+static int toggle(zq3_fsm *fsm) {
+	fsm->ops->toggle(fsm->ops_arg);
+	return 0;
+}
+
+
+/*
+* TRANSITIONS
+*/
+
+static const transition table[] = {
+	// Entering a state
+	{S(WIFI_ERR), ZQ3_EV_ENTER, NULL, stop_worker, STAY, STAY},
+	{S(WIFIWAIT), ZQ3_EV_ENTER, NULL, drop, STAY, STAY},
+	{S(MQTT_ERR), ZQ3_EV_ENTER, NULL, retry_later, STAY, STAY},
+	{S(CONNWAIT) | S(SUBWAIT), ZQ3_EV_ENTER, NULL, broker_timer, STAY, STAY},
+	{S(SYNCWAIT), ZQ3_EV_ENTER, NULL, sync_timer, STAY, STAY},
+
+	// Button
+	{S(OFFLINE) | S(WIFI_ERR), ZQ3_EV_PRESS, NULL, wifi_connect,
+		WIFIWAIT, WIFI_ERR},
+	{S(MQTT_ERR), ZQ3_EV_PRESS, NULL, retry, CONNECTING, STAY},
+	{S(CONNECTING), ZQ3_EV_PRESS, NULL, cancel, STAY, STAY},
+	{S(READY), ZQ3_EV_PRESS, NULL, toggle, STAY, STAY},
+
+	// Wifi
+	{ANY, ZQ3_EV_WIFI_UP, NULL, connect, CONNECTING, STAY},
+	{ANY, ZQ3_EV_WIFI_DOWN, NULL, NULL, WIFIWAIT, STAY},
+	{ANY, ZQ3_EV_WIFI_FAIL, NULL, NULL, WIFI_ERR, STAY},
+	{CONNECTED, ZQ3_EV_ROAM, NULL, disconnect, WIFIWAIT, STAY},
+	{ANY, ZQ3_EV_ROAM, NULL, NULL, WIFIWAIT, STAY},
+
+	// Shell
+	{S(OFFLINE) | S(WIFI_ERR), ZQ3_EV_MQTT_UP, NULL, join, WIFIWAIT, WIFI_ERR},
+	{S(WIFIWAIT), ZQ3_EV_MQTT_UP, NULL, rearm, STAY, STAY},
+	{S(MQTT_ERR), ZQ3_EV_MQTT_UP, NULL, mqtt_up, CONNECTING, STAY},
+	{S(CONNECTING), ZQ3_EV_MQTT_DOWN, NULL, cancel, STAY, STAY},
+	{CONNECTED | S(MQTT_ERR), ZQ3_EV_MQTT_DOWN, NULL, mqtt_down,
+		MQTT_ERR, STAY},
+
+	// Broker connection
+	{S(CONNECTING), ZQ3_EV_CONN_DONE, arg_set, NULL, MQTT_ERR, STAY},
+	{S(CONNECTING), ZQ3_EV_CONN_DONE, NULL, NULL, CONNWAIT, STAY},
+	{S(CONNWAIT), ZQ3_EV_CONNACK, resumed_pending, resume_widgets, READY,
+		MQTT_ERR},
+	{S(CONNWAIT), ZQ3_EV_CONNACK, resumed, resume, SYNCWAIT, MQTT_ERR},
+	{S(CONNWAIT), ZQ3_EV_CONNACK, NULL, subscribe, SUBWAIT, MQTT_ERR},
+	{S(SUBWAIT), ZQ3_EV_SUBACK, pending, sync_widgets, READY, MQTT_ERR},
+	{S(SUBWAIT), ZQ3_EV_SUBACK, NULL, sync, SYNCWAIT, MQTT_ERR},
+	{S(SYNCWAIT), ZQ3_EV_VALUE, NULL, NULL, READY, STAY},
+	{CONNECTED, ZQ3_EV_MQTT_ERR, NULL, NULL, MQTT_ERR, STAY},
+	{S(READY), ZQ3_EV_FAILBACK, not_pending, failback, CONNECTING, STAY},
+
+	// Timers: broker went quiet, broker didn't send the value (use the
+	// saved one), failover delay is up
+	{S(CONNWAIT) | S(SUBWAIT), ZQ3_EV_TIMEOUT, NULL, NULL, MQTT_ERR, STAY},
+	{S(SYNCWAIT), ZQ3_EV_TIMEOUT, NULL, NULL, READY, STAY},
+	{S(MQTT_ERR), ZQ3_EV_TIMEOUT, NULL, connect, CONNECTING, STAY},
+};
+
+
+void zq3_fsm_init(zq3_fsm *fsm, const zq3_fsm_ops *ops, void *ops_arg,
+	uint32_t broker_timeout_ms, uint32_t sync_timeout_ms)
+{
+	*fsm = (zq3_fsm){
+		.ops = ops,
+		.ops_arg = ops_arg,
+		.state = OFFLINE,
+		.failover = true,
+		.broker_timeout_ms = broker_timeout_ms,
+		.sync_timeout_ms = sync_timeout_ms,
+	};
+}
+
+// Run the first matching transition for an event
+static bool step(zq3_fsm *fsm, zq3_fsm_event ev, int arg) {
+	for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+		const transition *t = &table[i];
+		if (t->event != ev || !(t->from & S(fsm->state))) {
+			continue;
+		}
+		fsm->arg = arg;
+		if (t->guard && !t->guard(fsm)) {
+			continue;
+		}
+		zq3_state to = t->to;
+		if (t->action && t->action(fsm) < 0) {
+			to = t->fail;
+		}
+		if (to != STAY && to != fsm->state) {
+			zq3_state from = fsm->state;
+			fsm->state = to;
+			fsm->since = fsm->now;
+			fsm->timer_at = 0;
+			step(fsm, ZQ3_EV_ENTER, 0);
+			fsm->ops->entered(fsm->ops_arg, from, to);
+		}
+		return true;
+	}
+	if (ev != ZQ3_EV_ENTER) {
+		fsm->ignored++;
+	}
+	return false;
+}
+
+// Handle an event. Returns false if the current state ignores it.
+//
+// Actions can cause events of their own (disconnecting makes the MQTT
+// library send DISCONNECT). Those wait until the current transition is
+// finished, so each transition runs to completion before the next starts.
+bool zq3_fsm_dispatch(zq3_fsm *fsm, zq3_fsm_event ev, int arg, int64_t now) {
+	if (fsm->busy) {
+		if (fsm->queued == ZQ3_FSM_QUEUE) {
+			fsm->dropped++;
+			return false;
+		}
+		fsm->queue[fsm->queued].ev = ev;
+		fsm->queue[fsm->queued].arg = arg;
+		fsm->queued++;
+		return true;
+	}
+	fsm->busy = true;
+	fsm->now = now;
+	fsm->events++;
+	bool handled = step(fsm, ev, arg);
+	for (int i = 0; i < fsm->queued; i++) {
+		fsm->events++;
+		step(fsm, fsm->queue[i].ev, fsm->queue[i].arg);
+	}
+	fsm->queued = 0;
+	fsm->busy = false;
+	return handled;
+}
+
+// Send TIMEOUT if the current state's timer ran out
+void zq3_fsm_poll(zq3_fsm *fsm, int64_t now) {
+	if (fsm->timer_at && now >= fsm->timer_at) {
+		fsm->timer_at = 0;
+		zq3_fsm_dispatch(fsm, ZQ3_EV_TIMEOUT, 0, now);
+	}
+}
+
+const char *zq3_fsm_state_name(zq3_state state) {
+	return (state < ZQ3_STATES) ? state_names[state] : "?";
+}
+
+const char *zq3_fsm_event_name(zq3_fsm_event ev) {
+	return (ev < ZQ3_EVENTS) ? event_names[ev] : "?";
+}
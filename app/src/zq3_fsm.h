@@ -0,0 +1,93 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_FSM_H
+#define ZQ3_FSM_H
+
+// This doesn't depend on Zephyr, so the host side simulation bench
+// (sim/zq3_fsm_sim.c) runs the same state machine as the firmware.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "zq3_state.h"
+
+
+// Things that happen to the connection
+typedef enum {
+	ZQ3_EV_ENTER,       // just entered a state (internal)
+	ZQ3_EV_TIMEOUT,     // state timer ran out (internal, zq3_fsm_poll)
+	ZQ3_EV_PRESS,       // button click: connect, retry, cancel, or toggle
+	ZQ3_EV_WIFI_UP,     // wifi connected
+	ZQ3_EV_WIFI_DOWN,   // wifi dropped (the wifi manager reconnects)
+	ZQ3_EV_WIFI_FAIL,   // wifi gave up
+	ZQ3_EV_ROAM,        // moving to a better AP
+	ZQ3_EV_MQTT_UP,     // `aio up`
+	ZQ3_EV_MQTT_DOWN,   // `aio dn`
+	ZQ3_EV_CONN_DONE,   // connect worker finished (arg: error, 0 = CONNECT sent)
+	ZQ3_EV_CONNACK,     // arg: broker kept our session
+	ZQ3_EV_SUBACK,
+	ZQ3_EV_VALUE,       // broker sent the toggle value
+	ZQ3_EV_MQTT_ERR,    // DISCONNECT, publish failed, or no PINGRESP
+	ZQ3_EV_FAILBACK,    // time to go back to the preferred broker
+	ZQ3_EVENTS,
+} zq3_fsm_event;
+
+// What the state machine does to the outside world. The firmware hooks
+// these up to the wifi, connect worker, and MQTT modules. The simulation
+// bench fakes them with a virtual clock. Each gets ops_arg.
+typedef struct {
+	int (*wifi_connect)(void *arg);
+	void (*connect)(void *arg);         // start the connect worker
+	void (*cancel)(void *arg);          // cancel the connect worker
+	void (*drop)(void *arg);            // drop what's left of the connection
+	void (*disconnect)(void *arg);      // send DISCONNECT
+	void (*first_broker)(void *arg);    // go back to the preferred broker
+	int64_t (*failover)(void *arg);     // line up the next broker, return
+	                                    // the delay (ms, < 0 = don't retry)
+	bool (*subscribed)(void *arg);      // a kept session has our topics
+	int (*subscribe)(void *arg, bool resumed);
+	int (*sync)(void *arg, bool get_toggle);
+	bool (*pending)(void *arg);         // unpublished local toggle change
+	void (*toggle)(void *arg);
+	void (*entered)(void *arg, zq3_state from, zq3_state to);
+} zq3_fsm_ops;
+
+// Events caused by actions wait here until the transition is done
+#define ZQ3_FSM_QUEUE (4)
+
+typedef struct {
+	const zq3_fsm_ops *ops;
+	void *ops_arg;
+	zq3_state state;
+	bool failover;             // reconnect (to the next broker) after errors
+	int64_t now;               // time of the event being handled (ms)
+	int64_t since;             // time the current state was entered
+	int64_t timer_at;          // time of the next TIMEOUT (0 = no timer)
+	int arg;                   // argument of the event being handled
+	uint32_t broker_timeout_ms; // wait for CONNACK or SUBACK
+	uint32_t sync_timeout_ms;  // wait for the toggle value after SUBACK
+	bool busy;                 // in the middle of a transition
+	struct {
+		zq3_fsm_event ev;
+		int arg;
+	} queue[ZQ3_FSM_QUEUE];
+	int queued;
+	uint32_t events;           // events handled
+	uint32_t ignored;          // events with no transition in their state
+	uint32_t dropped;          // queue was full
+} zq3_fsm;
+
+void zq3_fsm_init(zq3_fsm *fsm, const zq3_fsm_ops *ops, void *ops_arg,
+	uint32_t broker_timeout_ms, uint32_t sync_timeout_ms);
+
+bool zq3_fsm_dispatch(zq3_fsm *fsm, zq3_fsm_event ev, int arg, int64_t now);
+
+void zq3_fsm_poll(zq3_fsm *fsm, int64_t now);
+
+const char *zq3_fsm_state_name(zq3_state state);
+
+const char *zq3_fsm_event_name(zq3_fsm_event ev);
+
+
+#endif /* ZQ3_FSM_H */
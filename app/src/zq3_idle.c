@@ -0,0 +1,168 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Display activity manager: dim the backlight, then sleep the panel
+ *
+ * After CONFIG_ZQ3_IDLE_DIM_S seconds without activity, the backlight PWM
+ * drops to CONFIG_ZQ3_IDLE_DIM_PCT. After CONFIG_ZQ3_IDLE_SLEEP_S seconds,
+ * the backlight turns off, the ST7789V goes into sleep mode (SLPIN), and the
+ * LVGL refresh timer gets paused so nothing gets rendered for a dark screen.
+ *
+ * Activity means a button press (see zq3_input.c) or something the main
+ * loop decides the user needs to see, like a toggle change from MQTT. The
+ * idle timers use LVGL's display inactivity time. Pressing the button
+ * while the display sleeps only wakes it up. Otherwise, people would flip
+ * the toggle without seeing it.
+ *
+ * Docs & Refs:
+ * https://docs.zephyrproject.org/latest/hardware/peripherals/pwm.html
+ * https://docs.lvgl.io/9.2/overview/display.html (inactivity)
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/drivers/pwm.h>
+#include <lvgl.h>
+#include "zq3_disp.h"
+#include "zq3_idle.h"
+
+LOG_MODULE_REGISTER(zq3_idle, CONFIG_ZQ3_IDLE_LOG_LEVEL);
+
+
+static const struct pwm_dt_spec backlight =
+	PWM_DT_SPEC_GET(DT_ALIAS(backlight));
+
+// Backlight duty cycle (percent) for each state
+static const uint8_t duty_pct[ZQ3_IDLE_STATES] = {
+	100, CONFIG_ZQ3_IDLE_DIM_PCT, 0,
+};
+static const char *state_names[ZQ3_IDLE_STATES] = {"on", "dim", "sleep"};
+
+
+// Set the backlight brightness
+static int set_backlight(uint8_t pct) {
+	uint32_t pulse = (uint32_t)(((uint64_t)backlight.period * pct) / 100);
+	int err = pwm_set_pulse_dt(&backlight, pulse);
+	if (err) {
+		LOG_ERR("backlight pwm = %d", err);
+	}
+	return err;
+}
+
+// Move to a new power state
+static void set_state(zq3_idle_context *idle, zq3_idle_state state) {
+	if (state == idle->state) {
+		return;
+	}
+	int64_t now = k_uptime_get();
+	lv_timer_t *refr = lv_display_get_refr_timer(lv_display_get_default());
+	idle->time_in[idle->state] += now - idle->since;
+	idle->since = now;
+	if (state == ZQ3_IDLE_SLEEP) {
+		set_backlight(0);
+		zq3_disp_sleep(true);
+		lv_timer_pause(refr);
+	} else if (idle->state == ZQ3_IDLE_SLEEP) {
+		// Wake up: draw what changed while asleep, then turn on the light
+		lv_timer_resume(refr);
+		zq3_disp_sleep(false);
+		set_backlight(duty_pct[state]);
+		idle->wakes++;
+		idle->wake_ms = k_uptime_get_32() - idle->wake_at;
+		idle->wake_ms_max = MAX(idle->wake_ms, idle->wake_ms_max);
+		LOG_INF("Display wake: %d ms", idle->wake_ms);
+	} else {
+		set_backlight(duty_pct[state]);
+	}
+	idle->state = state;
+}
+
+// Turn the backlight on full
+int zq3_idle_init(zq3_idle_context *idle) {
+	memset(idle, 0, sizeof(*idle));
+	idle->state = ZQ3_IDLE_ON;
+	idle->since = k_uptime_get();
+	if (!pwm_is_ready_dt(&backlight)) {
+		LOG_ERR("backlight pwm not ready");
+		return -ENODEV;
+	}
+	return set_backlight(duty_pct[ZQ3_IDLE_ON]);
+}
+
+// Handle a button press that happened at uptime `at` (ms). This returns true
+// if the display was asleep, meaning the press should only wake it up.
+bool zq3_idle_press(zq3_idle_context *idle, uint32_t at) {
+	lv_display_trigger_activity(NULL);
+	if (idle->state != ZQ3_IDLE_SLEEP) {
+		return false;
+	}
+	if (!idle->wake_pending) {
+		idle->wake_pending = true;
+		idle->wake_at = at;
+	}
+	return true;
+}
+
+// Note activity that the user should see (restarts the idle timers)
+void zq3_idle_activity(zq3_idle_context *idle) {
+	lv_display_trigger_activity(NULL);
+	if (idle->state == ZQ3_IDLE_SLEEP && !idle->wake_pending) {
+		idle->wake_pending = true;
+		idle->wake_at = k_uptime_get_32();
+	}
+}
+
+// Update the power state. The main loop calls this each time around.
+void zq3_idle_update(zq3_idle_context *idle) {
+	const uint32_t dim_ms = CONFIG_ZQ3_IDLE_DIM_S * 1000;
+	const uint32_t sleep_ms = CONFIG_ZQ3_IDLE_SLEEP_S * 1000;
+	uint32_t inactive = lv_display_get_inactive_time(NULL);
+	if (idle->wake_pending) {
+		idle->wake_pending = false;
+		lv_display_trigger_activity(NULL);
+		set_state(idle, ZQ3_IDLE_ON);
+	} else if (sleep_ms > 0 && inactive >= sleep_ms) {
+		set_state(idle, ZQ3_IDLE_SLEEP);
+	} else if (dim_ms > 0 && inactive >= dim_ms) {
+		// Once asleep, only a wake request turns the display back on
+		if (idle->state != ZQ3_IDLE_SLEEP) {
+			set_state(idle, ZQ3_IDLE_DIM);
+		}
+	} else if (idle->state != ZQ3_IDLE_SLEEP) {
+		set_state(idle, ZQ3_IDLE_ON);
+	}
+}
+
+// Print time in each state, average backlight level, and wake latency. If
+// CONFIG_ZQ3_IDLE_BACKLIGHT_MW and CONFIG_ZQ3_IDLE_PANEL_MW are set (from
+// measurements of your board), this also estimates average display power.
+void zq3_idle_print(zq3_idle_context *idle) {
+	int64_t t[ZQ3_IDLE_STATES];
+	int64_t total = 0;
+	int64_t duty = 0;
+	for (int i = 0; i < ZQ3_IDLE_STATES; i++) {
+		t[i] = idle->time_in[i];
+		if (i == idle->state) {
+			t[i] += k_uptime_get() - idle->since;
+		}
+		total += t[i];
+		duty += t[i] * duty_pct[i];
+	}
+	total = MAX(total, 1);
+	printk("Display: %s, inactive for %d s\n", state_names[idle->state],
+		lv_display_get_inactive_time(NULL) / 1000);
+	printk("Time: on %d%%, dim %d%%, sleep %d%%\n",
+		(int)(t[ZQ3_IDLE_ON] * 100 / total),
+		(int)(t[ZQ3_IDLE_DIM] * 100 / total),
+		(int)(t[ZQ3_IDLE_SLEEP] * 100 / total));
+	printk("Average backlight: %d%%\n", (int)(duty / total));
+	printk("Wakeups: %d (last %d ms, max %d ms)\n", idle->wakes,
+		idle->wake_ms, idle->wake_ms_max);
+	if (CONFIG_ZQ3_IDLE_BACKLIGHT_MW > 0 || CONFIG_ZQ3_IDLE_PANEL_MW > 0) {
+		int64_t awake = total - t[ZQ3_IDLE_SLEEP];
+		int mw = (int)((CONFIG_ZQ3_IDLE_BACKLIGHT_MW * duty / 100 +
+			CONFIG_ZQ3_IDLE_PANEL_MW * awake) / total);
+		printk("Estimated average display power: %d mW\n", mw);
+	}
+}
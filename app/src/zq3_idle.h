@@ -0,0 +1,42 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_IDLE_H
+#define ZQ3_IDLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// Display power states, from most to least power
+typedef enum {
+	ZQ3_IDLE_ON,     // backlight at full brightness
+	ZQ3_IDLE_DIM,    // backlight dimmed
+	ZQ3_IDLE_SLEEP,  // backlight off, panel in SLPIN, LVGL refresh paused
+	ZQ3_IDLE_STATES,
+} zq3_idle_state;
+
+typedef struct {
+	zq3_idle_state state;
+	int64_t since;                       // uptime when state started (ms)
+	int64_t time_in[ZQ3_IDLE_STATES];    // total time in each state (ms)
+	bool wake_pending;                   // wake up on next update
+	uint32_t wake_at;                    // uptime of the wake request (ms)
+	uint32_t wakes;                      // count of wakeups from sleep
+	uint32_t wake_ms;                    // latency of the last wakeup
+	uint32_t wake_ms_max;                // worst wakeup latency
+} zq3_idle_context;
+
+int zq3_idle_init(zq3_idle_context *idle);
+
+bool zq3_idle_press(zq3_idle_context *idle, uint32_t at);
+
+void zq3_idle_activity(zq3_idle_context *idle);
+
+void zq3_idle_update(zq3_idle_context *idle);
+
+void zq3_idle_print(zq3_idle_context *idle);
+
+
+#endif /* ZQ3_IDLE_H */
@@ -0,0 +1,282 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Input events: debounce, long-press, and double-click for every key
+ *
+ * Key events from all input devices (the BOOT button, plus any other
+ * gpio-keys or ESP32 touch pads in devicetree, see app/inputs.overlay) go
+ * into a timestamped queue as soon as the input subsystem reports them, so
+ * presses that happen between passes through the main loop don't get lost.
+ * The input callback also signals an eventfd that wakes up the main loop.
+ *
+ * zq3_input_poll() runs in the main loop. It debounces each key (leading
+ * edge, so a clean press isn't delayed), works out gestures, and calls the
+ * handlers registered for them with zq3_input_on(). CLICK only waits for
+ * the double-click timeout if the key has a DOUBLE handler, and a long
+ * press only cancels the click if the key has a LONG handler.
+ *
+ * Docs & Refs:
+ * https://docs.zephyrproject.org/latest/services/input/index.html
+ * https://docs.zephyrproject.org/latest/build/dts/api/bindings/input/gpio-keys.html
+ * https://docs.zephyrproject.org/latest/build/dts/api/bindings/input/espressif%2Cesp32-touch.html
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/dt-bindings/input/input-event-codes.h>
+#include <zephyr/input/input.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+#include <sys/eventfd.h>
+#include "zq3_input.h"
+
+LOG_MODULE_REGISTER(zq3_input, CONFIG_ZQ3_INPUT_LOG_LEVEL);
+
+
+// Raw key event from the input subsystem
+typedef struct {
+	uint16_t code;
+	bool down;
+	uint32_t at;
+	uint32_t cyc;
+} raw_event;
+
+// Key code for `aio input` benchmark events (no real key uses this)
+#define BENCH_CODE (INPUT_KEY_F24)
+
+K_MSGQ_DEFINE(raw_q, sizeof(raw_event), CONFIG_ZQ3_INPUT_QUEUE, 4);
+static atomic_t dropped = ATOMIC_INIT(0);
+static int wake_fd = -1;
+
+// Benchmark results (handler runs in the main loop, bench in the shell)
+static K_SEM_DEFINE(bench_sem, 0, 1);
+static uint32_t bench_cb_cyc;       // when the input callback saw the event
+static uint32_t bench_handler_cyc;  // when the handler ran
+
+
+// Input subsystem callback (runs in the input thread)
+static void input_cb(struct input_event *evt, void *user_data) {
+	if (evt->type != INPUT_EV_KEY) {
+		return;
+	}
+	raw_event r = {
+		.code = evt->code,
+		.down = evt->value != 0,
+		.at = k_uptime_get_32(),
+		.cyc = k_cycle_get_32(),
+	};
+	if (k_msgq_put(&raw_q, &r, K_NO_WAIT)) {
+		atomic_inc(&dropped);
+	}
+	if (wake_fd >= 0) {
+		eventfd_write(wake_fd, 1);
+	}
+}
+INPUT_CALLBACK_DEFINE(NULL, input_cb, NULL);
+
+// Handler for benchmark events
+static void bench_handler(const zq3_input_event *ev) {
+	bench_cb_cyc = ev->cyc;
+	bench_handler_cyc = k_cycle_get_32();
+	k_sem_give(&bench_sem);
+}
+
+// Make the wake eventfd and register the benchmark handler. The filter gets
+// a look at each new press before any handlers (NULL means no filter).
+int zq3_input_init(zq3_input_context *inp, zq3_input_filter filter) {
+	memset(inp, 0, sizeof(*inp));
+	inp->filter = filter;
+	if (wake_fd < 0) {
+		wake_fd = eventfd(0, EFD_NONBLOCK);
+		if (wake_fd < 0) {
+			LOG_ERR("input eventfd: %d", -errno);
+		}
+	}
+	return zq3_input_on(inp, BENCH_CODE, ZQ3_INPUT_PRESS, bench_handler);
+}
+
+// Call fn when a key makes a gesture. Register handlers before the main
+// loop starts.
+int zq3_input_on(zq3_input_context *inp, uint16_t code,
+	zq3_input_gesture gesture, zq3_input_handler fn)
+{
+	if (inp->handler_count >= ARRAY_SIZE(inp->handlers)) {
+		LOG_ERR("too many input handlers (CONFIG_ZQ3_INPUT_HANDLERS)");
+		return -ENOMEM;
+	}
+	int i = inp->handler_count++;
+	inp->handlers[i].code = code;
+	inp->handlers[i].gesture = gesture;
+	inp->handlers[i].fn = fn;
+	return 0;
+}
+
+// Get the eventfd that becomes readable when there are input events (the
+// main loop polls it along with the LAN socket)
+int zq3_input_fd(void) {
+	return wake_fd;
+}
+
+static bool has_handler(zq3_input_context *inp, uint16_t code,
+	zq3_input_gesture gesture)
+{
+	for (int i = 0; i < inp->handler_count; i++) {
+		if (inp->handlers[i].code == code &&
+			inp->handlers[i].gesture == gesture)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Call the handlers for a gesture
+static void emit(zq3_input_context *inp, zq3_input_key *key,
+	zq3_input_gesture gesture, uint32_t at, uint32_t cyc)
+{
+	const zq3_input_event ev = {key->code, gesture, at, cyc};
+	inp->gestures++;
+	for (int i = 0; i < inp->handler_count; i++) {
+		if (inp->handlers[i].code == key->code &&
+			inp->handlers[i].gesture == gesture)
+		{
+			inp->handlers[i].fn(&ev);
+		}
+	}
+}
+
+// Find the state for a key code, or start tracking a new key
+static zq3_input_key *find_key(zq3_input_context *inp, uint16_t code) {
+	for (int i = 0; i < inp->key_count; i++) {
+		if (inp->keys[i].code == code) {
+			return &inp->keys[i];
+		}
+	}
+	if (inp->key_count >= ARRAY_SIZE(inp->keys)) {
+		return NULL;
+	}
+	zq3_input_key *key = &inp->keys[inp->key_count++];
+	memset(key, 0, sizeof(*key));
+	key->code = code;
+	return key;
+}
+
+// Accept a debounced edge and work out what gesture it makes
+static void edge(zq3_input_context *inp, zq3_input_key *key, bool down,
+	uint32_t at, uint32_t cyc)
+{
+	key->down = down;
+	key->edge_at = at;
+	if (down) {
+		const zq3_input_event ev = {key->code, ZQ3_INPUT_PRESS, at, cyc};
+		key->down_at = at;
+		key->long_sent = false;
+		key->swallow = inp->filter && key->code != BENCH_CODE &&
+			inp->filter(&ev);
+		if (key->swallow) {
+			key->clicks = 0;
+			return;
+		}
+		emit(inp, key, ZQ3_INPUT_PRESS, at, cyc);
+		return;
+	}
+	if (key->swallow || key->long_sent) {
+		key->swallow = false;
+		return;
+	}
+	key->clicks++;
+	if (key->clicks >= 2) {
+		key->clicks = 0;
+		emit(inp, key, ZQ3_INPUT_DOUBLE, at, cyc);
+	} else if (!has_handler(inp, key->code, ZQ3_INPUT_DOUBLE)) {
+		key->clicks = 0;
+		emit(inp, key, ZQ3_INPUT_CLICK, at, cyc);
+	} else {
+		key->click_at = at;
+	}
+}
+
+// Handle queued input events and gesture timeouts. The main loop calls this
+// each time around.
+void zq3_input_poll(zq3_input_context *inp) {
+	const uint32_t debounce = CONFIG_ZQ3_INPUT_DEBOUNCE_MS;
+	eventfd_t unused;
+	raw_event r;
+	if (wake_fd >= 0) {
+		eventfd_read(wake_fd, &unused);
+	}
+	while (k_msgq_get(&raw_q, &r, K_NO_WAIT) == 0) {
+		zq3_input_key *key = find_key(inp, r.code);
+		inp->events++;
+		if (key == NULL) {
+			continue;
+		}
+		key->raw = r.down;
+		// Leading edge debounce: take the first edge right away, then
+		// ignore bounces until the debounce time is up
+		if (r.down != key->down && r.at - key->edge_at >= debounce) {
+			edge(inp, key, r.down, r.at, r.cyc);
+		}
+	}
+	uint32_t now = k_uptime_get_32();
+	uint32_t cyc = k_cycle_get_32();
+	for (int i = 0; i < inp->key_count; i++) {
+		zq3_input_key *key = &inp->keys[i];
+		// If the key ended up in a different state after bouncing, take
+		// that state once the debounce time is up
+		if (key->raw != key->down && now - key->edge_at >= debounce) {
+			edge(inp, key, key->raw, now, cyc);
+		}
+		if (key->down && !key->swallow && !key->long_sent &&
+			now - key->down_at >= CONFIG_ZQ3_INPUT_LONG_MS &&
+			has_handler(inp, key->code, ZQ3_INPUT_LONG))
+		{
+			key->long_sent = true;
+			key->clicks = 0;
+			emit(inp, key, ZQ3_INPUT_LONG, now, cyc);
+		}
+		if (key->clicks == 1 && !key->down &&
+			now - key->click_at >= CONFIG_ZQ3_INPUT_DOUBLE_MS)
+		{
+			key->clicks = 0;
+			emit(inp, key, ZQ3_INPUT_CLICK, now, cyc);
+		}
+	}
+}
+
+// Print input event counters
+void zq3_input_print(zq3_input_context *inp) {
+	printk("Input: %d keys, %d events, %d gestures, %d dropped\n",
+		inp->key_count, inp->events, inp->gestures, (int)atomic_get(&dropped));
+	printk("debounce %d ms, long-press %d ms, double-click %d ms\n",
+		CONFIG_ZQ3_INPUT_DEBOUNCE_MS, CONFIG_ZQ3_INPUT_LONG_MS,
+		CONFIG_ZQ3_INPUT_DOUBLE_MS);
+}
+
+// Measure input-to-action latency. This runs in the shell thread. It reports
+// fake key presses to the input subsystem and times how long they take to
+// reach the input callback and then a handler in the main loop.
+int zq3_input_bench(zq3_input_context *inp, int rounds) {
+	const struct device *dev = DEVICE_DT_GET(DT_NODELABEL(buttons));
+	uint32_t to_cb = 0, to_handler = 0, worst = 0;
+	for (int i = 0; i < rounds; i++) {
+		k_sem_reset(&bench_sem);
+		uint32_t start = k_cycle_get_32();
+		input_report_key(dev, BENCH_CODE, 1, true, K_FOREVER);
+		if (k_sem_take(&bench_sem, K_MSEC(1000))) {
+			printk("ERR: no input event from main loop\n");
+			return -ETIMEDOUT;
+		}
+		input_report_key(dev, BENCH_CODE, 0, true, K_FOREVER);
+		uint32_t total = k_cyc_to_us_floor32(bench_handler_cyc - start);
+		to_cb += k_cyc_to_us_floor32(bench_cb_cyc - start);
+		to_handler += total;
+		worst = MAX(worst, total);
+		// Let the release get past the debounce time
+		k_msleep(2 * CONFIG_ZQ3_INPUT_DEBOUNCE_MS + 100);
+	}
+	printk("Input latency (%d presses): %d us to callback, "
+		"%d us to handler (max %d us)\n", rounds, to_cb / rounds,
+		to_handler / rounds, worst);
+	return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_INPUT_H
+#define ZQ3_INPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// Gestures that handlers can be registered for
+typedef enum {
+	ZQ3_INPUT_PRESS,   // key went down (fires right away, before CLICK)
+	ZQ3_INPUT_CLICK,   // press and release (not part of a double-click)
+	ZQ3_INPUT_DOUBLE,  // two clicks within CONFIG_ZQ3_INPUT_DOUBLE_MS
+	ZQ3_INPUT_LONG,    // held down for CONFIG_ZQ3_INPUT_LONG_MS
+	ZQ3_INPUT_GESTURES,
+} zq3_input_gesture;
+
+typedef struct {
+	uint16_t code;              // INPUT_KEY_* code from devicetree
+	zq3_input_gesture gesture;
+	uint32_t at;                // uptime of the input event (ms)
+	uint32_t cyc;               // cycle count of the input event
+} zq3_input_event;
+
+// Handlers run in the main loop (from zq3_input_poll())
+typedef void (*zq3_input_handler)(const zq3_input_event *ev);
+
+// Filter for new presses. Returning true swallows the whole press, so it
+// won't make any gestures (used for waking the display).
+typedef bool (*zq3_input_filter)(const zq3_input_event *ev);
+
+// Debounce and gesture state for one key
+typedef struct {
+	uint16_t code;
+	bool down;           // debounced state
+	bool raw;            // last state reported by the driver
+	uint32_t edge_at;    // uptime of the last debounced edge
+	uint32_t down_at;    // uptime of the last debounced press
+	uint32_t click_at;   // uptime of a click that may become a double-click
+	uint8_t clicks;      // clicks waiting for the double-click timeout
+	bool long_sent;      // LONG already fired for this press
+	bool swallow;        // filter swallowed this press
+} zq3_input_key;
+
+typedef struct {
+	zq3_input_key keys[CONFIG_ZQ3_INPUT_KEYS];
+	int key_count;
+	struct {
+		uint16_t code;
+		zq3_input_gesture gesture;
+		zq3_input_handler fn;
+	} handlers[CONFIG_ZQ3_INPUT_HANDLERS];
+	int handler_count;
+	zq3_input_filter filter;
+	uint32_t events;     // raw key events from the input subsystem
+	uint32_t gestures;   // gestures sent to handlers
+} zq3_input_context;
+
+int zq3_input_init(zq3_input_context *inp, zq3_input_filter filter);
+
+int zq3_input_on(zq3_input_context *inp, uint16_t code,
+	zq3_input_gesture gesture, zq3_input_handler fn);
+
+int zq3_input_fd(void);
+
+void zq3_input_poll(zq3_input_context *inp);
+
+void zq3_input_print(zq3_input_context *inp);
+
+int zq3_input_bench(zq3_input_context *inp, int rounds);
+
+
+#endif /* ZQ3_INPUT_H */
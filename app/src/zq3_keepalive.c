@@ -0,0 +1,249 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Adaptive MQTT keepalive that learns how long a network lets TCP sit idle
+ *
+ * Routers and firewalls forget idle TCP connections after some timeout
+ * (often a few minutes, sometimes hours). When that happens nothing tells
+ * us: the broker's messages just stop arriving. Pinging often keeps the
+ * connection alive, but each ping wakes the radio and costs the broker
+ * some work.
+ *
+ * This sends a PINGREQ once the connection has been idle (no packets either
+ * way) for the current interval. It starts at CONFIG_ZQ3_KEEPALIVE_MIN_S.
+ * After CONFIG_ZQ3_KEEPALIVE_CONFIRMS PINGRESPs in a row, the interval
+ * grows by CONFIG_ZQ3_KEEPALIVE_STEP_S, up to CONFIG_ZQ3_KEEPALIVE_MAX_S.
+ * If a PINGRESP doesn't come within CONFIG_ZQ3_KEEPALIVE_DEADLINE_MS, the
+ * connection is dead and the caller reconnects. A lost PINGRESP can also be
+ * a wifi or broker blip, so the interval only goes back to the longest one
+ * that worked after CONFIG_ZQ3_KEEPALIVE_MISSES probes in a row miss. That's
+ * the learned value for the network.
+ * It gets saved to flash as "<seconds> <ssid>" in zq3/ka (or zq3/ka1, ...,
+ * matching zq3/ssid1, ...), so probing happens once per network.
+ *
+ * If a learned interval stops working (new router), it drops one step and
+ * gets saved again. After CONFIG_ZQ3_KEEPALIVE_REPROBE PINGRESPs in a row at
+ * the learned interval, probing starts again from there, so an interval
+ * that got lowered by bad luck can climb back. The deadline also catches
+ * dead connections on pings that aren't probes, which is faster than
+ * waiting for TCP to give up.
+ *
+ * The keepalive sent in CONNECT is CONFIG_ZQ3_KEEPALIVE_MAX_S, so the broker
+ * won't drop us while the interval grows. When the broker keeps sending
+ * messages, the connection is never idle, but MQTT still needs something
+ * from us within the keepalive time, so that gets a ping too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+#include "zq3_keepalive.h"
+
+LOG_MODULE_REGISTER(zq3_keepalive, CONFIG_ZQ3_KEEPALIVE_LOG_LEVEL);
+
+
+void zq3_keepalive_init(zq3_keepalive_context *ka) {
+	memset(ka, 0, sizeof(*ka));
+	ka->net = -1;
+	ka->interval = CONFIG_ZQ3_KEEPALIVE_MIN_S;
+}
+
+// Load a learned interval from the zq3/ka setting: "<seconds> <ssid>"
+int zq3_keepalive_set(zq3_keepalive_context *ka, const char *key,
+	const char *value, int len)
+{
+	const char *suffix = key + 2;
+	int n = (*suffix == '\0') ? 0 : atoi(suffix);
+	if ((n == 0 && *suffix != '\0') || n < 0 || n >= CONFIG_ZQ3_WIFI_NETS) {
+		LOG_ERR("bad keepalive key '%s'", key);
+		return -EINVAL;
+	}
+	const char *ssid = strchr(value, ' ');
+	int secs = atoi(value);
+	if (!ssid || secs < CONFIG_ZQ3_KEEPALIVE_MIN_S ||
+		secs > CONFIG_ZQ3_KEEPALIVE_MAX_S ||
+		strlen(ssid + 1) >= sizeof(ka->saved[n].ssid))
+	{
+		// Stale (Kconfig limits changed) or damaged: learn it again
+		LOG_WRN("ignoring '%s' = '%s'", key, value);
+		return 0;
+	}
+	ka->saved[n].secs = secs;
+	strcpy(ka->saved[n].ssid, ssid + 1);
+	return 0;
+}
+
+// Remember the interval for this network (once it's learned or changed)
+static void save(zq3_keepalive_context *ka) {
+	zq3_keepalive_saved *s = &ka->saved[ka->net];
+	if (s->secs == ka->interval && strcmp(s->ssid, ka->ssid) == 0) {
+		return;
+	}
+	s->secs = ka->interval;
+	strcpy(s->ssid, ka->ssid);
+	char key[12];
+	char value[8 + sizeof(s->ssid)];
+	if (ka->net == 0) {
+		strcpy(key, "zq3/ka");
+	} else {
+		snprintk(key, sizeof(key), "zq3/ka%d", ka->net);
+	}
+	int len = snprintk(value, sizeof(value), "%u %s", s->secs, s->ssid);
+	int err = settings_save_one(key, value, len + 1);
+	if (err) {
+		LOG_ERR("keepalive save: %d", err);
+	}
+}
+
+static void settle(zq3_keepalive_context *ka) {
+	ka->settled = true;
+	ka->confirms = 0;
+	LOG_INF("%u s for '%s'", ka->interval, ka->ssid);
+	save(ka);
+}
+
+// A probe got its PINGRESP: after enough of them, try a longer interval
+static void probe_ok(zq3_keepalive_context *ka) {
+	ka->fails = 0;
+	if (ka->settled) {
+		// Now and then, see if a longer interval works after all
+		if (CONFIG_ZQ3_KEEPALIVE_REPROBE == 0 ||
+			++ka->confirms < CONFIG_ZQ3_KEEPALIVE_REPROBE ||
+			ka->interval >= CONFIG_ZQ3_KEEPALIVE_MAX_S)
+		{
+			return;
+		}
+		ka->settled = false;
+		ka->fail = 0;
+	} else if (++ka->confirms < CONFIG_ZQ3_KEEPALIVE_CONFIRMS) {
+		return;
+	}
+	ka->confirms = 0;
+	ka->safe = ka->interval;
+	int next = MIN(ka->interval + CONFIG_ZQ3_KEEPALIVE_STEP_S,
+		CONFIG_ZQ3_KEEPALIVE_MAX_S);
+	if (next == ka->interval || (ka->fail && next >= ka->fail)) {
+		settle(ka);
+		return;
+	}
+	LOG_INF("%u s works, trying %d s", ka->interval, next);
+	ka->interval = next;
+}
+
+// Probes didn't get their PINGRESP: go back to the longest interval that
+// worked (or one step shorter if that was this one). One miss could be a
+// blip, so the connection gets a few more tries at this interval first.
+static void probe_failed(zq3_keepalive_context *ka) {
+	ka->confirms = 0;
+	if (++ka->fails < CONFIG_ZQ3_KEEPALIVE_MISSES) {
+		LOG_WRN("%u s probe missed (%d of %d)", ka->interval, ka->fails,
+			CONFIG_ZQ3_KEEPALIVE_MISSES);
+		return;
+	}
+	ka->fails = 0;
+	ka->fail = ka->interval;
+	if (ka->safe >= ka->interval) {
+		ka->safe = 0;
+	}
+	ka->interval = ka->safe ? ka->safe :
+		MAX(ka->interval - CONFIG_ZQ3_KEEPALIVE_STEP_S,
+			CONFIG_ZQ3_KEEPALIVE_MIN_S);
+	settle(ka);
+}
+
+// Call at CONNACK. Probing picks up where it left off if it's the same
+// network as before, or starts from the learned value for this network.
+void zq3_keepalive_start(zq3_keepalive_context *ka, int net,
+	const char *ssid)
+{
+	ka->last_rx = k_uptime_get();
+	ka->ping_at = 0;
+	if (net < 0 || net >= CONFIG_ZQ3_WIFI_NETS ||
+		(net == ka->net && strcmp(ssid, ka->ssid) == 0))
+	{
+		return;
+	}
+	zq3_keepalive_saved *s = &ka->saved[net];
+	ka->net = net;
+	strncpy(ka->ssid, ssid, sizeof(ka->ssid) - 1);
+	ka->ssid[sizeof(ka->ssid) - 1] = '\0';
+	ka->fail = 0;
+	ka->fails = 0;
+	ka->confirms = 0;
+	if (s->secs && strcmp(s->ssid, ssid) == 0) {
+		ka->interval = s->secs;
+		ka->safe = s->secs;
+		ka->settled = true;
+	} else {
+		ka->interval = CONFIG_ZQ3_KEEPALIVE_MIN_S;
+		ka->safe = 0;
+		ka->settled = false;
+	}
+}
+
+// Call for each MQTT event from the broker (any packet resets idle time)
+void zq3_keepalive_rx(zq3_keepalive_context *ka, bool pingresp) {
+	int64_t now = k_uptime_get();
+	ka->last_rx = now;
+	if (pingresp && ka->ping_at) {
+		ka->rtt_ms = now - ka->ping_at;
+		ka->ping_at = 0;
+		if (ka->probe) {
+			probe_ok(ka);
+		}
+	}
+}
+
+// Send pings when they're due. Returns -ETIMEDOUT if the PINGRESP deadline
+// passed (the connection is dead), or an error from sending the ping.
+int zq3_keepalive_poll(zq3_keepalive_context *ka, zq3_mqtt_context *mctx) {
+	int64_t now = k_uptime_get();
+	if (ka->ping_at) {
+		if (now - ka->ping_at < CONFIG_ZQ3_KEEPALIVE_DEADLINE_MS) {
+			return 0;
+		}
+		LOG_ERR("no PINGRESP after %u s idle", ka->interval);
+		ka->misses++;
+		ka->ping_at = 0;
+		if (ka->probe) {
+			probe_failed(ka);
+		}
+		return -ETIMEDOUT;
+	}
+	uint32_t tx_idle = zq3_mqtt_tx_idle_ms(mctx);
+	int64_t idle = MIN((int64_t)tx_idle, now - ka->last_rx);
+	bool probe = idle >= ka->interval * 1000;
+	bool due = tx_idle + CONFIG_ZQ3_KEEPALIVE_DEADLINE_MS >=
+		mctx->client.keepalive * 1000;
+	if (!probe && !due) {
+		return 0;
+	}
+	int err = zq3_mqtt_ping(mctx);
+	if (err) {
+		return err;
+	}
+	ka->ping_at = now;
+	ka->probe = probe;
+	ka->pings++;
+	return 0;
+}
+
+void zq3_keepalive_print(zq3_keepalive_context *ka) {
+	printk("Ping after %u s idle (%s), longest that worked: %u s",
+		ka->interval, ka->settled ? "learned" : "probing", ka->safe);
+	if (ka->fail) {
+		printk(", failed: %u s", ka->fail);
+	}
+	printk("\nPings: %u, misses: %u, last round trip: %u ms\n",
+		ka->pings, ka->misses, ka->rtt_ms);
+	for (int i = 0; i < CONFIG_ZQ3_WIFI_NETS; i++) {
+		if (ka->saved[i].secs) {
+			printk("%c %d: %u s '%s'\n", (i == ka->net) ? '*' : ' ', i,
+				ka->saved[i].secs, ka->saved[i].ssid);
+		}
+	}
+}
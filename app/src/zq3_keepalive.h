@@ -0,0 +1,54 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_KEEPALIVE_H
+#define ZQ3_KEEPALIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/net/wifi.h>
+#include "zq3_mqtt.h"
+
+
+// Learned ping interval for one wifi network (zq3/ka, zq3/ka1, ... go with
+// zq3/ssid, zq3/ssid1, ...)
+typedef struct {
+	uint16_t secs;                       // 0 = not learned yet
+	char ssid[WIFI_SSID_MAX_LEN + 1];    // network it was learned on
+} zq3_keepalive_saved;
+
+typedef struct {
+	zq3_keepalive_saved saved[CONFIG_ZQ3_WIFI_NETS];
+	int net;                // index into saved[] (-1 = none yet)
+	char ssid[WIFI_SSID_MAX_LEN + 1];
+	uint16_t interval;      // ping after this much idle time (s)
+	uint16_t safe;          // longest interval that got PINGRESPs (s)
+	uint16_t fail;          // shortest interval that didn't (s, 0 = none)
+	uint8_t confirms;       // PINGRESPs in a row at this interval
+	uint8_t fails;          // probes in a row without a PINGRESP
+	bool settled;           // done probing on this network
+	bool probe;             // the outstanding ping tests the interval
+	int64_t last_rx;        // uptime of the latest packet from the broker
+	int64_t ping_at;        // uptime of the outstanding PINGREQ (0 = none)
+	uint32_t pings;
+	uint32_t misses;        // pings without a PINGRESP before the deadline
+	uint32_t rtt_ms;        // round trip of the latest ping
+} zq3_keepalive_context;
+
+void zq3_keepalive_init(zq3_keepalive_context *ka);
+
+int zq3_keepalive_set(zq3_keepalive_context *ka, const char *key,
+	const char *value, int len);
+
+void zq3_keepalive_start(zq3_keepalive_context *ka, int net,
+	const char *ssid);
+
+void zq3_keepalive_rx(zq3_keepalive_context *ka, bool pingresp);
+
+int zq3_keepalive_poll(zq3_keepalive_context *ka, zq3_mqtt_context *mctx);
+
+void zq3_keepalive_print(zq3_keepalive_context *ka);
+
+
+#endif /* ZQ3_KEEPALIVE_H */
@@ -0,0 +1,274 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Local LAN control over UDP (read or set the toggle without the broker)
+ *
+ * When the zq3/lantok setting holds a shared secret, the app listens on UDP
+ * port CONFIG_ZQ3_LAN_PORT for small fixed size packets (see zq3_lan.h for
+ * the layout). Every request and response carries a truncated HMAC-SHA256
+ * made with the shared secret. To stop replays, each request also carries
+ * the device's boot nonce and a sequence number that has to be bigger than
+ * the last accepted one. Clients get the nonce and current sequence number
+ * with a hello request (see tools/lan_ctl.py).
+ *
+ * Toggle changes from the LAN take effect right away, then the main loop
+ * mirrors them to MQTT with the usual publish_pending flag (which waits for
+ * the broker connection if it's down).
+ *
+ * Docs & Refs:
+ * https://docs.zephyrproject.org/apidoc/latest/group__bsd__sockets.html
+ * https://www.rfc-editor.org/rfc/rfc2104 (HMAC)
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/random/random.h>     // sys_rand32_get()
+#include <zephyr/sys/byteorder.h>     // sys_put_be32(), sys_get_be32()
+#include <mbedtls/sha256.h>
+#include "zq3.h"
+#include "zq3_lan.h"
+
+LOG_MODULE_REGISTER(zq3_lan, CONFIG_ZQ3_LAN_LOG_LEVEL);
+
+
+// Max packets to handle per pass through the main loop
+#define MAX_PACKETS (4)
+
+
+void zq3_lan_init(zq3_lan_context *lan) {
+	memset(lan->token, 0, sizeof(lan->token));
+	lan->sock = -1;
+	lan->fds[0].fd = -1;
+	lan->fds[0].events = ZSOCK_POLLIN;
+	for (int i = 1; i < ARRAY_SIZE(lan->fds); i++) {
+		lan->fds[i].fd = -1;
+		lan->fds[i].events = ZSOCK_POLLIN;
+	}
+	lan->nonce = sys_rand32_get();
+	lan->last_seq = 0;
+	lan->requests = 0;
+	lan->rejects = 0;
+}
+
+// Set the shared secret (empty string disables LAN control)
+int zq3_lan_set_token(zq3_lan_context *lan, const char *token, int len) {
+	if (len >= sizeof(lan->token)) {
+		return -EOVERFLOW;
+	}
+	if (len > 0 && len < 16) {
+		LOG_WRN("zq3/lantok should be at least 16 characters");
+	}
+	memset(lan->token, 0, sizeof(lan->token));
+	memcpy(lan->token, token, len);
+	return 0;
+}
+
+// Open the UDP socket if there's a shared secret, or close it if the secret
+// went away (`aio reload` after deleting zq3/lantok). The socket binds to any
+// address, so this works before wifi connects.
+int zq3_lan_open(zq3_lan_context *lan) {
+	if (!IS_ENABLED(CONFIG_ZQ3_LAN)) {
+		return -ENOTSUP;
+	}
+	if (strlen(lan->token) == 0) {
+		if (lan->sock >= 0) {
+			lan->fds[0].fd = -1;
+			close(lan->sock);
+			lan->sock = -1;
+			LOG_INF("LAN control off");
+		}
+		return -ENOENT;
+	}
+	if (lan->sock >= 0) {
+		return 0;
+	}
+	int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (sock < 0) {
+		LOG_ERR("LAN socket: %d", -errno);
+		return -errno;
+	}
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(CONFIG_ZQ3_LAN_PORT),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		int err = -errno;
+		LOG_ERR("LAN bind: %d", err);
+		close(sock);
+		return err;
+	}
+	lan->sock = sock;
+	lan->fds[0].fd = sock;
+	LOG_INF("LAN control on UDP port %d", CONFIG_ZQ3_LAN_PORT);
+	return 0;
+}
+
+// Also wake up zq3_lan_wait() when fd becomes readable (the main loop uses
+// this for the input event fd, see zq3_input.c, and the connect worker's
+// event fd, see zq3_conn.c)
+int zq3_lan_add_wake_fd(zq3_lan_context *lan, int fd) {
+	if (fd < 0) {
+		return -EINVAL;
+	}
+	for (int i = 1; i < ARRAY_SIZE(lan->fds); i++) {
+		if (lan->fds[i].fd < 0) {
+			lan->fds[i].fd = fd;
+			return 0;
+		}
+	}
+	return -ENOMEM;
+}
+
+// Sleep for up to timeout_ms, but wake up early if a LAN packet arrives (or
+// a wake fd becomes readable). Poll ignores fds that are -1.
+void zq3_lan_wait(zq3_lan_context *lan, uint32_t timeout_ms) {
+	if (lan->sock < 0 && lan->fds[1].fd < 0) {
+		k_msleep(timeout_ms);
+		return;
+	}
+	poll(lan->fds, ARRAY_SIZE(lan->fds), (int)timeout_ms);
+}
+
+// HMAC-SHA256 (RFC 2104) using the mbedTLS SHA-256 functions. The key is
+// always shorter than the 64 byte block size, so it doesn't need hashing.
+static void
+hmac_sha256(const char *key, const uint8_t *msg, size_t len, uint8_t out[32])
+{
+	mbedtls_sha256_context sha;
+	uint8_t pad[64] = {0};
+	uint8_t inner[32];
+	memcpy(pad, key, strlen(key));
+	for (int i = 0; i < sizeof(pad); i++) {
+		pad[i] ^= 0x36;
+	}
+	mbedtls_sha256_init(&sha);
+	mbedtls_sha256_starts(&sha, 0);
+	mbedtls_sha256_update(&sha, pad, sizeof(pad));
+	mbedtls_sha256_update(&sha, msg, len);
+	mbedtls_sha256_finish(&sha, inner);
+	for (int i = 0; i < sizeof(pad); i++) {
+		pad[i] ^= 0x36 ^ 0x5c;
+	}
+	mbedtls_sha256_starts(&sha, 0);
+	mbedtls_sha256_update(&sha, pad, sizeof(pad));
+	mbedtls_sha256_update(&sha, inner, sizeof(inner));
+	mbedtls_sha256_finish(&sha, out);
+	mbedtls_sha256_free(&sha);
+}
+
+// Check a packet's MAC (constant time, so timing doesn't leak the MAC)
+static bool mac_ok(zq3_lan_context *lan, const uint8_t *pkt) {
+	uint8_t mac[32];
+	uint8_t diff = 0;
+	hmac_sha256(lan->token, pkt, ZQ3_LAN_HDR_LEN, mac);
+	for (int i = 0; i < ZQ3_LAN_MAC_LEN; i++) {
+		diff |= mac[i] ^ pkt[ZQ3_LAN_HDR_LEN + i];
+	}
+	return diff == 0;
+}
+
+// Fill in a response packet and its MAC
+static void make_response(zq3_lan_context *lan, uint8_t *pkt, char cmd,
+	zq3_toggle toggle, uint32_t seq)
+{
+	uint8_t mac[32];
+	pkt[0] = ZQ3_LAN_VERSION;
+	pkt[1] = cmd;
+	pkt[2] = (toggle == ON) ? '1' : (toggle == OFF) ? '0' : '?';
+	pkt[3] = 0;
+	sys_put_be32(lan->nonce, &pkt[4]);
+	sys_put_be32(seq, &pkt[8]);
+	hmac_sha256(lan->token, pkt, ZQ3_LAN_HDR_LEN, mac);
+	memcpy(&pkt[ZQ3_LAN_HDR_LEN], mac, ZQ3_LAN_MAC_LEN);
+}
+
+// Handle one request. Returns true if pkt now holds a response to send.
+static bool handle(zq3_lan_context *lan, zq3_context *zctx, uint8_t *pkt) {
+	// Packets that fail authentication get no answer, so the port can't be
+	// used to probe the device or bounce traffic at somebody else. With no
+	// shared secret, anybody could make a valid MAC, so reject everything.
+	if (strlen(lan->token) == 0 || pkt[0] != ZQ3_LAN_VERSION ||
+		!mac_ok(lan, pkt))
+	{
+		lan->rejects++;
+		return false;
+	}
+	char cmd = pkt[1];
+	char value = pkt[2];
+	uint32_t nonce = sys_get_be32(&pkt[4]);
+	uint32_t seq = sys_get_be32(&pkt[8]);
+	if (cmd == 'h') {
+		// Tell the client our nonce and the sequence number to beat
+		make_response(lan, pkt, 'H', UNKNOWN, lan->last_seq);
+		return true;
+	}
+	if (nonce != lan->nonce || seq <= lan->last_seq) {
+		// Replay, or the device rebooted since the client's hello
+		lan->rejects++;
+		make_response(lan, pkt, 'E', UNKNOWN, lan->last_seq);
+		return true;
+	}
+	lan->last_seq = seq;
+	switch (cmd) {
+	case 'g':
+		make_response(lan, pkt, 'G', zctx->toggle, seq);
+		break;
+	case 's':
+		if (value != '0' && value != '1') {
+			make_response(lan, pkt, 'E', zctx->toggle, seq);
+			break;
+		}
+		zq3_toggle toggle = (value == '1') ? ON : OFF;
+		if (zctx->toggle != toggle) {
+			zctx->toggle = toggle;
+			zctx->publish_pending = true;   // mirror to MQTT
+		}
+		make_response(lan, pkt, 'S', zctx->toggle, seq);
+		break;
+	default:
+		make_response(lan, pkt, 'E', zctx->toggle, seq);
+	}
+	lan->requests++;
+	return true;
+}
+
+// Handle pending LAN requests (non-blocking). Returns the number handled.
+int zq3_lan_poll(zq3_lan_context *lan, zq3_context *zctx) {
+	if (lan->sock < 0) {
+		return 0;
+	}
+	int count = 0;
+	for (int i = 0; i < MAX_PACKETS; i++) {
+		uint8_t pkt[ZQ3_LAN_PKT_LEN + 1];
+		struct sockaddr_storage src;
+		socklen_t src_len = sizeof(src);
+		ssize_t len = recvfrom(lan->sock, pkt, sizeof(pkt), MSG_DONTWAIT,
+			(struct sockaddr *)&src, &src_len);
+		if (len < 0) {
+			break;  // EAGAIN: nothing more to read
+		}
+		if (len != ZQ3_LAN_PKT_LEN) {
+			lan->rejects++;
+			continue;
+		}
+		if (handle(lan, zctx, pkt)) {
+			sendto(lan->sock, pkt, ZQ3_LAN_PKT_LEN, 0,
+				(struct sockaddr *)&src, src_len);
+			count++;
+		}
+	}
+	return count;
+}
+
+// Print LAN control status
+void zq3_lan_print(zq3_lan_context *lan) {
+	if (lan->sock < 0) {
+		printk("LAN control: off (set zq3/lantok to enable)\n");
+		return;
+	}
+	printk("LAN control: UDP port %d, %d requests, %d rejected\n",
+		CONFIG_ZQ3_LAN_PORT, lan->requests, lan->rejects);
+}
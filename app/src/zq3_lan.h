@@ -0,0 +1,51 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_LAN_H
+#define ZQ3_LAN_H
+
+#include <zephyr/net/socket.h>
+#include "zq3.h"
+
+
+// LAN control packet layout (requests and responses are both 28 bytes):
+//   [0]      version (ZQ3_LAN_VERSION)
+//   [1]      command: 'h' hello, 'g' get, 's' set (responses use uppercase,
+//            or 'E' for an error)
+//   [2]      toggle value: '0', '1', or '?' (unknown)
+//   [3]      reserved (0)
+//   [4..7]   boot nonce (big-endian, from the device's hello response)
+//   [8..11]  sequence number (big-endian, must increase for each request)
+//   [12..27] HMAC-SHA256(token, bytes 0..11), truncated to 16 bytes
+#define ZQ3_LAN_VERSION   (1)
+#define ZQ3_LAN_HDR_LEN   (12)
+#define ZQ3_LAN_MAC_LEN   (16)
+#define ZQ3_LAN_PKT_LEN   (ZQ3_LAN_HDR_LEN + ZQ3_LAN_MAC_LEN)
+
+typedef struct {
+	char token[64];        // shared secret from the zq3/lantok setting
+	int sock;              // UDP socket (-1 when closed)
+	struct pollfd fds[3];  // for waiting on the socket (and wake fds)
+	uint32_t nonce;        // random number picked at boot
+	uint32_t last_seq;     // highest accepted sequence number
+	uint32_t requests;     // count of accepted requests
+	uint32_t rejects;      // count of rejected requests
+} zq3_lan_context;
+
+void zq3_lan_init(zq3_lan_context *lan);
+
+int zq3_lan_set_token(zq3_lan_context *lan, const char *token, int len);
+
+int zq3_lan_open(zq3_lan_context *lan);
+
+int zq3_lan_add_wake_fd(zq3_lan_context *lan, int fd);
+
+void zq3_lan_wait(zq3_lan_context *lan, uint32_t timeout_ms);
+
+int zq3_lan_poll(zq3_lan_context *lan, zq3_context *zctx);
+
+void zq3_lan_print(zq3_lan_context *lan);
+
+
+#endif /* ZQ3_LAN_H */
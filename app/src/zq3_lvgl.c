@@ -10,13 +10,24 @@
  * https://docs.lvgl.io/9.2/widgets/switch.html (toggle switch widget)
  * https://docs.lvgl.io/9.2/overview/display.html  (change bg color)
  * https://docs.lvgl.io/9.2/overview/color.html  (color constants)
+ * https://docs.lvgl.io/9.2/layouts/flex.html  (panel for layout widgets)
+ * https://docs.lvgl.io/9.2/widgets/image.html  (wifi icon)
+ * https://docs.lvgl.io/9.2/widgets/spinner.html  (connect progress)
+ * https://docs.lvgl.io/9.2/overview/font.html  (subset fonts)
  */
 
 #include <zephyr/kernel.h>           // k_uptime_get_32()
 #include <zephyr/drivers/display.h>  // display_blanking_off()
+#include <zephyr/sys/atomic.h>
 #include <lvgl.h>
 #include <lvgl_input_device.h>
+#include "zq3_assets.h"        // generated by app/scripts/gen_assets.py
 #include "zq3_lvgl.h"
+#include "zq3_ui_text.h"
+
+
+// `aio fonts` asked for the font benchmark
+static atomic_t font_bench_req = ATOMIC_INIT(0);
 
 
 // Hide a widget
@@ -34,9 +45,8 @@ static void show(lv_obj_t *obj) {
 // Initialize the GUI:
 // - context struct (ctx) gets initialized with objects and values that need
 //   to stay available for future reference while the GUI is in use
-// - callback function pointer gets registered for keypad pressed events
 //
-void zq3_lvgl_init(zq3_lvgl_context *ctx, lv_event_cb_t keypad_callback) {
+void zq3_lvgl_init(zq3_lvgl_context *ctx) {
 	const struct device *display = DEVICE_DT_GET(DT_CHOSEN(zephyr_display));
 	const struct device *keypad =
 		DEVICE_DT_GET(DT_COMPAT_GET_ANY_STATUS_OKAY(zephyr_lvgl_keypad_input));
@@ -52,21 +62,40 @@ void zq3_lvgl_init(zq3_lvgl_context *ctx, lv_event_cb_t keypad_callback) {
 	// Change background color (see also lv_palette_main())
 	lv_obj_t *scr = lv_screen_active();
 	lv_obj_set_style_bg_color(scr, ctx->gray_dark, 0);
+#if defined(CONFIG_ZQ3_FONT_SUBSET)
+	// Fonts from the build-time asset pipeline (app/assets/assets.txt)
+	lv_obj_set_style_text_font(scr, &zq3_font_18, 0);
+#endif
 
-	// Make wifi icon label
-	ctx->wifi = lv_label_create(lv_screen_active());
-	lv_label_set_text(ctx->wifi, LV_SYMBOL_WIFI);
+	// Make wifi icon. The icon images are prerendered RGB565 on the screen
+	// background color, so drawing them is a plain copy.
+	ctx->wifi = lv_image_create(lv_screen_active());
+	lv_image_set_src(ctx->wifi, &zq3_img_wifi_off);
 	lv_obj_align(ctx->wifi, LV_ALIGN_TOP_RIGHT, -10, 5);
-	lv_obj_set_style_text_color(ctx->wifi, ctx->gray, 0);
 
 	// Make large text status label in center of screen
 	// This is initially visible
 	ctx->status = lv_label_create(lv_screen_active());
-	lv_label_set_text(ctx->status, "Loading...");
+#if defined(CONFIG_ZQ3_FONT_SUBSET)
+	lv_obj_set_style_text_font(ctx->status, &zq3_font_status, 0);
+#endif
+	lv_label_set_text(ctx->status, ZQ3_MSG_LOADING);
 	lv_obj_set_style_text_align(ctx->status, LV_TEXT_ALIGN_CENTER, 0);
 	lv_obj_set_style_text_color(ctx->status, ctx->green, 0);
 	lv_obj_center(ctx->status);
 
+	// Make spinner to show below the status label while the broker
+	// connection comes up. This is initially hidden
+	ctx->spinner = lv_spinner_create(lv_screen_active());
+	lv_spinner_set_anim_params(ctx->spinner, 1000, 200);
+	lv_obj_set_size(ctx->spinner, 24, 24);
+	lv_obj_set_style_arc_width(ctx->spinner, 4, LV_PART_MAIN);
+	lv_obj_set_style_arc_width(ctx->spinner, 4, LV_PART_INDICATOR);
+	lv_obj_set_style_arc_color(ctx->spinner, ctx->gray, LV_PART_MAIN);
+	lv_obj_set_style_arc_color(ctx->spinner, ctx->green, LV_PART_INDICATOR);
+	lv_obj_align(ctx->spinner, LV_ALIGN_BOTTOM_MID, 0, -6);
+	hide(ctx->spinner);
+
 	// Make toggle switch widget (gets added to keypad group later)
 	// This is initially hidden
 	ctx->toggle = lv_switch_create(lv_screen_active());
@@ -74,18 +103,19 @@ void zq3_lvgl_init(zq3_lvgl_context *ctx, lv_event_cb_t keypad_callback) {
 	lv_obj_center(ctx->toggle);
 	hide(ctx->toggle);
 
-	// Set up input group so keypad press events go to the active screen. This
-	// arrangement (vs. putting pressed event on the switch) lets the main
-	// event loop consider both keypad presses and received MQTT messages to
-	// decide what the toggle switch's CHECKED state should be. For this to
-	// work, the devicetree config must provide a keypad with physical buttons
-	// mapped to navigation keys such as LV_KEY_LEFT, LV_KEY_RIGHT, and
-	// LV_KEY_ENTER. Minimum is LV_KEY_ENTER.
+	// Panel for layout widgets gets made later (only if there's a layout)
+	ctx->panel = NULL;
+
+	// Set up input group so keypad events go to the active screen rather
+	// than the switch. Button presses that do things (toggle, connect, etc)
+	// don't come from LVGL. They go from the input subsystem straight to the
+	// handlers in main.c (see zq3_input.c), so the main event loop can
+	// consider both button presses and received MQTT messages to decide what
+	// the toggle switch's CHECKED state should be.
 	lv_obj_t *screen = lv_screen_active();
 	ctx->grp = lv_group_create();
 	lv_group_add_obj(ctx->grp, screen);
 	lv_indev_set_group(lvgl_input_get_indev(keypad), ctx->grp);
-	lv_obj_add_event_cb(screen, keypad_callback, LV_EVENT_PRESSED, NULL);
 
 	display_blanking_off(display);
 }
@@ -95,15 +125,55 @@ void zq3_lvgl_init(zq3_lvgl_context *ctx, lv_event_cb_t keypad_callback) {
 // the big toggle switch.
 void zq3_lvgl_show_message(zq3_lvgl_context *ctx, const char *msg) {
 	hide(ctx->toggle);
+	hide(ctx->spinner);
+	if (ctx->panel) {
+		hide(ctx->panel);
+	}
 	show(ctx->status);
 	lv_label_set_text(ctx->status, msg);
 	lv_obj_set_style_text_align(ctx->status, LV_TEXT_ALIGN_CENTER, 0);
 }
 
+// Show a status message with a spinner below it, for things that take a
+// while (like the broker connection stages)
+void zq3_lvgl_show_progress(zq3_lvgl_context *ctx, const char *msg) {
+	zq3_lvgl_show_message(ctx, msg);
+	show(ctx->spinner);
+}
+
 // Show the big toggle switch. This means MQTT is connected and subscribed
 void zq3_lvgl_show_toggle(zq3_lvgl_context *ctx) {
 	hide(ctx->status);
+	hide(ctx->spinner);
 	show(ctx->toggle);
+	if (ctx->panel) {
+		show(ctx->panel);
+	}
+}
+
+// Get the flex container for layout widgets (see zq3_bind.c). The first call
+// makes the panel below the statusbar and moves the toggle switch into it at
+// a smaller size, so the toggle and the layout widgets share the screen.
+lv_obj_t *zq3_lvgl_panel(zq3_lvgl_context *ctx) {
+	if (ctx->panel) {
+		return ctx->panel;
+	}
+	lv_obj_t *panel = lv_obj_create(lv_screen_active());
+	lv_obj_remove_style_all(panel);
+	lv_obj_set_size(panel, lv_pct(100), 108);
+	lv_obj_align(panel, LV_ALIGN_BOTTOM_MID, 0, 0);
+	lv_obj_remove_flag(panel, LV_OBJ_FLAG_SCROLLABLE);
+	lv_obj_set_flex_flow(panel, LV_FLEX_FLOW_ROW_WRAP);
+	lv_obj_set_flex_align(panel, LV_FLEX_ALIGN_SPACE_EVENLY,
+		LV_FLEX_ALIGN_CENTER, LV_FLEX_ALIGN_CENTER);
+	lv_obj_set_style_pad_all(panel, 4, 0);
+	lv_obj_set_style_pad_row(panel, 4, 0);
+	lv_obj_set_style_pad_column(panel, 4, 0);
+	lv_obj_set_parent(ctx->toggle, panel);
+	lv_obj_set_size(ctx->toggle, 70, 35);
+	hide(panel);
+	ctx->panel = panel;
+	return panel;
 }
 
 // Change the toggle switch state: checked==true means on, false means off
@@ -117,8 +187,67 @@ void zq3_lvgl_set_toggle(zq3_lvgl_context *ctx, bool checked) {
 
 // Update wifi statusbar icon color: up==true means green, false means gray
 void zq3_lvgl_wifi_status(zq3_lvgl_context *ctx, bool up) {
-	lv_color_t color = up ? ctx->green : ctx->gray;
-	lv_obj_set_style_text_color(ctx->wifi, color, 0);
+	lv_image_set_src(ctx->wifi, up ? &zq3_img_wifi_on : &zq3_img_wifi_off);
+}
+
+// Measure how long it takes to draw a status message with each font
+static void font_bench(zq3_lvgl_context *ctx) {
+	const struct {
+		const char *name;
+		const lv_font_t *font;
+	} fonts[] = {
+		{"default", LV_FONT_DEFAULT},
+#if defined(CONFIG_ZQ3_FONT_SUBSET)
+		{"zq3_font_18", &zq3_font_18},
+		{"zq3_font_status", &zq3_font_status},
+#endif
+	};
+	const int rounds = 10;
+	const char *msg = ZQ3_MSG_CONNECTING;
+	const lv_font_t *old_font = lv_obj_get_style_text_font(ctx->status, 0);
+	char old_text[64];
+	strncpy(old_text, lv_label_get_text(ctx->status), sizeof(old_text) - 1);
+	old_text[sizeof(old_text) - 1] = '\0';
+	bool hidden = lv_obj_has_flag(ctx->status, LV_OBJ_FLAG_HIDDEN);
+
+	lv_obj_remove_flag(ctx->status, LV_OBJ_FLAG_HIDDEN);
+	lv_label_set_text(ctx->status, msg);
+	for (int i = 0; i < ARRAY_SIZE(fonts); i++) {
+		lv_obj_set_style_text_font(ctx->status, fonts[i].font, 0);
+		lv_refr_now(NULL);
+		uint32_t cycles = 0;
+		for (int j = 0; j < rounds; j++) {
+			lv_obj_invalidate(ctx->status);
+			uint32_t start = k_cycle_get_32();
+			lv_refr_now(NULL);
+			cycles += k_cycle_get_32() - start;
+		}
+		uint32_t us = k_cyc_to_us_floor32(cycles) / rounds;
+		printk("%-16s %5d us per redraw, %4d us per glyph\n",
+			fonts[i].name, us, us / strlen(msg));
+	}
+
+	// Put the status label back how it was
+	lv_obj_set_style_text_font(ctx->status, old_font, 0);
+	lv_label_set_text(ctx->status, old_text);
+	if (hidden) {
+		lv_obj_add_flag(ctx->status, LV_OBJ_FLAG_HIDDEN);
+	}
+	lv_obj_invalidate(lv_screen_active());
+}
+
+// Ask for the font benchmark. This is safe to call from the shell. The
+// benchmark runs in zq3_lvgl_apply().
+void zq3_lvgl_font_bench(zq3_lvgl_context *ctx) {
+	atomic_set(&font_bench_req, 1);
+}
+
+// Run a requested font benchmark. The main loop calls this, since it owns
+// LVGL.
+void zq3_lvgl_apply(zq3_lvgl_context *ctx) {
+	if (atomic_set(&font_bench_req, 0)) {
+		font_bench(ctx);
+	}
 }
 
 // The main event loop must call this frequently so LVGL can update the screen
@@ -12,22 +12,32 @@ typedef struct {
 	lv_color_t gray_dark;
 	lv_color_t gray;
 	lv_color_t green;
-	lv_obj_t *wifi;        // status bar wifi icon
+	lv_obj_t *wifi;        // status bar wifi icon (image)
 	lv_obj_t *status;      // large status label in center of screen
+	lv_obj_t *spinner;     // progress spinner below the status label
 	lv_obj_t *toggle;      // toggle switch widget
+	lv_obj_t *panel;       // flex container for toggle + layout widgets
 	lv_group_t *grp;       // keypad input group
 } zq3_lvgl_context;
 
-void zq3_lvgl_init(zq3_lvgl_context *ctx, lv_event_cb_t keypad_callback);
+void zq3_lvgl_init(zq3_lvgl_context *ctx);
 
 void zq3_lvgl_show_message(zq3_lvgl_context *ctx, const char *msg);
 
+void zq3_lvgl_show_progress(zq3_lvgl_context *ctx, const char *msg);
+
 void zq3_lvgl_show_toggle(zq3_lvgl_context *ctx);
 
 void zq3_lvgl_set_toggle(zq3_lvgl_context *ctx, bool checked);
 
+lv_obj_t *zq3_lvgl_panel(zq3_lvgl_context *ctx);
+
 void zq3_lvgl_wifi_status(zq3_lvgl_context *ctx, bool up);
 
+void zq3_lvgl_font_bench(zq3_lvgl_context *ctx);
+
+void zq3_lvgl_apply(zq3_lvgl_context *ctx);
+
 uint32_t zq3_lvgl_timer_handler();
 
 
@@ -0,0 +1,74 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Latest-value-wins mailbox (sequence lock, one writer and one reader)
+ *
+ * The writer bumps the sequence number before and after copying in a new
+ * value, so the number is odd while a write is in progress. The reader
+ * copies the value out between two reads of the sequence number, and keeps
+ * the copy only if the number was even and didn't change. Neither side ever
+ * waits for the other. If the reader loses the race a few times in a row,
+ * it gives up until the next frame.
+ *
+ * Because each value has a sequence number, the reader always ends up with
+ * the newest value, no matter how many got overwritten in between.
+ *
+ * Docs & Refs:
+ * https://docs.zephyrproject.org/latest/kernel/services/other/atomic.html
+ * https://docs.zephyrproject.org/latest/hardware/barriers/index.html
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/barrier.h>
+#include "zq3_mbox.h"
+
+
+// Read attempts per take before giving up until the next frame
+#define TAKE_TRIES (4)
+
+
+void zq3_mbox_init(zq3_mbox *mb) {
+	memset(mb, 0, sizeof(*mb));
+}
+
+// Write a new value (overwrites a value that hasn't been taken yet). Empty
+// values get ignored. Returns -EMSGSIZE for a value that doesn't fit.
+int zq3_mbox_put(zq3_mbox *mb, const uint8_t *buf, size_t len) {
+	if (len == 0) {
+		return 0;
+	}
+	if (len > sizeof(mb->data)) {
+		return -EMSGSIZE;
+	}
+	atomic_inc(&mb->seq);
+	memcpy(mb->data, buf, len);
+	mb->len = len;
+	atomic_inc(&mb->seq);
+	mb->puts++;
+	return 0;
+}
+
+// Copy out the newest value if it wasn't taken yet. Returns the value's
+// length, 0 if there's nothing new, or -EAGAIN if a write kept getting in
+// the way.
+int zq3_mbox_take(zq3_mbox *mb, uint8_t *buf, size_t size) {
+	for (int i = 0; i < TAKE_TRIES; i++) {
+		uint32_t seq = atomic_get(&mb->seq);
+		if (seq & 1) {
+			continue;
+		}
+		if (seq == mb->taken) {
+			return 0;
+		}
+		size_t len = MIN(mb->len, size);
+		memcpy(buf, mb->data, len);
+		barrier_dmem_fence_full();
+		if (atomic_get(&mb->seq) == seq) {
+			mb->taken = seq;
+			mb->takes++;
+			return len;
+		}
+	}
+	return -EAGAIN;
+}
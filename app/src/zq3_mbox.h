@@ -0,0 +1,36 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_MBOX_H
+#define ZQ3_MBOX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/sys/atomic.h>
+
+
+// Biggest payload a mailbox holds. This matches ZQ3_BIND_PAYLOAD_MAX, so
+// any payload the app reads for a widget fits.
+#define ZQ3_MBOX_MAX (128)
+
+// Latest-value-wins mailbox for one feed. The MQTT receive path writes it
+// and the UI reads it once per frame. A new value overwrites one that hasn't
+// been read yet, so a burst of messages costs one redraw.
+typedef struct {
+	atomic_t seq;               // odd while a write is in progress
+	uint32_t taken;             // seq of the last value the reader took
+	uint32_t puts;              // values written
+	uint32_t takes;             // values read (one per redraw)
+	uint8_t len;
+	uint8_t data[ZQ3_MBOX_MAX];
+} zq3_mbox;
+
+void zq3_mbox_init(zq3_mbox *mb);
+
+int zq3_mbox_put(zq3_mbox *mb, const uint8_t *buf, size_t len);
+
+int zq3_mbox_take(zq3_mbox *mb, uint8_t *buf, size_t size);
+
+
+#endif /* ZQ3_MBOX_H */
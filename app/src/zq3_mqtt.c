@@ -25,12 +25,25 @@
  */
 
 #include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/drivers/hwinfo.h>
 #include <zephyr/net/mqtt.h>
 #include <zephyr/net/tls_credentials.h>
+#include <zephyr/random/random.h>
 #include "zq3.h"
 #include "zq3_dns.h"
 #include "zq3_mqtt.h"
 #include "zq3_cert.h"
+#include "zq3_cred.h"
+#include "zq3_ota.h"
+#include "zq3_tls.h"
+#include "zq3_url.h"
+
+LOG_MODULE_REGISTER(zq3_mqtt, CONFIG_ZQ3_MQTT_LOG_LEVEL);
+
+
+// Max packets to handle per call to zq3_mqtt_poll()
+#define MAX_PACKETS (8)
 
 
 // Initialize MQTT
@@ -43,6 +56,7 @@ int zq3_mqtt_init(
 	memset(mctx->pass_buf, 0, sizeof(mctx->pass_buf));
 	memset(mctx->hostname, 0, sizeof(mctx->hostname));
 	memset(mctx->topic, 0, sizeof(mctx->topic));
+	memset(mctx->client_id_buf, 0, sizeof(mctx->client_id_buf));
 	// Initialize the MQTT API's client struct
 	struct mqtt_client *c = &mctx->client;
 	mqtt_client_init(c);
@@ -54,11 +68,42 @@ int zq3_mqtt_init(
 	c->user_name = &mctx->user;
 	c->broker = &mctx->broker;
 	c->evt_cb = callback;
-	c->client_id.utf8 = (uint8_t *)"i";  // protocol requires non-empty id
-	c->client_id.size = strlen("i");
+	// Client id gets set from the zq3/cid setting or from the device id by
+	// zq3_mqtt_default_client_id(). Protocol requires a non-empty id.
+	c->client_id.utf8 = mctx->client_id_buf;
+	c->client_id.size = 0;
+	// With a persistent session, the broker remembers our subscription and
+	// queues QoS 1 messages for us while we're disconnected
+	c->clean_session = IS_ENABLED(CONFIG_ZQ3_MQTT_PERSISTENT_SESSION) ? 0 : 1;
 	c->password = &mctx->pass;
 	c->user_name = &mctx->user;
 	c->protocol_version = MQTT_VERSION_3_1_1;
+	// The adaptive keepalive pings more often than this (zq3_keepalive.c)
+	c->keepalive = CONFIG_ZQ3_KEEPALIVE_MAX_S;
+	mctx->mqtt5 = false;
+	mctx->next_msg_id = 2;
+	mctx->inflight = 0;
+	mctx->rx_max = UINT16_MAX;
+	mctx->alias_max = 0;
+	mctx->alias_set = false;
+#if defined(CONFIG_ZQ3_MQTT5)
+	// These only get sent if zq3/mqttv selects MQTT 5. Receive Maximum limits
+	// how many QoS 1 messages the broker sends before waiting for PUBACK, and
+	// Maximum Packet Size stops the broker from sending anything that won't
+	// fit in rx_buf. OTA chunks stream past rx_buf (mq_event() in main.c), so
+	// with OTA the limit is the biggest chunk message instead.
+	c->prop.receive_maximum = CONFIG_ZQ3_MQTT5_RECEIVE_MAX;
+#if defined(CONFIG_ZQ3_OTA)
+	c->prop.maximum_packet_size = ZQ3_OTA_PACKET_MAX;
+#else
+	c->prop.maximum_packet_size = sizeof(mctx->rx_buf);
+#endif
+#if defined(CONFIG_ZQ3_MQTT_PERSISTENT_SESSION)
+	// MQTT 5 ends the session at disconnect unless we ask the broker to
+	// keep it
+	c->prop.session_expiry_interval = CONFIG_ZQ3_MQTT5_SESSION_EXPIRY_S;
+#endif
+#endif
 	c->rx_buf = mctx->rx_buf;
 	c->rx_buf_size = sizeof(mctx->rx_buf);
 	c->tx_buf = mctx->tx_buf;
@@ -66,38 +111,13 @@ int zq3_mqtt_init(
 	// Start by assuming TLS is turned on
 	c->transport.type = MQTT_TRANSPORT_SECURE;
 	mctx->tls = true;
-    // Register the TLS CA certificates from zq3_certs.h
-	int err;
-	const char fmt[] = "ERR: tls_credential_add(%d, ...) = %d\n";
-	// This one is for the broker on my private testbench LAN. You can omit
-	// it or replace it with your own self-signed testing cert in zq3_cert.h
-	err = tls_credential_add(zq3_cert_tags[0], TLS_CREDENTIAL_CA_CERTIFICATE,
-		zq3_cert_self_signed, sizeof(zq3_cert_self_signed));
-	if (err) {
-		printk(fmt, zq3_cert_tags[0], err);
-	}
-	// This is the root certificate used by the certificate chain for
-	// io.adafruit.com. You need this to talk to Adafruit IO.
-	err = tls_credential_add(zq3_cert_tags[1], TLS_CREDENTIAL_CA_CERTIFICATE,
-		zq3_cert_digicert_global_root_g2,
-		sizeof(zq3_cert_digicert_global_root_g2));
-	if (err) {
-		printk(fmt, zq3_cert_tags[1], err);
-	}
-
-	// This is the intermediate certificate for io.adafruit.com. You need this
-	// to talk to Adafruit IO
-	err = tls_credential_add(zq3_cert_tags[2], TLS_CREDENTIAL_CA_CERTIFICATE,
-		zq3_cert_geotrust_g1, sizeof(zq3_cert_geotrust_g1));
-	if (err) {
-		printk(fmt, zq3_cert_tags[2], err);
-	}
-	// Configure TLS stuff in the MQTT client struct
+	// Configure TLS stuff in the MQTT client struct. The CA certs don't get
+	// registered until zq3_mqtt_connect() knows which broker to talk to.
 	struct mqtt_sec_config *conf = &mctx->client.transport.tls.config;
 	conf->peer_verify = TLS_PEER_VERIFY_REQUIRED;
 	conf->cipher_list = NULL;
-	conf->sec_tag_list = zq3_cert_tags;
-	conf->sec_tag_count = sizeof(zq3_cert_tags)/sizeof(zq3_cert_tags[0]);
+	conf->sec_tag_list = mctx->sec_tags;
+	conf->sec_tag_count = 0;
 	conf->hostname = mctx->hostname;
 	return 0;
 }
@@ -156,6 +176,56 @@ int zq3_mqtt_set_topic(zq3_mqtt_context *mctx, const char *src, int len) {
 	return 0;
 }
 
+// Load the broker settings from a url (see zq3_url.c for the format)
+int zq3_mqtt_set_url(zq3_mqtt_context *mctx, const char *url) {
+	zq3_url u;
+	int err = zq3_url_split(url, &u);
+	if (err) {
+		return err;
+	}
+	zq3_mqtt_set_tls(mctx, u.tls);
+	mctx->port = u.port;
+	zq3_mqtt_set_username(mctx, u.user, strlen(u.user));
+	zq3_mqtt_set_password(mctx, u.pass, strlen(u.pass));
+	zq3_mqtt_set_hostname(mctx, u.host, strlen(u.host));
+	return zq3_mqtt_set_topic(mctx, u.topic, strlen(u.topic));
+}
+
+int zq3_mqtt_set_client_id(zq3_mqtt_context *mctx, const char *src, int len) {
+	if (src == NULL || len < 1) {
+		return -EINVAL;
+	}
+	if (len >= sizeof(mctx->client_id_buf)) {
+		return -EDOM;
+	}
+	memset(mctx->client_id_buf, 0, sizeof(mctx->client_id_buf));
+	memcpy(mctx->client_id_buf, src, len);
+	mctx->client.client_id.utf8 = mctx->client_id_buf;
+	mctx->client.client_id.size = strlen(mctx->client_id_buf);
+	return 0;
+}
+
+// Make a client id that's unique to this board, like "zq3-a1b2c3d4e5f6".
+// This uses the hardware device id (on ESP32-S3, that's the MAC address), or
+// a random number if there's no device id. Persistent sessions are keyed by
+// client id, so the caller should save it to keep it stable across boots.
+//
+int zq3_mqtt_default_client_id(zq3_mqtt_context *mctx) {
+	uint8_t id[8] = {0};
+	ssize_t len = hwinfo_get_device_id(id, sizeof(id));
+	if (len <= 0) {
+		LOG_INF("hwinfo_get_device_id() = %d, using random id", len);
+		sys_rand_get(id, sizeof(id));
+		len = sizeof(id);
+	}
+	char buf[sizeof(mctx->client_id_buf)] = "zq3-";
+	int pos = strlen(buf);
+	for (int i = 0; i < len && pos + 2 < sizeof(buf); i++) {
+		pos += snprintk(&buf[pos], sizeof(buf) - pos, "%02x", id[i]);
+	}
+	return zq3_mqtt_set_client_id(mctx, buf, pos);
+}
+
 int zq3_mqtt_set_hostname(zq3_mqtt_context *mctx, const char *src, int len) {
 	if (src == NULL) {
 		return -EINVAL;
@@ -169,36 +239,49 @@ int zq3_mqtt_set_hostname(zq3_mqtt_context *mctx, const char *src, int len) {
 }
 
 // Once MQTT connection is up, event loop calls this to start subscription.
-// This is hardcoded to subscribe to the one topic specified in zq3_context.
+// This subscribes to the toggle switch topic plus any extra topics (feeds for
+// the widgets from the zq3/layout setting) in one SUBSCRIBE packet.
 // Related docs:
 // - https://docs.zephyrproject.org/latest/doxygen/html/structmqtt__subscription__list.html
 // - https://docs.zephyrproject.org/latest/doxygen/html/structmqtt__topic.html
 // - https://docs.zephyrproject.org/latest/doxygen/html/structmqtt__utf8.html
 //
-int zq3_mqtt_subscribe(zq3_mqtt_context *mctx) {
-	// This uses a C99 compound literal to initialize a nested struct
-	struct mqtt_subscription_list list = {
-		.list = &(struct mqtt_topic){
+int
+zq3_mqtt_subscribe(zq3_mqtt_context *mctx, const char *const *extra, int count)
+{
+	struct mqtt_topic topics[ZQ3_MQTT_MAX_TOPICS];
+	if (count < 0 || count + 1 > ZQ3_MQTT_MAX_TOPICS) {
+		return -E2BIG;
+	}
+	for (int i = 0; i <= count; i++) {
+		// Topic 0 is the toggle switch, the rest are extras
+		const char *t = (i == 0) ? (const char *)mctx->topic :
+			extra[i - 1];
+		// This uses a C99 compound literal to initialize a nested struct
+		topics[i] = (struct mqtt_topic){
 			.topic = (struct mqtt_utf8){
-				.utf8 = mctx->topic,
-				.size = strlen(mctx->topic)
+				.utf8 = (const uint8_t *)t,
+				.size = strlen(t)
 			},
-			.qos = MQTT_QOS_0_AT_MOST_ONCE
-		},
-		.list_count = 1,
+			.qos = MQTT_QOS_1_AT_LEAST_ONCE
+		};
+	}
+	struct mqtt_subscription_list list = {
+		.list = topics,
+		.list_count = count + 1,
 		.message_id = 1
 	};
 	// Send the subscription request
 	int err = mqtt_subscribe(&mctx->client, &list);
 	if(err) {
 		// https://docs.zephyrproject.org/apidoc/latest/errno_8h.html
-		printk("ERR: mqtt_subscribe() = %d\n", err);
+		LOG_ERR("mqtt_subscribe() = %d", err);
 	}
 	return err;
 }
 
 
-// Publish new toggle switch state to the topic.
+// Publish a payload to a topic.
 // Related docs:
 // - https://docs.zephyrproject.org/latest/doxygen/html/structmqtt__publish__param.html
 // - https://docs.zephyrproject.org/latest/doxygen/html/structmqtt__publish__message.html
@@ -206,60 +289,231 @@ int zq3_mqtt_subscribe(zq3_mqtt_context *mctx) {
 // - https://docs.zephyrproject.org/latest/doxygen/html/structmqtt__utf8.html
 // - https://docs.zephyrproject.org/latest/doxygen/html/structmqtt__binstr.html
 //
-int
-zq3_mqtt_publish(zq3_mqtt_context *mctx, bool toggle)
+// With MQTT 5, publishing to the main topic uses topic alias 1 when the
+// broker allows aliases. The first publish after connecting sends the topic
+// string along with the alias. After that, only the 2-byte alias gets sent.
+//
+// QoS 1 publishes count against the broker's Receive Maximum. If too many
+// are in flight (waiting for PUBACK), this returns -EBUSY so the caller can
+// try again later.
+//
+static int
+publish(zq3_mqtt_context *mctx, uint8_t *topic, const char *payload,
+	enum mqtt_qos qos, bool retain)
 {
-	char * state = toggle ? "1" : "0";
+	if (qos != MQTT_QOS_0_AT_MOST_ONCE && mctx->inflight >= mctx->rx_max) {
+		return -EBUSY;
+	}
+	uint16_t message_id = 0;
+	if (qos != MQTT_QOS_0_AT_MOST_ONCE) {
+		// Message id 1 is for SUBSCRIBE, and 0 is not allowed
+		message_id = mctx->next_msg_id;
+		mctx->next_msg_id = (message_id == UINT16_MAX) ? 2 : message_id + 1;
+	}
 	// Build a C99 compound literal representing the message to be published
-	const struct mqtt_publish_param param = {
+	struct mqtt_publish_param param = {
 		.message = (struct mqtt_publish_message){
 			.topic = (struct mqtt_topic){
 				.topic = (struct mqtt_utf8){
-					.utf8 = mctx->topic,
-					.size = strlen(mctx->topic),
+					.utf8 = topic,
+					.size = strlen(topic),
 				},
-				.qos = MQTT_QOS_0_AT_MOST_ONCE,
+				.qos = qos,
 			},
 			.payload = (struct mqtt_binstr){
-				.data = (uint8_t *)state,
-				.len = strlen(state),
+				.data = (uint8_t *)payload,
+				.len = strlen(payload),
 			},
 		},
-		.message_id = 0,
+		.message_id = message_id,
 		.dup_flag = 0,
-		.retain_flag = 0,
+		.retain_flag = retain ? 1 : 0,
 	};
+#if defined(CONFIG_ZQ3_MQTT5)
+	bool use_alias = mctx->mqtt5 && mctx->alias_max >= 1 &&
+		topic == mctx->topic;
+	if (use_alias) {
+		param.prop.topic_alias = 1;
+		if (mctx->alias_set) {
+			// Broker already knows alias 1, so leave out the topic string
+			param.message.topic.topic.size = 0;
+		}
+	}
+#endif
 	// Publish it
 	int err = mqtt_publish(&mctx->client, &param);
 	if (err) {
-		printk("ERR: mqtt_publish() = %d\n", err);
+		LOG_ERR("mqtt_publish() = %d", err);
+		return err;
 	}
-	return err;
+#if defined(CONFIG_ZQ3_MQTT5)
+	if (use_alias) {
+		mctx->alias_set = true;
+	}
+#endif
+	if (qos != MQTT_QOS_0_AT_MOST_ONCE) {
+		mctx->inflight++;
+	}
+	return 0;
 }
 
+// Publish new toggle switch state to the topic. With CONFIG_ZQ3_MQTT_RETAIN,
+// the broker keeps the value and sends it back to us when we re-subscribe.
+//
+int
+zq3_mqtt_publish(zq3_mqtt_context *mctx, bool toggle)
+{
+	return publish(mctx, mctx->topic, toggle ? "1" : "0",
+		MQTT_QOS_1_AT_LEAST_ONCE, IS_ENABLED(CONFIG_ZQ3_MQTT_RETAIN));
+}
 
-// Connect to MQTT broker
-int zq3_mqtt_connect(zq3_mqtt_context *mctx) {
-	// Use DNS to resolve hostname to IPv4 IP (IPv6 not supported)
-	int err = zq3_dns_resolve(mctx->hostname, mctx->tls,
+// Ask the broker to re-send a topic's current value using the Adafruit IO
+// `/get` topic modifier. The answer arrives as a normal PUBLISH event on the
+// subscribed topic. For brokers that don't know about `/get` (mosquitto), this
+// is a harmless publish to an unused topic.
+// Related docs:
+// - https://io.adafruit.com/api/docs/mqtt.html#using-the-get-topic
+//
+int
+zq3_mqtt_get_topic(zq3_mqtt_context *mctx, const char *topic)
+{
+	uint8_t get_topic[sizeof(mctx->topic) + sizeof("/get")] = {0};
+	int len = strlen(topic);
+	if (len >= sizeof(mctx->topic)) {
+		return -EDOM;
+	}
+	memcpy(get_topic, topic, len);
+	memcpy(get_topic + len, "/get", strlen("/get"));
+	return publish(mctx, get_topic, "", MQTT_QOS_0_AT_MOST_ONCE, false);
+}
+
+// Ask the broker to re-send the toggle switch topic's current value
+int
+zq3_mqtt_get(zq3_mqtt_context *mctx)
+{
+	return zq3_mqtt_get_topic(mctx, (const char *)mctx->topic);
+}
+
+// Publish a string to some other topic (QoS 0, not retained), like OTA status
+int
+zq3_mqtt_publish_to(zq3_mqtt_context *mctx, const char *topic,
+	const char *payload)
+{
+	return publish(mctx, (uint8_t *)topic, payload, MQTT_QOS_0_AT_MOST_ONCE,
+		false);
+}
+
+// Event handler calls this for CONNACK to reset per-connection state and
+// save the broker's MQTT 5 limits (Receive Maximum, Topic Alias Maximum).
+// Related docs:
+// - https://docs.oasis-open.org/mqtt/mqtt/v5.0/os/mqtt-v5.0-os.html#_Toc3901080
+//
+void
+zq3_mqtt_connack(zq3_mqtt_context *mctx, const struct mqtt_connack_param *p)
+{
+	mctx->inflight = 0;
+	mctx->rx_max = UINT16_MAX;
+	mctx->alias_max = 0;
+	mctx->alias_set = false;
+#if defined(CONFIG_ZQ3_MQTT5)
+	if (!mctx->mqtt5) {
+		return;
+	}
+	if (p->prop.rx.has_receive_maximum) {
+		mctx->rx_max = p->prop.receive_maximum;
+	}
+	if (p->prop.rx.has_topic_alias_maximum) {
+		mctx->alias_max = p->prop.topic_alias_maximum;
+	}
+	LOG_INF("MQTT 5: broker Receive Maximum %d, Topic Alias Maximum %d",
+		mctx->rx_max, mctx->alias_max);
+#endif
+}
+
+// Event handler calls this for PUBACK (our QoS 1 publish was delivered)
+void zq3_mqtt_puback(zq3_mqtt_context *mctx) {
+	if (mctx->inflight > 0) {
+		mctx->inflight--;
+	}
+}
+
+// Select MQTT 3.1.1 or MQTT 5.0 (from the zq3/mqttv setting)
+int zq3_mqtt_set_version(zq3_mqtt_context *mctx, bool mqtt5) {
+#if defined(CONFIG_ZQ3_MQTT5)
+	mctx->mqtt5 = mqtt5;
+	mctx->client.protocol_version =
+		mqtt5 ? MQTT_VERSION_5_0 : MQTT_VERSION_3_1_1;
+	return 0;
+#else
+	if (mqtt5) {
+		LOG_ERR("MQTT 5 needs CONFIG_ZQ3_MQTT5=y");
+		return -ENOTSUP;
+	}
+	return 0;
+#endif
+}
+
+
+// Connect stage 1: use DNS to resolve hostname to IPv4 IP (IPv6 not
+// supported)
+int zq3_mqtt_resolve(zq3_mqtt_context *mctx) {
+	uint16_t port = mctx->port ? mctx->port : (mctx->tls ? 8883 : 1883);
+	return zq3_dns_resolve(mctx->hostname, port,
 		(struct sockaddr_storage *)mctx->client.broker);
-	if (err) {
-		return err;
+}
+
+// Connect stage 2: register credentials for this broker. Credentials
+// provisioned in NVM flash (`aio cred ...`) come first. If there are no CA
+// certs in flash, use the build-time CA certs for this broker (see
+// app/certs/certs.txt).
+int zq3_mqtt_creds(zq3_mqtt_context *mctx) {
+	if (mctx->tls) {
+		sec_tag_t *tags = mctx->sec_tags;
+		int max = ARRAY_SIZE(mctx->sec_tags);
+		int count = zq3_cred_register(mctx->hostname, tags, max);
+		if (count < 0) {
+			return count;
+		}
+		if (!zq3_cred_has_ca()) {
+			int n = zq3_cert_register(mctx->hostname, &tags[count],
+				max - count);
+			if (n < 0) {
+				return n;
+			}
+			count += n;
+		}
+		mctx->client.transport.tls.config.sec_tag_count = count;
+		// Pin the cipher suites for the current TLS profile (zq3/tls)
+		zq3_tls_apply(&mctx->client.transport.tls.config);
 	}
+	return 0;
+}
 
-	err = mqtt_connect(&mctx->client);
+// Connect stage 3: TCP connect, TLS handshake (including cert parsing), and
+// send MQTT CONNECT. Zephyr's mqtt_connect() does all three in one blocking
+// call. CONNACK comes later through zq3_mqtt_poll().
+int zq3_mqtt_open(zq3_mqtt_context *mctx) {
+	uint32_t start = k_uptime_get_32();
+	zq3_cert_heap_reset();
+	int err = mqtt_connect(&mctx->client);
+	mctx->connect_ms = k_uptime_get_32() - start;
+	mctx->tls_heap_peak = zq3_cert_heap_peak();
+	if (mctx->tls) {
+		LOG_INF("TLS connect (%s): %d ms, mbedTLS heap peak %d bytes",
+			zq3_tls_profile_name(), mctx->connect_ms, mctx->tls_heap_peak);
+	}
 	if(err) {
 		// https://docs.zephyrproject.org/apidoc/latest/errno_8h.html
-		const char *fmt = "ERR: mqtt_connect() = %d %s\n";
 		switch(-err) {
 		case ENOENT:
-			printk(fmt, err, "ENOENT: TLS CA cert valid?");
+			LOG_ERR("mqtt_connect() = %d ENOENT: TLS CA cert valid?", err);
 			break;
 		case ECONNREFUSED:
-			printk(fmt, err, "ECONNREFUSED: Broker service running?");
+			LOG_ERR("mqtt_connect() = %d ECONNREFUSED: Broker service "
+				"running?", err);
 			break;
 		default:
-			printk(fmt, err, "");
+			LOG_ERR("mqtt_connect() = %d", err);
 		}
 		return err;
 	}
@@ -272,26 +526,44 @@ int zq3_mqtt_connect(zq3_mqtt_context *mctx) {
 	return 0;
 }
 
-// Poll for incoming packets (note: poll() requires CONFIG_POSIX_API=y)
-int zq3_mqtt_poll(zq3_mqtt_context *mctx) {
-	if (poll(mctx->fds, 1, 0) > 0) {
-		return mqtt_input(&mctx->client);
+// Connect to MQTT broker (all stages, blocking)
+int zq3_mqtt_connect(zq3_mqtt_context *mctx) {
+	int err = zq3_mqtt_resolve(mctx);
+	if (err) {
+		return err;
 	}
-	return 0;
+	err = zq3_mqtt_creds(mctx);
+	if (err) {
+		return err;
+	}
+	return zq3_mqtt_open(mctx);
 }
 
-// Send an MQTT PINGREQ ping several seconds before the keepalive timer is due
-// to run out. This keeps the TCP connection to the MQTT broker open so it can
-// send us messages on subscribed topics as they are published.
-//
-int zq3_mqtt_keepalive(zq3_mqtt_context *mctx) {
-	int remaining_ms = mqtt_keepalive_time_left(&mctx->client);
-	if (remaining_ms < 5000) {
-		return mqtt_live(&mctx->client);
+// Poll for incoming packets (note: poll() requires CONFIG_POSIX_API=y). This
+// handles up to MAX_PACKETS per call, so a burst of messages gets through in
+// one pass of the main loop (and one redraw).
+int zq3_mqtt_poll(zq3_mqtt_context *mctx) {
+	for (int i = 0; i < MAX_PACKETS && poll(mctx->fds, 1, 0) > 0; i++) {
+		int err = mqtt_input(&mctx->client);
+		if (err) {
+			return err;
+		}
 	}
 	return 0;
 }
 
+// Send an MQTT PINGREQ ping (see zq3_keepalive.c for when)
+int zq3_mqtt_ping(zq3_mqtt_context *mctx) {
+	return mqtt_ping(&mctx->client);
+}
+
+// Time since we last sent the broker anything (ms)
+uint32_t zq3_mqtt_tx_idle_ms(zq3_mqtt_context *mctx) {
+	uint32_t keepalive_ms = mctx->client.keepalive * MSEC_PER_SEC;
+	uint32_t remaining_ms = mqtt_keepalive_time_left(&mctx->client);
+	return (remaining_ms < keepalive_ms) ? keepalive_ms - remaining_ms : 0;
+}
+
 // Disconnect from MQTT broker
 int zq3_mqtt_disconnect(zq3_mqtt_context *mctx) {
 	int err = mqtt_disconnect(&mctx->client);
@@ -299,12 +571,18 @@ int zq3_mqtt_disconnect(zq3_mqtt_context *mctx) {
 		// https://docs.zephyrproject.org/apidoc/latest/errno_8h.html
 		switch(-err) {
 		case ENOTCONN:
-			printk("ERR: Socket was not connected\n");
+			LOG_ERR("Socket was not connected");
 			break;
 		default:
-			printk("ERR: %d\n", err);
+			LOG_ERR("mqtt_disconnect() = %d", err);
 		}
 		return err;
 	}
 	return 0;
 }
+
+// Drop the MQTT connection without sending DISCONNECT (for a connection that
+// stopped working, before trying another broker)
+int zq3_mqtt_abort(zq3_mqtt_context *mctx) {
+	return mqtt_abort(&mctx->client);
+}
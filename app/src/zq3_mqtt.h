@@ -6,6 +6,7 @@
 #define ZQ3_MQTT_H
 
 #include <zephyr/net/mqtt.h>  /* struct mqtt_client */
+#include <zephyr/net/tls_credentials.h>  /* sec_tag_t */
 #include "zq3.h"              /* zq3_context */
 
 
@@ -25,14 +26,29 @@ typedef struct {
 	uint8_t pass_buf[48];            // MQTT password string buffer
 	uint8_t topic[48];               // MQTT topic string buffer
 	uint8_t hostname[48];            // MQTT broker hostname string buffer
+	uint8_t client_id_buf[24];       // MQTT client id string buffer
 	struct mqtt_utf8 pass;           // UTF-8 password struct
 	struct mqtt_utf8 user;           // UTF-8 username struct
 	struct sockaddr_storage broker;  // Broker network address struct union
 	struct mqtt_client client;       // client struct for mqtt_*() API funcs
 	struct pollfd fds[1];            // socket file descriptor
+	sec_tag_t sec_tags[6];           // TLS credential tags for broker
 	bool tls;                        // true: port 8883+TLS, false: port 1883
+	uint16_t port;                   // broker port from the url (0 = default)
+	bool mqtt5;                      // true: MQTT 5.0, false: MQTT 3.1.1
+	uint16_t next_msg_id;            // next QoS 1 PUBLISH message id
+	uint16_t inflight;               // QoS 1 publishes waiting for PUBACK
+	uint16_t rx_max;                 // broker's Receive Maximum (MQTT 5)
+	uint16_t alias_max;              // broker's Topic Alias Maximum (MQTT 5)
+	bool alias_set;                  // broker knows topic alias 1 = topic
+	uint32_t connect_ms;             // duration of last mqtt_connect() call
+	size_t tls_heap_peak;            // mbedTLS heap peak during last connect
 } zq3_mqtt_context;
 
+// Max topics in one SUBSCRIBE: toggle switch, layout widgets, layout feed,
+// OTA topics
+#define ZQ3_MQTT_MAX_TOPICS (CONFIG_ZQ3_BIND_MAX + 3)
+
 #define ZQ3_MQTT_URL_MAX_LEN (sizeof("mqtts://:@") + \
 	sizeof(((zq3_mqtt_context *)0)->user_buf) + \
 	sizeof(((zq3_mqtt_context *)0)->pass_buf) + \
@@ -54,17 +70,48 @@ int zq3_mqtt_set_hostname(zq3_mqtt_context *mctx, const char *src, int len);
 
 int zq3_mqtt_set_topic(zq3_mqtt_context *mctx, const char *src, int len);
 
-int zq3_mqtt_subscribe(zq3_mqtt_context *mctx);
+int zq3_mqtt_set_url(zq3_mqtt_context *mctx, const char *url);
+
+int zq3_mqtt_set_client_id(zq3_mqtt_context *mctx, const char *src, int len);
+
+int zq3_mqtt_default_client_id(zq3_mqtt_context *mctx);
+
+int
+zq3_mqtt_subscribe(zq3_mqtt_context *mctx, const char *const *extra, int count);
 
 int zq3_mqtt_publish(zq3_mqtt_context *mctx, bool toggle);
 
+int zq3_mqtt_get_topic(zq3_mqtt_context *mctx, const char *topic);
+
+int zq3_mqtt_get(zq3_mqtt_context *mctx);
+
+int zq3_mqtt_publish_to(zq3_mqtt_context *mctx, const char *topic,
+	const char *payload);
+
+void
+zq3_mqtt_connack(zq3_mqtt_context *mctx, const struct mqtt_connack_param *p);
+
+void zq3_mqtt_puback(zq3_mqtt_context *mctx);
+
+int zq3_mqtt_set_version(zq3_mqtt_context *mctx, bool mqtt5);
+
+int zq3_mqtt_resolve(zq3_mqtt_context *mctx);
+
+int zq3_mqtt_creds(zq3_mqtt_context *mctx);
+
+int zq3_mqtt_open(zq3_mqtt_context *mctx);
+
 int zq3_mqtt_connect(zq3_mqtt_context *mctx);
 
 int zq3_mqtt_poll(zq3_mqtt_context *mctx);
 
-int zq3_mqtt_keepalive(zq3_mqtt_context *mctx);
+int zq3_mqtt_ping(zq3_mqtt_context *mctx);
+
+uint32_t zq3_mqtt_tx_idle_ms(zq3_mqtt_context *mctx);
 
 int zq3_mqtt_disconnect(zq3_mqtt_context *mctx);
 
+int zq3_mqtt_abort(zq3_mqtt_context *mctx);
+
 #endif /* ZQ3_MQTT_H */
 
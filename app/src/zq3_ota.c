@@ -0,0 +1,449 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Firmware updates over MQTT (streamed into the MCUboot secondary slot)
+ *
+ * With CONFIG_ZQ3_OTA=y (`make app-ota`, which builds MCUboot too) and the
+ * zq3/ota setting holding a topic prefix, the app subscribes to <prefix>/#
+ * and takes a signed image as a series of chunk messages (see zq3_ota.h for
+ * the topics and tools/ota_send.py for a sender).
+ *
+ * Chunks don't get staged in RAM. The MQTT library hands us each chunk's
+ * payload while it's still in the socket, and we copy it to flash through
+ * one small buffer (CONFIG_ZQ3_OTA_BUF_SIZE). Each flash sector gets erased
+ * right before the first chunk that lands in it.
+ *
+ * A bitmap tracks which chunks are in flash (see zq3_chunks.c). If the
+ * connection drops, the sender can send the same begin message again, and
+ * the device answers with the first chunk it still needs. Chunks it already
+ * has get skipped, so resending the rest of the image is cheap. The bitmap
+ * gets saved in zq3/otamap every CONFIG_ZQ3_OTA_SAVE_CHUNKS chunks, so a
+ * reboot only loses the chunks since the last save.
+ *
+ * When the last chunk arrives, the main loop hashes the slot a piece at a
+ * time (so LVGL keeps running) and compares it with the SHA-256 from the
+ * begin message. Only a good image gets marked for MCUboot to swap in (as a
+ * test). After the new image connects to the broker, it confirms itself.
+ * If it never gets that far, MCUboot swaps back on the next reset.
+ *
+ * Compressed and delta images aren't supported yet. The begin message has
+ * a mode field for them, but only "raw" is accepted.
+ *
+ * Docs & Refs:
+ * https://docs.zephyrproject.org/latest/services/device_mgmt/dfu.html
+ * https://docs.zephyrproject.org/latest/services/storage/flash_map/flash_map.html
+ * https://docs.zephyrproject.org/latest/connectivity/networking/api/mqtt.html
+ */
+
+#include <stdlib.h>                   // strtoul()
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/sys/byteorder.h>     // sys_get_le32()
+#include <zephyr/sys/util.h>          // hex2bin()
+#include <mbedtls/sha256.h>
+#if defined(CONFIG_ZQ3_OTA)
+#include <zephyr/dfu/mcuboot.h>
+#endif
+#include "zq3_ota.h"
+
+LOG_MODULE_REGISTER(zq3_ota, CONFIG_ZQ3_OTA_LOG_LEVEL);
+
+
+#define SLOT_ID FIXED_PARTITION_ID(slot1_partition)
+
+// MCUboot image header magic (first 4 bytes of a signed image, little-endian)
+#define IMAGE_MAGIC (0x96f3b83d)
+
+static mbedtls_sha256_context sha;
+
+static const char *state_names[ZQ3_OTA_STATES] = {
+	"idle", "receiving", "verifying", "ready", "failed",
+};
+
+
+static void fail(zq3_ota_context *ota, int err) {
+	LOG_ERR("OTA failed: %d", err);
+	ota->save_pending |= ota->state == ZQ3_OTA_RECEIVING;
+	ota->state = ZQ3_OTA_FAILED;
+	ota->err = err;
+	ota->status_pending = true;
+}
+
+// Read and throw away the rest of a payload we don't want
+static void drain(zq3_ota_context *ota, struct mqtt_client *client,
+	uint32_t len)
+{
+	while (len > 0) {
+		uint32_t n = MIN(len, sizeof(ota->buf));
+		if (mqtt_readall_publish_payload(client, ota->buf, n) < 0) {
+			return;
+		}
+		len -= n;
+	}
+}
+
+void zq3_ota_init(zq3_ota_context *ota) {
+	memset(ota, 0, sizeof(*ota));
+}
+
+// Set the topic prefix (empty string disables OTA)
+int zq3_ota_set_prefix(zq3_ota_context *ota, const char *prefix, int len) {
+	len = strnlen(prefix, len);
+	if (len >= sizeof(ota->prefix)) {
+		return -EOVERFLOW;
+	}
+	memset(ota->prefix, 0, sizeof(ota->prefix));
+	memcpy(ota->prefix, prefix, len);
+	snprintk(ota->filter, sizeof(ota->filter), "%s/#", ota->prefix);
+	return 0;
+}
+
+// Get the topic filter to subscribe to (NULL if OTA is off)
+const char *zq3_ota_filter(zq3_ota_context *ota) {
+	if (!IS_ENABLED(CONFIG_ZQ3_OTA) || strlen(ota->prefix) == 0) {
+		return NULL;
+	}
+	return ota->filter;
+}
+
+// Load the chunk map saved by a transfer that a reboot interrupted (the
+// zq3/otamap setting), so the sender can resume it. Call from the settings
+// handler.
+int zq3_ota_load(zq3_ota_context *ota, size_t len, settings_read_cb read_cb,
+	void *cb_arg)
+{
+	if (ota->state != ZQ3_OTA_IDLE) {
+		return 0;   // `aio reload` while the RAM map is newer
+	}
+	zq3_chunks saved;
+	int rc = (len == sizeof(saved)) ? read_cb(cb_arg, &saved, len) : -EINVAL;
+	if (rc < 0 || zq3_chunks_load(&ota->map, &saved, rc) != 0) {
+		// Stale (Kconfig limits changed) or damaged: start over
+		LOG_WRN("ignoring saved OTA chunk map");
+		ota->save_pending = true;
+		return 0;
+	}
+	ota->state = ZQ3_OTA_RECEIVING;
+	ota->saved_at = ota->map.received;
+	LOG_INF("OTA transfer has %d of %d chunks", ota->map.received,
+		ota->map.chunks);
+	return 0;
+}
+
+// Check if a topic is one of ours (<prefix>/...)
+bool zq3_ota_match(zq3_ota_context *ota, const uint8_t *topic, uint32_t len) {
+	int plen = strlen(ota->prefix);
+	return zq3_ota_filter(ota) && len > plen && topic[plen] == '/' &&
+		memcmp(topic, ota->prefix, plen) == 0;
+}
+
+// Handle <prefix>/begin: "<size> <chunk size> <sha256 hex> [mode]"
+static int begin(zq3_ota_context *ota, char *args) {
+	char *p = args;
+	uint32_t size = strtoul(p, &p, 10);
+	uint32_t chunk = strtoul(p, &p, 10);
+	while (*p == ' ') {
+		p++;
+	}
+	uint8_t hash[32];
+	if (hex2bin(p, 64, hash, sizeof(hash)) != sizeof(hash)) {
+		return -EINVAL;
+	}
+	p += 64;
+	while (*p == ' ') {
+		p++;
+	}
+	if (*p != '\0' && strcmp(p, "raw") != 0) {
+		LOG_ERR("OTA mode '%s' is not supported", p);
+		return -ENOTSUP;
+	}
+	const struct flash_area *fa;
+	int err = flash_area_open(SLOT_ID, &fa);
+	if (err) {
+		return err;
+	}
+	size_t slot_size = fa->fa_size;
+	flash_area_close(fa);
+
+	// Same image as the transfer in progress, so keep the chunks we have
+	bool same = zq3_chunks_same(&ota->map, size, chunk, hash);
+	if (same && ota->state == ZQ3_OTA_RECEIVING) {
+		LOG_INF("resuming at chunk %d of %d", zq3_chunks_next(&ota->map),
+			ota->map.chunks);
+	} else if (same && (ota->state == ZQ3_OTA_VERIFYING ||
+		ota->state == ZQ3_OTA_READY))
+	{
+		return 0;
+	} else {
+		err = zq3_chunks_begin(&ota->map, size, chunk, hash, slot_size);
+		if (err) {
+			return err;
+		}
+		ota->saved_at = 0;
+		ota->save_pending = true;
+		LOG_INF("new image, %d bytes in %d chunks", size, ota->map.chunks);
+	}
+	ota->state = ZQ3_OTA_RECEIVING;
+	ota->err = 0;
+	ota->bytes = 0;
+	ota->start_ms = 0;
+	return 0;
+}
+
+// Handle <prefix>/c/<n>: copy the payload from the socket to flash. want is
+// from zq3_chunks_want().
+static int write_chunk(zq3_ota_context *ota, struct mqtt_client *client,
+	uint32_t n, uint32_t len, int want, uint32_t erase_off)
+{
+	uint32_t off = n * ota->map.chunk;
+	const struct flash_area *fa;
+	int err = (want >= 0) ? flash_area_open(SLOT_ID, &fa) : want;
+	if (err) {
+		drain(ota, client, len);
+		return err;
+	}
+	uint32_t start = k_cycle_get_32();
+	if (want == 1) {
+		err = flash_area_erase(fa, erase_off, ZQ3_CHUNKS_SECTOR);
+		ota->erases++;
+	}
+
+	// Copy the payload in buffer sized pieces. The last piece of the image
+	// gets padded to the flash write alignment with erased bytes (0xff).
+	size_t align = flash_area_align(fa);
+	uint32_t done = 0;
+	while (err == 0 && done < len) {
+		uint32_t piece = MIN(len - done, sizeof(ota->buf));
+		err = mqtt_readall_publish_payload(client, ota->buf, piece);
+		if (err) {
+			// Socket error, so the MQTT connection is going down anyway
+			flash_area_close(fa);
+			return err;
+		}
+		done += piece;
+		uint32_t padded = ROUND_UP(piece, align);
+		memset(ota->buf + piece, 0xff, padded - piece);
+		err = flash_area_write(fa, off + done - piece, ota->buf, padded);
+	}
+	flash_area_close(fa);
+	if (err) {
+		// Keep the MQTT stream in sync by reading the rest of the payload
+		drain(ota, client, len - done);
+		return err;
+	}
+	uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+	ota->write_us_max = MAX(ota->write_us_max, us);
+	zq3_chunks_mark(&ota->map, n);
+	ota->bytes += len;
+	if (ota->map.received - ota->saved_at >= CONFIG_ZQ3_OTA_SAVE_CHUNKS) {
+		ota->save_pending = true;
+	}
+	return 0;
+}
+
+// Handle a message on one of our topics. This reads the whole payload
+// (straight into flash, for chunks), so call it instead of
+// mqtt_read_publish_payload(). It runs in the MQTT event callback.
+void zq3_ota_receive(zq3_ota_context *ota, struct mqtt_client *client,
+	const uint8_t *topic, uint32_t t_len, uint32_t payload_len)
+{
+	const char *sub = (const char *)topic + strlen(ota->prefix) + 1;
+	int sub_len = t_len - strlen(ota->prefix) - 1;
+	int err;
+
+	if (sub_len > 2 && memcmp(sub, "c/", 2) == 0) {
+		char num[12] = {0};
+		memcpy(num, sub + 2, MIN(sub_len - 2, sizeof(num) - 1));
+		uint32_t n = strtoul(num, NULL, 10);
+		uint32_t erase_off = 0;
+		int want = (ota->state == ZQ3_OTA_RECEIVING) ?
+			zq3_chunks_want(&ota->map, n, payload_len, &erase_off) :
+			-ENOENT;
+		if (want == -ENOENT || want == -EALREADY) {
+			ota->dupes += want == -EALREADY;
+			drain(ota, client, payload_len);
+			return;
+		}
+		int64_t now = k_uptime_get();
+		if (ota->start_ms == 0) {
+			ota->start_ms = now;
+		}
+		err = write_chunk(ota, client, n, payload_len, want, erase_off);
+		ota->last_ms = k_uptime_get();
+		if (err) {
+			fail(ota, err);
+		} else if (ota->map.received == ota->map.chunks) {
+			LOG_INF("got all %d chunks, verifying", ota->map.chunks);
+			ota->state = ZQ3_OTA_VERIFYING;
+			ota->save_pending = true;   // delete the map
+			ota->verify_off = 0;
+			ota->verify_ms = 0;
+			mbedtls_sha256_init(&sha);
+			mbedtls_sha256_starts(&sha, 0);
+		}
+	} else if (sub_len == 5 && memcmp(sub, "begin", 5) == 0) {
+		char args[100] = {0};
+		if (payload_len >= sizeof(args)) {
+			drain(ota, client, payload_len);
+			fail(ota, -EMSGSIZE);
+			return;
+		}
+		err = mqtt_readall_publish_payload(client, (uint8_t *)args,
+			payload_len);
+		if (err == 0) {
+			err = begin(ota, args);
+		}
+		if (err) {
+			fail(ota, err);
+		}
+		ota->status_pending = true;
+	} else if (sub_len == 4 && memcmp(sub, "boot", 4) == 0) {
+		drain(ota, client, payload_len);
+		ota->boot_pending = ota->state == ZQ3_OTA_READY;
+	} else {
+		// Our own status messages come back here too
+		drain(ota, client, payload_len);
+	}
+}
+
+// Hash the next piece of the slot. When it's all hashed, check the result
+// and ask MCUboot to swap the new image in on the next boot.
+static void verify_step(zq3_ota_context *ota) {
+	const struct flash_area *fa;
+	int err = flash_area_open(SLOT_ID, &fa);
+	if (err) {
+		fail(ota, err);
+		return;
+	}
+	uint32_t start = k_uptime_get_32();
+	uint32_t end = MIN(ota->map.size,
+		ota->verify_off + CONFIG_ZQ3_OTA_VERIFY_STEP);
+	while (err == 0 && ota->verify_off < end) {
+		uint32_t n = MIN(end - ota->verify_off, sizeof(ota->buf));
+		err = flash_area_read(fa, ota->verify_off, ota->buf, n);
+		if (err == 0 && ota->verify_off == 0 &&
+			sys_get_le32(ota->buf) != IMAGE_MAGIC)
+		{
+			err = -ENOEXEC;   // not a signed MCUboot image
+		}
+		if (err) {
+			break;
+		}
+		mbedtls_sha256_update(&sha, ota->buf, n);
+		ota->verify_off += n;
+	}
+	flash_area_close(fa);
+	ota->verify_ms += k_uptime_get_32() - start;
+	if (err) {
+		mbedtls_sha256_free(&sha);
+		fail(ota, err);
+		return;
+	}
+	if (ota->verify_off < ota->map.size) {
+		return;
+	}
+	uint8_t hash[32];
+	mbedtls_sha256_finish(&sha, hash);
+	mbedtls_sha256_free(&sha);
+	if (memcmp(hash, ota->map.sha256, sizeof(hash)) != 0) {
+		fail(ota, -EBADMSG);
+		return;
+	}
+#if defined(CONFIG_ZQ3_OTA)
+	err = boot_request_upgrade(BOOT_UPGRADE_TEST);
+#else
+	err = -ENOTSUP;
+#endif
+	if (err) {
+		fail(ota, err);
+		return;
+	}
+	LOG_INF("image verified in %d ms, swap on next boot",
+		ota->verify_ms);
+	ota->state = ZQ3_OTA_READY;
+	ota->status_pending = true;
+}
+
+// Save the chunk map while receiving, or delete it once it's no use
+static void save_map(zq3_ota_context *ota) {
+	ota->save_pending = false;
+	ota->saved_at = ota->map.received;
+	int err = (ota->state == ZQ3_OTA_RECEIVING) ?
+		settings_save_one("zq3/otamap", &ota->map, sizeof(ota->map)) :
+		settings_delete("zq3/otamap");
+	if (err) {
+		LOG_ERR("OTA map save: %d", err);
+	}
+}
+
+// Verify a finished transfer, save the chunk map, and publish status. The
+// main loop calls this each time around. Returns ZQ3_OTA_BOOT when the
+// sender asked for a reboot into a verified image.
+int zq3_ota_poll(zq3_ota_context *ota, zq3_mqtt_context *mctx, bool online) {
+	if (ota->state == ZQ3_OTA_VERIFYING) {
+		verify_step(ota);
+	}
+	if (ota->save_pending) {
+		save_map(ota);
+	}
+	if (ota->status_pending && online) {
+		char topic[ZQ3_OTA_PREFIX_MAX + sizeof("/status")];
+		char status[48];
+		snprintk(topic, sizeof(topic), "%s/status", ota->prefix);
+		snprintk(status, sizeof(status), "%s %d %d %d %d",
+			state_names[ota->state], ota->map.received, ota->map.chunks,
+			zq3_chunks_next(&ota->map), ota->err);
+		if (zq3_mqtt_publish_to(mctx, topic, status) == 0) {
+			ota->status_pending = false;
+		}
+	}
+	if (ota->boot_pending) {
+		ota->boot_pending = false;
+		return ZQ3_OTA_BOOT;
+	}
+	return 0;
+}
+
+// Mark the running image as good, so MCUboot won't swap back to the old one.
+// Call this once the app has proven it can reach the broker.
+void zq3_ota_confirm(zq3_ota_context *ota) {
+#if defined(CONFIG_ZQ3_OTA)
+	if (ota->confirmed) {
+		return;
+	}
+	ota->confirmed = true;
+	if (!boot_is_img_confirmed()) {
+		int err = boot_write_img_confirmed();
+		LOG_INF("confirmed new image: %d", err);
+	}
+#endif
+}
+
+// Print transfer progress, throughput, and RAM use
+void zq3_ota_print(zq3_ota_context *ota) {
+	if (!IS_ENABLED(CONFIG_ZQ3_OTA)) {
+		printk("OTA is off (build with `make app-ota`)\n");
+		return;
+	}
+	printk("OTA: %s, topic prefix '%s'\n", state_names[ota->state],
+		ota->prefix);
+	printk("Chunks: %d of %d (next %d, dupes %d), %d bytes each\n",
+		ota->map.received, ota->map.chunks, zq3_chunks_next(&ota->map),
+		ota->dupes, ota->map.chunk);
+	int64_t ms = ota->last_ms - ota->start_ms;
+	if (ota->start_ms > 0 && ms > 0) {
+		printk("Throughput: %d KB/s (%d bytes in %d ms)\n",
+			(int)(ota->bytes * 1000LL / 1024 / ms), ota->bytes, (int)ms);
+	}
+	printk("Flash: %d sectors erased, slowest chunk %d us, verify %d ms\n",
+		ota->erases, ota->write_us_max, ota->verify_ms);
+	printk("RAM: %d bytes (buffer %d, bitmap %d)\n",
+		(int)(sizeof(*ota) + sizeof(sha)), (int)sizeof(ota->buf),
+		(int)sizeof(ota->map.bitmap));
+	if (ota->err) {
+		printk("Last error: %d\n", ota->err);
+	}
+}
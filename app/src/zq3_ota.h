@@ -0,0 +1,82 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_OTA_H
+#define ZQ3_OTA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/net/mqtt.h>
+#include <zephyr/settings/settings.h>
+#include "zq3_chunks.h"
+#include "zq3_mqtt.h"
+
+
+// OTA topics, under the prefix from the zq3/ota setting:
+//   <prefix>/begin   "<size> <chunk size> <sha256 hex> [raw]" starts (or
+//                    resumes) a transfer of a signed MCUboot image
+//   <prefix>/c/<n>   raw bytes of chunk n (all chunks but the last are
+//                    exactly chunk size bytes)
+//   <prefix>/boot    reboot into the new image once it's verified
+//   <prefix>/status  (published by the device)
+//                    "<state> <received> <chunks> <next missing> <err>"
+#define ZQ3_OTA_PREFIX_MAX (48)
+// Biggest chunk message: a sector sized chunk plus the fixed header, topic,
+// packet ID, and MQTT 5 properties
+#define ZQ3_OTA_PACKET_MAX (ZQ3_CHUNKS_SECTOR + ZQ3_OTA_PREFIX_MAX + 64)
+#define ZQ3_OTA_BOOT (1)      // zq3_ota_poll() result: time to reboot
+
+typedef enum {
+	ZQ3_OTA_IDLE,
+	ZQ3_OTA_RECEIVING,    // writing chunks to the secondary slot
+	ZQ3_OTA_VERIFYING,    // hashing the secondary slot
+	ZQ3_OTA_READY,        // verified, swap requested for the next boot
+	ZQ3_OTA_FAILED,
+	ZQ3_OTA_STATES,
+} zq3_ota_state;
+
+typedef struct {
+	zq3_ota_state state;
+	char prefix[ZQ3_OTA_PREFIX_MAX];     // from the zq3/ota setting
+	char filter[ZQ3_OTA_PREFIX_MAX + 2]; // prefix + "/#", to subscribe
+	zq3_chunks map;                      // image and the chunks we have
+	uint32_t saved_at;                   // map.received at the last save
+	uint8_t buf[CONFIG_ZQ3_OTA_BUF_SIZE];  // for payload and flash reads
+	uint32_t verify_off;                 // bytes hashed so far
+	int err;                             // why it failed
+	bool status_pending;                 // publish status soon
+	bool save_pending;                   // save (or delete) zq3/otamap
+	bool boot_pending;                   // got <prefix>/boot
+	bool confirmed;                      // running image is confirmed
+	int64_t start_ms;                    // uptime of the first new chunk
+	int64_t last_ms;                     // uptime of the latest chunk
+	uint32_t bytes;                      // bytes written since start_ms
+	uint32_t dupes;                      // chunks we already had
+	uint32_t erases;                     // flash sectors erased
+	uint32_t write_us_max;               // slowest chunk (erase + write)
+	uint32_t verify_ms;                  // time spent hashing
+} zq3_ota_context;
+
+void zq3_ota_init(zq3_ota_context *ota);
+
+int zq3_ota_set_prefix(zq3_ota_context *ota, const char *prefix, int len);
+
+const char *zq3_ota_filter(zq3_ota_context *ota);
+
+int zq3_ota_load(zq3_ota_context *ota, size_t len, settings_read_cb read_cb,
+	void *cb_arg);
+
+bool zq3_ota_match(zq3_ota_context *ota, const uint8_t *topic, uint32_t len);
+
+void zq3_ota_receive(zq3_ota_context *ota, struct mqtt_client *client,
+	const uint8_t *topic, uint32_t t_len, uint32_t payload_len);
+
+int zq3_ota_poll(zq3_ota_context *ota, zq3_mqtt_context *mctx, bool online);
+
+void zq3_ota_confirm(zq3_ota_context *ota);
+
+void zq3_ota_print(zq3_ota_context *ota);
+
+
+#endif /* ZQ3_OTA_H */
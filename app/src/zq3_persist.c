@@ -0,0 +1,294 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Write-behind persistence for settings that change at runtime
+ *
+ * Saving the toggle state and similar runtime values with settings_save_one()
+ * on every change wears out the NVS partition much faster than it needs to,
+ * and each write blocks the caller while NVS appends to flash (or, now and
+ * then, erases a sector to garbage collect).
+ *
+ * Instead, new values go in a small table in RAM. Repeated changes to the
+ * same key collapse into one write, and a change back to the value that's
+ * already in flash cancels the write. Values get flushed when:
+ *
+ * - The oldest unsaved change is CONFIG_ZQ3_PERSIST_DELAY_S old. That's the
+ *   most a power cut can lose.
+ * - The display goes idle (dim or sleep), since changes are unlikely then.
+ * - zq3_persist_flush() gets called, like before a reboot.
+ *
+ * The timer and idle flushes run on a low priority work queue so the flash
+ * writes don't hold up LVGL or the buttons. The work queue gets a copy of
+ * the values, so the table stays free for new changes while it writes.
+ *
+ * Docs & Refs:
+ * https://docs.zephyrproject.org/latest/services/storage/settings/index.html
+ * https://docs.zephyrproject.org/latest/services/storage/nvs/nvs.html
+ * https://docs.zephyrproject.org/latest/kernel/services/threads/workqueue.html
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+#include "zq3_persist.h"
+
+LOG_MODULE_REGISTER(zq3_persist, CONFIG_ZQ3_PERSIST_LOG_LEVEL);
+
+
+K_THREAD_STACK_DEFINE(persist_stack, CONFIG_ZQ3_PERSIST_STACK_SIZE);
+static struct k_work_q persist_q;
+static K_MUTEX_DEFINE(persist_lock);
+
+static const char *reason_names[ZQ3_PERSIST_REASONS] = {
+	"timer", "idle", "sync",
+};
+
+
+// Write one value to flash, timing how long it takes
+static void write_one(zq3_persist_context *ctx, zq3_persist_write *w) {
+	uint32_t start = k_cycle_get_32();
+	w->err = settings_save_one(ctx->entries[w->entry].key, w->value, w->len);
+	w->us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+}
+
+// Work queue handler: write the batch, then give it back to the main loop
+static void flush_work(struct k_work *work) {
+	zq3_persist_context *ctx = CONTAINER_OF(work, zq3_persist_context, work);
+	for (int i = 0; i < ctx->batch_count; i++) {
+		write_one(ctx, &ctx->batch[i]);
+	}
+	atomic_set(&ctx->busy, 0);
+}
+
+// Count the results of a finished batch. Failed writes stay dirty, so they
+// get tried again after the next delay. So do values that changed while the
+// batch was being written. Caller must hold persist_lock.
+static void reconcile(zq3_persist_context *ctx) {
+	int64_t now = k_uptime_get();
+	for (int i = 0; i < ctx->batch_count; i++) {
+		zq3_persist_write *w = &ctx->batch[i];
+		zq3_persist_entry *e = &ctx->entries[w->entry];
+		if (w->err) {
+			LOG_ERR("settings_save_one(%s) = %d", e->key, w->err);
+			ctx->errors++;
+			if (!e->dirty) {
+				e->dirty = true;
+				e->since = now;
+			}
+			continue;
+		}
+		memcpy(e->saved, w->value, w->len);
+		e->saved_len = w->len;
+		if (!e->dirty &&
+			(e->len != w->len || memcmp(e->value, w->value, w->len) != 0))
+		{
+			// The value changed back while this was being written (set
+			// took it for a revert to the old flash value), so flash is
+			// out of date again
+			e->dirty = true;
+			e->since = now;
+		}
+		ctx->writes++;
+		ctx->last_us = w->us;
+		ctx->max_us = MAX(ctx->max_us, w->us);
+		ctx->total_us += w->us;
+	}
+	ctx->batch_count = 0;
+}
+
+// Copy dirty values into the batch and mark them clean. Returns the number
+// of values copied. Caller must hold persist_lock.
+static int take_batch(zq3_persist_context *ctx, zq3_persist_reason reason) {
+	int64_t now = k_uptime_get();
+	ctx->batch_count = 0;
+	for (int i = 0; i < ctx->count; i++) {
+		zq3_persist_entry *e = &ctx->entries[i];
+		if (!e->dirty) {
+			continue;
+		}
+		zq3_persist_write *w = &ctx->batch[ctx->batch_count++];
+		w->entry = i;
+		memcpy(w->value, e->value, e->len);
+		w->len = e->len;
+		w->err = 0;
+		w->us = 0;
+		ctx->max_age_ms = MAX(ctx->max_age_ms, (uint32_t)(now - e->since));
+		e->dirty = false;
+	}
+	if (ctx->batch_count > 0) {
+		ctx->flushes[reason]++;
+	}
+	return ctx->batch_count;
+}
+
+static zq3_persist_entry *find(zq3_persist_context *ctx, const char *key) {
+	for (int i = 0; i < ctx->count; i++) {
+		if (strcmp(ctx->entries[i].key, key) == 0) {
+			return &ctx->entries[i];
+		}
+	}
+	return NULL;
+}
+
+// Find the entry for key, or add one if there's room
+static zq3_persist_entry *find_or_add(zq3_persist_context *ctx,
+	const char *key)
+{
+	zq3_persist_entry *e = find(ctx, key);
+	if (e || ctx->count >= CONFIG_ZQ3_PERSIST_KEYS ||
+		strlen(key) >= ZQ3_PERSIST_KEY_MAX)
+	{
+		return e;
+	}
+	e = &ctx->entries[ctx->count++];
+	memset(e, 0, sizeof(*e));
+	strcpy(e->key, key);
+	return e;
+}
+
+// Start the work queue for flash writes
+int zq3_persist_init(zq3_persist_context *ctx) {
+	memset(ctx, 0, sizeof(*ctx));
+	k_work_init(&ctx->work, flush_work);
+	k_work_queue_start(&persist_q, persist_stack,
+		K_THREAD_STACK_SIZEOF(persist_stack), CONFIG_ZQ3_PERSIST_PRIORITY,
+		NULL);
+	k_thread_name_set(&persist_q.thread, "zq3_persist");
+	return 0;
+}
+
+// Save a value for key (like settings_save_one(), but written later). Safe
+// to call from the shell thread. Values are strings, so len includes the NUL.
+int zq3_persist_set(zq3_persist_context *ctx, const char *key,
+	const char *value, int len)
+{
+	if (len <= 0 || len > ZQ3_PERSIST_VALUE_MAX) {
+		return -EINVAL;
+	}
+	k_mutex_lock(&persist_lock, K_FOREVER);
+	zq3_persist_entry *e = find_or_add(ctx, key);
+	if (!e) {
+		k_mutex_unlock(&persist_lock);
+		LOG_ERR("no room for %s", key);
+		return -ENOMEM;
+	}
+	if (e->len == len && memcmp(e->value, value, len) == 0) {
+		// Same as the newest value, so nothing changed
+	} else if (e->saved_len == len && memcmp(e->saved, value, len) == 0) {
+		// Back to the value in flash, so skip the write
+		if (e->dirty) {
+			ctx->reverted++;
+			e->dirty = false;
+		}
+	} else {
+		ctx->changes++;
+		if (e->dirty) {
+			ctx->coalesced++;
+		} else {
+			e->dirty = true;
+			e->since = k_uptime_get();
+		}
+	}
+	memcpy(e->value, value, len);
+	e->len = len;
+	k_mutex_unlock(&persist_lock);
+	return 0;
+}
+
+// Remember a value that settings_load() found in flash, so setting it again
+// doesn't cause a write. Keys that aren't written behind get ignored.
+void zq3_persist_loaded(zq3_persist_context *ctx, const char *key,
+	const char *value, int len)
+{
+	if (len <= 0 || len > ZQ3_PERSIST_VALUE_MAX) {
+		return;
+	}
+	k_mutex_lock(&persist_lock, K_FOREVER);
+	zq3_persist_entry *e = find_or_add(ctx, key);
+	if (e && !e->dirty) {
+		memcpy(e->value, value, len);
+		memcpy(e->saved, value, len);
+		e->len = len;
+		e->saved_len = len;
+	}
+	k_mutex_unlock(&persist_lock);
+}
+
+// Start a background flush if a change is old enough or the display is
+// idle. The main loop calls this each time around.
+void zq3_persist_poll(zq3_persist_context *ctx, bool idle) {
+	if (atomic_get(&ctx->busy)) {
+		return;
+	}
+	k_mutex_lock(&persist_lock, K_FOREVER);
+	reconcile(ctx);
+	int64_t oldest = INT64_MAX;
+	for (int i = 0; i < ctx->count; i++) {
+		if (ctx->entries[i].dirty) {
+			oldest = MIN(oldest, ctx->entries[i].since);
+		}
+	}
+	zq3_persist_reason reason = ZQ3_PERSIST_REASONS;
+	if (oldest == INT64_MAX) {
+		// Nothing to write
+	} else if (idle) {
+		reason = ZQ3_PERSIST_IDLE;
+	} else if (k_uptime_get() - oldest >= CONFIG_ZQ3_PERSIST_DELAY_S * 1000LL)
+	{
+		reason = ZQ3_PERSIST_TIMER;
+	}
+	if (reason != ZQ3_PERSIST_REASONS && take_batch(ctx, reason) > 0) {
+		atomic_set(&ctx->busy, 1);
+		k_work_submit_to_queue(&persist_q, &ctx->work);
+	}
+	k_mutex_unlock(&persist_lock);
+}
+
+// Write all unsaved values now and wait for them to finish. Call this
+// before a reboot. Safe to call from the shell thread.
+int zq3_persist_flush(zq3_persist_context *ctx) {
+	struct k_work_sync sync;
+	k_mutex_lock(&persist_lock, K_FOREVER);
+	k_work_flush(&ctx->work, &sync);
+	reconcile(ctx);
+	int n = take_batch(ctx, ZQ3_PERSIST_SYNC);
+	for (int i = 0; i < n; i++) {
+		write_one(ctx, &ctx->batch[i]);
+	}
+	int err = 0;
+	for (int i = 0; i < n; i++) {
+		err = err ? err : ctx->batch[i].err;
+	}
+	reconcile(ctx);
+	k_mutex_unlock(&persist_lock);
+	return err;
+}
+
+// Print pending values, flash write counts, and write latency
+void zq3_persist_print(zq3_persist_context *ctx) {
+	k_mutex_lock(&persist_lock, K_FOREVER);
+	int64_t now = k_uptime_get();
+	for (int i = 0; i < ctx->count; i++) {
+		zq3_persist_entry *e = &ctx->entries[i];
+		if (e->dirty) {
+			printk("%-12s '%s' unsaved for %d ms\n", e->key, e->value,
+				(int)(now - e->since));
+		} else {
+			printk("%-12s '%s' saved\n", e->key, e->value);
+		}
+	}
+	printk("Changes: %d (coalesced %d, reverted %d)\n", ctx->changes,
+		ctx->coalesced, ctx->reverted);
+	printk("Flushes:");
+	for (int r = 0; r < ZQ3_PERSIST_REASONS; r++) {
+		printk(" %s %d", reason_names[r], ctx->flushes[r]);
+	}
+	printk("\n");
+	uint32_t avg = ctx->writes ? (uint32_t)(ctx->total_us / ctx->writes) : 0;
+	printk("Flash writes: %d, errors %d (last %d us, avg %d us, max %d us)\n",
+		ctx->writes, ctx->errors, ctx->last_us, avg, ctx->max_us);
+	printk("Longest wait in RAM: %d ms (limit %d s)\n", ctx->max_age_ms,
+		CONFIG_ZQ3_PERSIST_DELAY_S);
+	k_mutex_unlock(&persist_lock);
+}
@@ -0,0 +1,78 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_PERSIST_H
+#define ZQ3_PERSIST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+
+#define ZQ3_PERSIST_KEY_MAX (16)    // longest key, with "zq3/" and NUL
+#define ZQ3_PERSIST_VALUE_MAX (16)  // longest value, with NUL
+
+// Why a batch of writes got flushed
+typedef enum {
+	ZQ3_PERSIST_TIMER,   // oldest change reached CONFIG_ZQ3_PERSIST_DELAY_S
+	ZQ3_PERSIST_IDLE,    // display went idle
+	ZQ3_PERSIST_SYNC,    // zq3_persist_flush() (before a reboot)
+	ZQ3_PERSIST_REASONS,
+} zq3_persist_reason;
+
+// One setting that gets written behind
+typedef struct {
+	char key[ZQ3_PERSIST_KEY_MAX];
+	char value[ZQ3_PERSIST_VALUE_MAX];   // newest value (RAM)
+	char saved[ZQ3_PERSIST_VALUE_MAX];   // value in flash (if known)
+	uint8_t len;
+	uint8_t saved_len;                   // 0 = not known
+	bool dirty;                          // value differs from flash
+	int64_t since;                       // uptime of the oldest unsaved change
+} zq3_persist_entry;
+
+// Copy of a write for the flash worker
+typedef struct {
+	int entry;
+	char value[ZQ3_PERSIST_VALUE_MAX];
+	uint8_t len;
+	int err;
+	uint32_t us;                         // how long settings_save_one took
+} zq3_persist_write;
+
+typedef struct {
+	zq3_persist_entry entries[CONFIG_ZQ3_PERSIST_KEYS];
+	int count;
+	zq3_persist_write batch[CONFIG_ZQ3_PERSIST_KEYS];
+	int batch_count;
+	atomic_t busy;                       // worker owns the batch
+	struct k_work work;
+	uint32_t changes;                    // calls to set with a new value
+	uint32_t coalesced;                  // changes that replaced unsaved ones
+	uint32_t reverted;                   // changes back to the flash value
+	uint32_t flushes[ZQ3_PERSIST_REASONS];
+	uint32_t writes;                     // successful flash writes
+	uint32_t errors;
+	uint32_t last_us;
+	uint32_t max_us;
+	uint64_t total_us;
+	uint32_t max_age_ms;                 // longest a change waited in RAM
+} zq3_persist_context;
+
+int zq3_persist_init(zq3_persist_context *ctx);
+
+int zq3_persist_set(zq3_persist_context *ctx, const char *key,
+	const char *value, int len);
+
+void zq3_persist_loaded(zq3_persist_context *ctx, const char *key,
+	const char *value, int len);
+
+void zq3_persist_poll(zq3_persist_context *ctx, bool idle);
+
+int zq3_persist_flush(zq3_persist_context *ctx);
+
+void zq3_persist_print(zq3_persist_context *ctx);
+
+
+#endif /* ZQ3_PERSIST_H */
@@ -0,0 +1,93 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Downsampling ring buffer for chart widgets
+ *
+ * A chart covers a fixed time window (e.g. the last hour) with a fixed number
+ * of columns. Each column is a bucket that keeps the min, max, and mean of
+ * the samples that arrived during its time span. This is similar to the M4
+ * aggregation that plotting tools use: it keeps the peaks that plain
+ * averaging would hide, while the cost per sample is just a few compares and
+ * an add.
+ *
+ * The lo/avg/hi arrays double as the chart's point arrays (the chart widget
+ * uses them directly with lv_chart_set_ext_y_array()), so there's only one
+ * copy of the data. The ready count tells the renderer how many columns are
+ * new since it last looked, so it can invalidate just those columns.
+ */
+
+#include <string.h>
+#include "zq3_series.h"
+
+
+static void bucket_reset(zq3_bucket *b) {
+	b->min = INT32_MAX;
+	b->max = INT32_MIN;
+	b->sum = 0;
+	b->n = 0;
+}
+
+void zq3_series_init(zq3_series *s, uint32_t window_s, int64_t now) {
+	for (int i = 0; i < CONFIG_ZQ3_CHART_COLUMNS; i++) {
+		s->lo[i] = ZQ3_SERIES_NONE;
+		s->avg[i] = ZQ3_SERIES_NONE;
+		s->hi[i] = ZQ3_SERIES_NONE;
+	}
+	s->head = 0;
+	s->ready = 0;
+	bucket_reset(&s->cur);
+	s->span_ms = (window_s * 1000) / CONFIG_ZQ3_CHART_COLUMNS;
+	if (s->span_ms == 0) {
+		s->span_ms = 1;
+	}
+	s->col_start = now;
+}
+
+// Move the current bucket into the ring and start a new one
+static void finish_column(zq3_series *s) {
+	zq3_bucket *b = &s->cur;
+	int i = s->head;
+	if (b->n == 0) {
+		s->lo[i] = ZQ3_SERIES_NONE;
+		s->avg[i] = ZQ3_SERIES_NONE;
+		s->hi[i] = ZQ3_SERIES_NONE;
+	} else {
+		s->lo[i] = b->min;
+		s->avg[i] = (int32_t)(b->sum / b->n);
+		s->hi[i] = b->max;
+	}
+	s->head = (i + 1) % CONFIG_ZQ3_CHART_COLUMNS;
+	if (s->ready < CONFIG_ZQ3_CHART_COLUMNS) {
+		s->ready++;
+	}
+	bucket_reset(b);
+	s->col_start += s->span_ms;
+}
+
+// Finish any columns whose time span is over. Call this periodically even
+// when no samples arrive, so the chart keeps scrolling (with gaps).
+void zq3_series_advance(zq3_series *s, int64_t now) {
+	// After a long gap, skip the columns that would all be empty anyway
+	int64_t full = (int64_t)s->span_ms * CONFIG_ZQ3_CHART_COLUMNS;
+	if (now - s->col_start > full) {
+		s->col_start = now - full;
+	}
+	while (now - s->col_start >= s->span_ms) {
+		finish_column(s);
+	}
+}
+
+// Add a sample to the current column
+void zq3_series_add(zq3_series *s, int32_t value, int64_t now) {
+	zq3_series_advance(s, now);
+	zq3_bucket *b = &s->cur;
+	if (value < b->min) {
+		b->min = value;
+	}
+	if (value > b->max) {
+		b->max = value;
+	}
+	b->sum += value;
+	b->n++;
+}
@@ -0,0 +1,44 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_SERIES_H
+#define ZQ3_SERIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// Value for columns with no samples (same as LVGL's LV_CHART_POINT_NONE)
+#define ZQ3_SERIES_NONE (INT32_MAX)
+
+// Running stats for the column that's being filled
+typedef struct {
+	int32_t min;
+	int32_t max;
+	int64_t sum;
+	uint32_t n;
+} zq3_bucket;
+
+// Time series ring buffer with one min/max/mean bucket per chart column.
+// Samples get folded into the current bucket, so memory and render cost
+// depend on the number of columns, not on how fast messages arrive.
+typedef struct {
+	int32_t lo[CONFIG_ZQ3_CHART_COLUMNS];   // column minimums
+	int32_t avg[CONFIG_ZQ3_CHART_COLUMNS];  // column means
+	int32_t hi[CONFIG_ZQ3_CHART_COLUMNS];   // column maximums
+	uint16_t head;         // ring index of the next column to finish
+	uint16_t ready;        // columns finished since the last render
+	zq3_bucket cur;        // bucket for the current column
+	uint32_t span_ms;      // time covered by one column
+	int64_t col_start;     // uptime (ms) when the current column started
+} zq3_series;
+
+void zq3_series_init(zq3_series *s, uint32_t window_s, int64_t now);
+
+void zq3_series_advance(zq3_series *s, int64_t now);
+
+void zq3_series_add(zq3_series *s, int32_t value, int64_t now);
+
+
+#endif /* ZQ3_SERIES_H */
@@ -0,0 +1,27 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_STATE_H
+#define ZQ3_STATE_H
+
+// This doesn't depend on Zephyr, so the host side fleet simulator (sim/)
+// can use the same states as the firmware.
+
+// Sequence of connection states from no-connectivity up to mqtt-ready-to-go.
+// See zq3_fsm.c for the transitions between them.
+typedef enum {
+	OFFLINE,   // waiting for button press to initiate wifi connection
+	WIFI_ERR,  // waiting for wifi error recovery (something went wrong)
+	WIFIWAIT,  // waiting for wifi to connect
+	MQTT_ERR,  // waiting for error recovery (something went wrong)
+	CONNECTING, // connect worker doing DNS, TCP, TLS, and MQTT CONNECT
+	CONNWAIT,  // waiting for MQTT CONNACK event
+	SUBWAIT,   // waiting for MQTT SUBACK
+	SYNCWAIT,  // waiting (with timeout) for broker to send current value
+	READY,     // task: respond to button pushes or publish events
+	ZQ3_STATES,
+} zq3_state;
+
+
+#endif /* ZQ3_STATE_H */
@@ -0,0 +1,126 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * TLS profiles: pinned cipher suite lists, plus a handshake benchmark
+ *
+ * A profile pins the list of cipher suites offered in the TLS ClientHello.
+ * The curves (and their order) come from which MBEDTLS_ECP_DP_* options are
+ * enabled at build time, because Zephyr's TLS sockets don't have an option
+ * to set them per connection. See the ZQ3_TLS_* options in app/Kconfig.
+ *
+ * Docs & Refs:
+ * zephyr/include/zephyr/net/mqtt.h  (struct mqtt_sec_config)
+ * mbedtls/include/mbedtls/ssl_ciphersuites.h
+ * https://docs.zephyrproject.org/latest/connectivity/networking/api/sockets.html
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/mqtt.h>
+#include <mbedtls/ssl_ciphersuites.h>
+#include "zq3_mqtt.h"
+#include "zq3_tls.h"
+
+LOG_MODULE_REGISTER(zq3_tls, CONFIG_ZQ3_TLS_LOG_LEVEL);
+
+
+typedef struct {
+	const char *name;     // value for the zq3/tls setting
+	const int *ciphers;   // cipher suite IDs, or NULL to let mbed TLS choose
+	uint32_t count;       // number of cipher suite IDs
+} zq3_tls_profile;
+
+// Adafruit IO has an RSA server cert, so it needs ECDHE-RSA. AES-128-GCM is
+// cheaper than the AES-256-GCM-SHA384 suite mbed TLS would otherwise pick.
+static const int rsa_ciphers[] = {
+	MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+};
+
+#if defined(CONFIG_ZQ3_TLS_ECDSA)
+// For a broker with a P-256 ECDSA cert (e.g. a local mosquitto), this skips
+// RSA signature verification entirely
+static const int ecdsa_ciphers[] = {
+	MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+};
+#endif
+
+static const zq3_tls_profile profiles[] = {
+	{"compat", NULL, 0},
+	{"rsa", rsa_ciphers, ARRAY_SIZE(rsa_ciphers)},
+#if defined(CONFIG_ZQ3_TLS_ECDSA)
+	{"ecdsa", ecdsa_ciphers, ARRAY_SIZE(ecdsa_ciphers)},
+#endif
+};
+#define PROFILE_COUNT (sizeof(profiles)/sizeof(profiles[0]))
+
+// Index of the current profile (starts with the Kconfig default)
+static int current = IS_ENABLED(CONFIG_ZQ3_TLS_PROFILE_RSA) ? 1 :
+	IS_ENABLED(CONFIG_ZQ3_TLS_PROFILE_ECDSA) ? 2 : 0;
+
+
+// Select a TLS profile by name (used for the zq3/tls setting)
+int zq3_tls_set_profile(const char *name) {
+	for (int i = 0; i < PROFILE_COUNT; i++) {
+		if (strcmp(profiles[i].name, name) == 0) {
+			current = i;
+			return 0;
+		}
+	}
+	LOG_ERR("unknown TLS profile '%s'", name);
+	return -EINVAL;
+}
+
+const char *zq3_tls_profile_name(void) {
+	return profiles[current].name;
+}
+
+// Apply the current profile to the MQTT client's TLS config
+void zq3_tls_apply(struct mqtt_sec_config *conf) {
+	conf->cipher_list = profiles[current].ciphers;
+	conf->cipher_count = profiles[current].count;
+}
+
+// Time full TLS handshakes for each profile. For meaningful numbers, point
+// the zq3/url setting at a local TLS mosquitto broker (rather than hammering
+// Adafruit IO) and disconnect first with `aio dn`. Each round does DNS,
+// TCP connect, TLS handshake and MQTT CONNECT, then disconnects. The timing
+// covers mqtt_connect() only (TCP + TLS + CONNECT), not DNS.
+//
+int zq3_tls_bench(zq3_mqtt_context *mctx, int rounds) {
+	if (!mctx->tls) {
+		printk("ERR: TLS benchmark needs an mqtts:// url\n");
+		return -EINVAL;
+	}
+	int saved = current;
+	for (int p = 0; p < PROFILE_COUNT; p++) {
+		current = p;
+		uint32_t min_ms = UINT32_MAX;
+		uint32_t max_ms = 0;
+		uint32_t total_ms = 0;
+		size_t peak = 0;
+		int ok = 0;
+		for (int r = 0; r < rounds; r++) {
+			if (zq3_mqtt_connect(mctx) != 0) {
+				continue;
+			}
+			uint32_t ms = mctx->connect_ms;
+			min_ms = MIN(min_ms, ms);
+			max_ms = MAX(max_ms, ms);
+			total_ms += ms;
+			peak = MAX(peak, mctx->tls_heap_peak);
+			ok++;
+			mqtt_abort(&mctx->client);
+		}
+		if (ok == 0) {
+			printk("%-7s: all %d handshakes failed\n", profiles[p].name,
+				rounds);
+			continue;
+		}
+		printk("%-7s: %d/%d ok, min %d ms, avg %d ms, max %d ms, "
+			"heap peak %d bytes\n", profiles[p].name, ok, rounds,
+			min_ms, total_ms / ok, max_ms, peak);
+	}
+	current = saved;
+	return 0;
+}
@@ -0,0 +1,21 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ZQ3_TLS_H
+#define ZQ3_TLS_H
+
+#include <zephyr/net/mqtt.h>  /* struct mqtt_sec_config */
+#include "zq3_mqtt.h"
+
+
+int zq3_tls_set_profile(const char *name);
+
+const char *zq3_tls_profile_name(void);
+
+void zq3_tls_apply(struct mqtt_sec_config *conf);
+
+int zq3_tls_bench(zq3_mqtt_context *mctx, int rounds);
+
+
+#endif /* ZQ3_TLS_H */
@@ -0,0 +1,24 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Status messages for the big center label. app/scripts/gen_assets.py reads
+ * the string literals in this file to decide which glyphs go in the status
+ * font, so any text shown with zq3_lvgl_show_message() belongs here.
+ */
+#ifndef ZQ3_UI_TEXT_H
+#define ZQ3_UI_TEXT_H
+
+
+#define ZQ3_MSG_LOADING     "Loading..."
+#define ZQ3_MSG_OFFLINE     "Press\nBOOT button\nto connect"
+#define ZQ3_MSG_WIFI_ERR    "Wifi Error\n(check settings)"
+#define ZQ3_MSG_CONNECTING  "Connecting..."
+#define ZQ3_MSG_RESOLVE     "Looking up\nbroker..."
+#define ZQ3_MSG_CREDS       "Loading\ncertificates..."
+#define ZQ3_MSG_OPEN        "Connecting\nto broker..."
+#define ZQ3_MSG_MQTT_ERR    "MQTT Error\n(check settings)"
+#define ZQ3_MSG_MQTT_RETRY  "MQTT Error\n(retrying...)"
+
+
+#endif /* ZQ3_UI_TEXT_H */
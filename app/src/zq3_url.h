@@ -5,10 +5,26 @@
 #ifndef ZQ3_URL_H
 #define ZQ3_URL_H
 
-#include "zq3_mqtt.h"
+#include <stdbool.h>
+#include <stdint.h>
 
 
-int zq3_url_parse(zq3_mqtt_context *mctx, const char *url);
+// Max length of each url field, including the NUL. These match the string
+// buffers in zq3_mqtt_context.
+#define ZQ3_URL_FIELD_MAX (48)
+
+// Fields of a broker url. This doesn't depend on Zephyr, so the host side
+// fleet simulator (sim/) uses the same parser as the firmware.
+typedef struct {
+	bool tls;                        // mqtts:// (true) or mqtt:// (false)
+	uint16_t port;                   // from host:port (0 = default)
+	char user[ZQ3_URL_FIELD_MAX];
+	char pass[ZQ3_URL_FIELD_MAX];
+	char host[ZQ3_URL_FIELD_MAX];
+	char topic[ZQ3_URL_FIELD_MAX];
+} zq3_url;
+
+int zq3_url_split(const char *url, zq3_url *out);
 
 
 #endif /* ZQ3_URL_H */
@@ -4,6 +4,28 @@
  *
  * Functions for managing the Wifi connection
  *
+ * The app can have credentials for several networks: zq3/ssid + zq3/psk,
+ * then zq3/ssid1 + zq3/psk1, and so on. To connect, it scans once, keeps the
+ * APs for known networks in a cache, and tries them best first. An AP's
+ * score is its RSSI, plus a bonus if it's the AP that worked last time for
+ * its network, minus a penalty for each failure in a row on that network.
+ * The connect request pins the AP's BSSID, channel, band, and security from
+ * the scan. If the connection fails, the next best AP gets a turn. Scan
+ * results stay fresh for CONFIG_ZQ3_WIFI_SCAN_CACHE_S, so a quick retry
+ * doesn't need another scan.
+ *
+ * While connected, the main loop checks the signal every
+ * CONFIG_ZQ3_WIFI_ROAM_CHECK_S. After two weak readings in a row (below
+ * CONFIG_ZQ3_WIFI_ROAM_RSSI), it scans in the background. If another AP for
+ * a known network is stronger by CONFIG_ZQ3_WIFI_ROAM_DELTA, the app roams
+ * to it instead of hanging on until the far AP drops the link.
+ *
+ * Net management events arrive in the net_mgmt thread. The callbacks here
+ * only record what happened, and zq3_wifi_poll() acts on it from the main
+ * loop. While a scan runs, the scan cache belongs to the net_mgmt thread,
+ * so the main loop leaves it alone until the scan is done. Shell commands
+ * go through zq3_wifi_request(), so they run in the main loop too.
+ *
  * Docs & Refs:
  * - https://github.com/zephyrproject-rtos/zephyr/blob/main/subsys/net/l2/wifi/wifi_shell.c
  * - https://docs.zephyrproject.org/latest/connectivity/networking/api/net_mgmt.html
@@ -13,67 +35,443 @@
  * - https://github.com/zephyrproject-rtos/zephyr/blob/main/include/zephyr/net/wifi.h
  */
 
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
 #include <zephyr/net/net_mgmt.h>   /* net_mgmt() */
 #include <zephyr/net/net_if.h>     /* net_if_get_wifi_sta() */
-#include <zephyr/net/wifi.h>       /* WIFI_SECURITY_TYPE_WPA_PSK, ... */
+#include <zephyr/net/wifi.h>       /* WIFI_SECURITY_TYPE_PSK, ... */
 #include <zephyr/net/wifi_mgmt.h>  /* NET_REQUEST_WIFI_CONNECT, ... */
+#include "zq3_wifi.h"
+
+LOG_MODULE_REGISTER(zq3_wifi, CONFIG_ZQ3_WIFI_LOG_LEVEL);
+
+
+// Weak signal checks in a row before scanning for a better AP
+#define WEAK_CHECKS (2)
 
 
-// Connect to the specified Wifi AP using WPA2-PSK
-int zq3_wifi_connect(const char *ssid, const char *psk) {
-	if (ssid == NULL || strlen(ssid) == 0) {
-		printk("ERR: Wifi connect: SSID not specified\n");
+void zq3_wifi_init(zq3_wifi_context *w) {
+	memset(w, 0, sizeof(*w));
+	w->current = -1;
+	w->roam_target = -1;
+	w->net = -1;
+}
+
+// Forget all credentials and the scan cache (before reloading settings)
+void zq3_wifi_clear(zq3_wifi_context *w) {
+	memset(w->nets, 0, sizeof(w->nets));
+	w->ap_count = 0;
+	w->scan_at = 0;
+}
+
+// Save an ssid or psk setting (key is ssid, psk, ssid1, psk1, ...)
+int zq3_wifi_set(zq3_wifi_context *w, const char *key, const char *value,
+	int len)
+{
+	bool is_ssid = strncmp("ssid", key, 4) == 0;
+	const char *suffix = key + (is_ssid ? 4 : 3);
+	int n = (*suffix == '\0') ? 0 : atoi(suffix);
+	if (n == 0 && *suffix != '\0') {
+		LOG_ERR("bad wifi key '%s'", key);
 		return -EINVAL;
 	}
-	if (psk == NULL || strlen(psk) == 0) {
-		printk("ERR: Wifi connect: PSK not specified\n");
-		return -EINVAL;
+	if (n < 0 || n >= CONFIG_ZQ3_WIFI_NETS) {
+		LOG_ERR("wifi network %d is too big (CONFIG_ZQ3_WIFI_NETS)",
+			n);
+		return -EDOM;
 	}
-	if (strlen(ssid) > WIFI_SSID_MAX_LEN) {
-		printk("ERR: Wifi connect: SSID is too long\n");
-		return -EINVAL;
+	char *dst = is_ssid ? w->nets[n].ssid : w->nets[n].psk;
+	size_t size = is_ssid ? sizeof(w->nets[n].ssid) : sizeof(w->nets[n].psk);
+	if (len >= size || (is_ssid && len > WIFI_SSID_MAX_LEN)) {
+		LOG_ERR("setting for '%s' is too long: %d", key, len);
+		return -EOVERFLOW;
+	}
+	memset(dst, 0, size);
+	memcpy(dst, value, len);
+	// New credentials may match APs that the cached scan skipped
+	w->scan_at = 0;
+	return 0;
+}
+
+static int score(zq3_wifi_context *w, const zq3_wifi_ap *ap) {
+	const zq3_wifi_net *net = &w->nets[ap->net];
+	int s = ap->rssi - net->fails * CONFIG_ZQ3_WIFI_SUCCESS_BONUS;
+	if (net->successes > 0 &&
+		memcmp(ap->bssid, net->good_bssid, WIFI_MAC_ADDR_LEN) == 0)
+	{
+		s += CONFIG_ZQ3_WIFI_SUCCESS_BONUS;
+	}
+	return s;
+}
+
+static int start_scan(zq3_wifi_context *w) {
+	if (w->scanning) {
+		return 0;   // zq3_wifi_poll() uses its results when it's done
+	}
+	struct wifi_scan_params params = {0};
+	struct net_if *i = net_if_get_wifi_sta();
+	w->ap_count = 0;
+	w->scan_done = false;
+	w->scanning = true;
+	int err = net_mgmt(NET_REQUEST_WIFI_SCAN, i, &params, sizeof(params));
+	if (err) {
+		w->scanning = false;
+		LOG_ERR("Wifi scan: net_mgmt() = %d", err);
+	} else {
+		LOG_INF("[Wifi SCAN requested]");
 	}
+	return err;
+}
+
+// Ask the driver to connect to one AP from the scan cache
+static int request_connect(zq3_wifi_context *w, int idx) {
+	const zq3_wifi_ap *ap = &w->aps[idx];
+	const zq3_wifi_net *net = &w->nets[ap->net];
 	// References for wifi_connect_req_params:
 	// - zephyr/include/zephyr/net/wifi.h        (enums)
 	// - zephyr/include/zephyr/net/wifi_mgmt.h   (struct def)
 	// - zephyr/samples/net/l2/wifi/wifi_shell.c (default values)
 	struct wifi_connect_req_params params = {
-		.ssid = ssid,
-		.ssid_length = strlen(ssid),
-		.psk = psk,
-		.psk_length = strlen(psk),
-		.band = WIFI_FREQ_BAND_2_4_GHZ,         // enum wifi_frequency_bands
-		.channel = WIFI_CHANNEL_ANY,
-		.security = WIFI_SECURITY_TYPE_PSK,     // enum wifi_security_type
+		.ssid = net->ssid,
+		.ssid_length = strlen(net->ssid),
+		.psk = net->psk,
+		.psk_length = strlen(net->psk),
+		.band = ap->band,                       // enum wifi_frequency_bands
+		.channel = ap->channel,
+		.security = ap->security,               // enum wifi_security_type
 		.mfp = WIFI_MFP_OPTIONAL,
 		.eap_ver = 1,
 		.ignore_broadcast_ssid = 0,
 		.bandwidth = WIFI_FREQ_BANDWIDTH_20MHZ, // wifi_frequency_bandwidths
 		.verify_peer_cert = false,
 	};
+	memcpy(params.bssid, ap->bssid, WIFI_MAC_ADDR_LEN);
+	w->current = idx;
 	struct net_if *i = net_if_get_wifi_sta();
 	int err = net_mgmt(NET_REQUEST_WIFI_CONNECT, i, &params, sizeof(params));
 	if (err) {
-		printk("ERR: Wifi connect: net_mgmt() = %d\n", err);
+		LOG_ERR("Wifi connect: net_mgmt() = %d", err);
 	} else {
-		printk("[Wifi CONNECT requested]\n");
+		LOG_INF("[Wifi CONNECT requested: %s ch %d, %d dBm]", net->ssid,
+			ap->channel, ap->rssi);
 	}
 	return err;
 }
 
-// Disconnect from Wifi
-int zq3_wifi_disconnect() {
+// Connect to the best AP that hasn't been tried since the last scan
+static int try_next(zq3_wifi_context *w) {
+	if (w->scanning) {
+		return 0;   // zq3_wifi_poll() tries again when the scan is done
+	}
+	while (1) {
+		int best = -1;
+		for (int i = 0; i < w->ap_count; i++) {
+			if (!w->aps[i].tried &&
+				(best < 0 || score(w, &w->aps[i]) > score(w, &w->aps[best])))
+			{
+				best = i;
+			}
+		}
+		if (best < 0) {
+			LOG_ERR("Wifi connect: no more APs to try");
+			w->current = -1;
+			return -ENETUNREACH;
+		}
+		w->aps[best].tried = true;
+		if (request_connect(w, best) == 0) {
+			return 0;
+		}
+		w->nets[w->aps[best].net].fails++;
+	}
+}
+
+// Start connecting to the best known network (uses the cached scan results
+// if they're fresh, otherwise scans first)
+int zq3_wifi_connect(zq3_wifi_context *w) {
+	bool have_creds = false;
+	for (int i = 0; i < CONFIG_ZQ3_WIFI_NETS; i++) {
+		have_creds |= strlen(w->nets[i].ssid) > 0;
+	}
+	if (!have_creds) {
+		LOG_ERR("Wifi connect: SSID not specified");
+		return -EINVAL;
+	}
+	w->want = true;
+	w->failed = false;
+	w->dropped = false;
+	w->roam_target = -1;
+	if (w->scanning) {
+		return 0;   // connect when the scan is done
+	}
+	for (int i = 0; i < w->ap_count; i++) {
+		w->aps[i].tried = false;
+	}
+	int64_t age = k_uptime_get() - w->scan_at;
+	if (w->scan_at > 0 && w->ap_count > 0 &&
+		age < CONFIG_ZQ3_WIFI_SCAN_CACHE_S * 1000)
+	{
+		LOG_INF("Using cached Wifi scan (%d s old)", (int)(age / 1000));
+		return try_next(w);
+	}
+	return start_scan(w);
+}
+
+// Disconnect from Wifi (and stay disconnected)
+int zq3_wifi_disconnect(zq3_wifi_context *w) {
+	w->want = false;
+	w->roam_target = -1;
 	struct net_if *i = net_if_get_wifi_sta();
 	int err = net_mgmt(NET_REQUEST_WIFI_DISCONNECT, i, NULL, 0);
 	switch (err) {
 	case 0:
-		printk("[Wifi DISCONNECT requested]\n");
+		LOG_INF("[Wifi DISCONNECT requested]");
 		return 0;
 	case -EALREADY:
-		printk("Wifi disconnect: already disconnected\n");
+		LOG_INF("Wifi disconnect: already disconnected");
 		return 0;
 	default:
-		printk("ERR: Wifi disconnect: net_mgmt() = %d\n", err);
+		LOG_ERR("Wifi disconnect: net_mgmt() = %d", err);
 		return err;
 	}
 }
+
+// Ask the main loop to connect (ZQ3_WIFI_REQ_UP) or disconnect
+// (ZQ3_WIFI_REQ_DOWN). This is for other threads, like the shell.
+void zq3_wifi_request(zq3_wifi_context *w, int req) {
+	atomic_set(&w->request, req);
+}
+
+// Leave the current AP for the one zq3_wifi_poll() picked. The connection
+// to the new AP starts once the disconnect event arrives.
+int zq3_wifi_roam(zq3_wifi_context *w) {
+	struct net_if *i = net_if_get_wifi_sta();
+	LOG_INF("Wifi roaming: %d dBm -> %d dBm", w->rssi,
+		w->aps[w->roam_target].rssi);
+	w->roams++;
+	int err = net_mgmt(NET_REQUEST_WIFI_DISCONNECT, i, NULL, 0);
+	if (err) {
+		LOG_ERR("Wifi roam: net_mgmt() = %d", err);
+		w->roam_target = -1;
+	}
+	return err;
+}
+
+// Check the signal and start a background scan if it stays weak
+static void check_signal(zq3_wifi_context *w) {
+	struct wifi_iface_status status = {0};
+	struct net_if *i = net_if_get_wifi_sta();
+	w->check_at = k_uptime_get() + CONFIG_ZQ3_WIFI_ROAM_CHECK_S * 1000;
+	int err = net_mgmt(NET_REQUEST_WIFI_IFACE_STATUS, i, &status,
+		sizeof(status));
+	if (err || status.state < WIFI_STATE_ASSOCIATED) {
+		return;
+	}
+	w->rssi = status.rssi;
+	if (status.rssi >= CONFIG_ZQ3_WIFI_ROAM_RSSI) {
+		w->weak = 0;
+		return;
+	}
+	w->weak++;
+	if (w->weak >= WEAK_CHECKS && !w->scanning) {
+		LOG_INF("Wifi signal weak (%d dBm), looking for a better AP",
+			status.rssi);
+		w->weak = 0;
+		start_scan(w);
+	}
+}
+
+// Pick an AP that's enough stronger than the current one, if there is one
+static int roam_candidate(zq3_wifi_context *w) {
+	int best = -1;
+	for (int i = 0; i < w->ap_count; i++) {
+		const zq3_wifi_ap *ap = &w->aps[i];
+		if (memcmp(ap->bssid, w->bssid, WIFI_MAC_ADDR_LEN) == 0) {
+			continue;
+		}
+		if (ap->rssi >= w->rssi + CONFIG_ZQ3_WIFI_ROAM_DELTA &&
+			(best < 0 || score(w, ap) > score(w, &w->aps[best])))
+		{
+			best = i;
+		}
+	}
+	return best;
+}
+
+// Act on scan and connection events. The main loop calls this each time
+// around. It returns ZQ3_WIFI_ROAM when it's time to roam, or a negative
+// error when every AP has failed.
+int zq3_wifi_poll(zq3_wifi_context *w) {
+	switch (atomic_set(&w->request, 0)) {
+	case ZQ3_WIFI_REQ_UP:
+		zq3_wifi_connect(w);
+		return 0;
+	case ZQ3_WIFI_REQ_DOWN:
+		zq3_wifi_disconnect(w);
+		return 0;
+	}
+	if (w->scan_done) {
+		w->scan_done = false;
+		LOG_INF("Wifi scan: %d APs for known networks", w->ap_count);
+		if (w->connected) {
+			w->roam_target = roam_candidate(w);
+			return (w->roam_target >= 0) ? ZQ3_WIFI_ROAM : 0;
+		}
+		return w->want ? try_next(w) : 0;
+	}
+	if (w->failed) {
+		w->failed = false;
+		return w->want ? try_next(w) : 0;
+	}
+	if (w->dropped) {
+		w->dropped = false;
+		if (w->roam_target >= 0) {
+			int idx = w->roam_target;
+			w->roam_target = -1;
+			w->aps[idx].tried = true;
+			if (request_connect(w, idx) == 0) {
+				return 0;
+			}
+		}
+		if (!w->want) {
+			return 0;
+		}
+		// The old AP may be gone, so look at what's around now
+		return zq3_wifi_connect(w);
+	}
+	if (w->connected && k_uptime_get() >= w->check_at) {
+		check_signal(w);
+	}
+	return 0;
+}
+
+// Add an AP from a scan to the cache if it belongs to a known network. When
+// the cache is full, a stronger AP replaces the weakest one. (net_mgmt thread)
+void zq3_wifi_scan_result(zq3_wifi_context *w,
+	const struct wifi_scan_result *r)
+{
+	int net = -1;
+	for (int i = 0; i < CONFIG_ZQ3_WIFI_NETS; i++) {
+		const char *ssid = w->nets[i].ssid;
+		if (strlen(ssid) > 0 && strlen(ssid) == r->ssid_length &&
+			memcmp(ssid, r->ssid, r->ssid_length) == 0)
+		{
+			net = i;
+			break;
+		}
+	}
+	// Skip results of scans we didn't ask for (like from the wifi shell)
+	if (!w->scanning || net < 0 || r->mac_length != WIFI_MAC_ADDR_LEN) {
+		return;
+	}
+	int idx = w->ap_count;
+	if (idx >= CONFIG_ZQ3_WIFI_SCAN_MAX) {
+		idx = 0;
+		for (int i = 1; i < w->ap_count; i++) {
+			if (w->aps[i].rssi < w->aps[idx].rssi) {
+				idx = i;
+			}
+		}
+		if (w->aps[idx].rssi >= r->rssi) {
+			return;
+		}
+	} else {
+		w->ap_count++;
+	}
+	zq3_wifi_ap *ap = &w->aps[idx];
+	memcpy(ap->bssid, r->mac, WIFI_MAC_ADDR_LEN);
+	ap->rssi = r->rssi;
+	ap->channel = r->channel;
+	ap->band = r->band;
+	ap->security = r->security;
+	ap->net = net;
+	ap->tried = false;
+}
+
+// Scan finished (net_mgmt thread)
+void zq3_wifi_scan_done(zq3_wifi_context *w) {
+	if (!w->scanning) {
+		return;   // not our scan
+	}
+	w->scan_at = k_uptime_get();
+	w->scanning = false;
+	w->scan_done = true;
+}
+
+// Record the result of a connect request. This returns true if the
+// connection worked. (net_mgmt thread)
+bool zq3_wifi_connect_result(zq3_wifi_context *w, int status) {
+	int idx = w->current;
+	zq3_wifi_net *net = (idx >= 0) ? &w->nets[w->aps[idx].net] : NULL;
+	if (status != 0) {
+		w->connected = false;
+		if (net) {
+			net->fails++;
+		}
+		w->failed = true;
+		return false;
+	}
+	w->connected = true;
+	w->weak = 0;
+	w->check_at = k_uptime_get() + CONFIG_ZQ3_WIFI_ROAM_CHECK_S * 1000;
+	if (net) {
+		net->successes++;
+		net->fails = 0;
+		memcpy(net->good_bssid, w->aps[idx].bssid, WIFI_MAC_ADDR_LEN);
+		memcpy(w->bssid, w->aps[idx].bssid, WIFI_MAC_ADDR_LEN);
+		w->rssi = w->aps[idx].rssi;
+		w->net = w->aps[idx].net;
+	}
+	return true;
+}
+
+// Record a disconnect. This returns true if the manager is going to
+// reconnect by itself (after a drop or to roam). (net_mgmt thread)
+bool zq3_wifi_disconnected(zq3_wifi_context *w) {
+	bool was_connected = w->connected;
+	w->connected = false;
+	w->net = -1;
+	memset(w->bssid, 0, sizeof(w->bssid));
+	// A failed connect attempt may also send a disconnect, but the connect
+	// result already covers that
+	if (was_connected) {
+		if (w->roam_target < 0) {
+			// Unexpected drops make the cached scan suspect
+			w->scan_at = 0;
+		}
+		w->dropped = true;
+	}
+	return w->want;
+}
+
+// Print known networks, the connection, and scored APs from the scan cache
+void zq3_wifi_print(zq3_wifi_context *w) {
+	for (int i = 0; i < CONFIG_ZQ3_WIFI_NETS; i++) {
+		const zq3_wifi_net *net = &w->nets[i];
+		if (strlen(net->ssid) == 0) {
+			continue;
+		}
+		printk("%c %d: %s (%d ok, %d failed in a row)\n",
+			(i == w->net) ? '*' : ' ', i, net->ssid, net->successes,
+			net->fails);
+	}
+	if (w->connected) {
+		printk("Connected: %d dBm, %d roams\n", w->rssi, w->roams);
+	}
+	if (w->scan_at == 0) {
+		printk("No cached scan\n");
+		return;
+	}
+	printk("Scan cache (%d s old):\n",
+		(int)((k_uptime_get() - w->scan_at) / 1000));
+	for (int i = 0; i < w->ap_count; i++) {
+		const zq3_wifi_ap *ap = &w->aps[i];
+		const uint8_t *m = ap->bssid;
+		bool cur = w->connected &&
+			memcmp(m, w->bssid, WIFI_MAC_ADDR_LEN) == 0;
+		printk("%c %02x:%02x:%02x:%02x:%02x:%02x %s ch %3d %4d dBm "
+			"score %4d\n", cur ? '*' : ' ', m[0], m[1], m[2], m[3], m[4],
+			m[5], w->nets[ap->net].ssid, ap->channel, ap->rssi,
+			score(w, ap));
+	}
+}
@@ -6,10 +6,89 @@
 #ifndef ZQ3_WIFI_H
 #define ZQ3_WIFI_H
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/net/wifi_mgmt.h>
+#include <zephyr/sys/atomic.h>
 
-int zq3_wifi_connect(const char *ssid, const char *psk);
 
-int zq3_wifi_disconnect();
+// Credentials for one network (zq3/ssid + zq3/psk, zq3/ssid1 + zq3/psk1, ...)
+typedef struct {
+	char ssid[33];
+	char psk[65];
+	uint8_t good_bssid[WIFI_MAC_ADDR_LEN]; // AP that worked last time
+	uint16_t successes;    // connections that worked (since boot)
+	uint16_t fails;        // connection failures in a row
+} zq3_wifi_net;
+
+// One access point from the cached scan results
+typedef struct {
+	uint8_t bssid[WIFI_MAC_ADDR_LEN];
+	int8_t rssi;
+	uint8_t channel;
+	uint8_t band;          // enum wifi_frequency_bands
+	uint8_t security;      // enum wifi_security_type
+	uint8_t net;           // index into nets[]
+	bool tried;            // already tried since the last scan
+} zq3_wifi_ap;
+
+typedef struct {
+	zq3_wifi_net nets[CONFIG_ZQ3_WIFI_NETS];
+	zq3_wifi_ap aps[CONFIG_ZQ3_WIFI_SCAN_MAX];
+	volatile int ap_count;  // the net_mgmt thread owns aps while scanning
+	int64_t scan_at;       // uptime of the last scan (0 = no cache)
+	int current;           // index into aps[] being connected (-1 = none)
+	int roam_target;       // index into aps[] to roam to (-1 = none)
+	uint8_t bssid[WIFI_MAC_ADDR_LEN]; // AP we're connected to
+	int net;               // index into nets[] we're connected to
+	bool want;             // stay connected (reconnect after drops)
+	bool connected;
+	volatile bool scanning;
+	volatile bool scan_done;
+	volatile bool failed;  // connect attempt failed
+	volatile bool dropped; // lost the connection (or roaming)
+	int64_t check_at;      // uptime of the next signal check
+	int8_t rssi;           // signal strength from the last check
+	uint8_t weak;          // signal checks in a row below the roam threshold
+	uint32_t roams;        // count of roams to a better AP
+	atomic_t request;      // connect or disconnect for the shell
+} zq3_wifi_context;
+
+// zq3_wifi_poll() result meaning it's time to roam to a better AP (drop
+// the MQTT connection, then call zq3_wifi_roam())
+#define ZQ3_WIFI_ROAM (1)
+
+// zq3_wifi_request() values
+#define ZQ3_WIFI_REQ_UP (1)
+#define ZQ3_WIFI_REQ_DOWN (2)
+
+void zq3_wifi_init(zq3_wifi_context *w);
+
+void zq3_wifi_clear(zq3_wifi_context *w);
+
+int zq3_wifi_set(zq3_wifi_context *w, const char *key, const char *value,
+	int len);
+
+int zq3_wifi_connect(zq3_wifi_context *w);
+
+int zq3_wifi_disconnect(zq3_wifi_context *w);
+
+void zq3_wifi_request(zq3_wifi_context *w, int req);
+
+int zq3_wifi_roam(zq3_wifi_context *w);
+
+int zq3_wifi_poll(zq3_wifi_context *w);
+
+void zq3_wifi_scan_result(zq3_wifi_context *w,
+	const struct wifi_scan_result *r);
+
+void zq3_wifi_scan_done(zq3_wifi_context *w);
+
+bool zq3_wifi_connect_result(zq3_wifi_context *w, int status);
+
+bool zq3_wifi_disconnected(zq3_wifi_context *w);
+
+void zq3_wifi_print(zq3_wifi_context *w);
 
 
 #endif /* ZQ3_WIFI_H */
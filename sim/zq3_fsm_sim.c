@@ -0,0 +1,762 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Deterministic simulation bench for the connection state machine
+ *
+ * This runs the firmware's zq3_fsm.c against fake wifi, connect worker, and
+ * broker hooks on a virtual clock. Nothing sleeps and nothing touches the
+ * network, so thousands of runs take a few seconds, and a run depends only
+ * on its seed.
+ *
+ * Each run presses the button at t=0, then throws disruptions at the state
+ * machine at random times: wifi drops and roams, broker disconnects, button
+ * presses, failbacks, and `aio dn` + `aio up`. Replies from the fake broker
+ * take random times (in 10 ms steps, so events often land at the same time)
+ * and can get lost. Events due at the same time run in random order. After
+ * the disruptions stop, a pretend user presses the button whenever the
+ * device is stuck waiting for one.
+ *
+ * For each scenario this reports the time from the first press to READY,
+ * and the time from the last disruption back to READY (p50, p90, p99,
+ * max). It also checks some rules on every step:
+ *
+ *   - no touching the MQTT client while the connect worker owns it
+ *   - no new connection while the old one is still open
+ *   - no SUBSCRIBE unless waiting for CONNACK on an open connection
+ *   - no READY without a live connection
+ *   - the state machine's event queue never overflows
+ *   - something is always about to happen until READY (a reply, a timer,
+ *     or the user's press), and READY comes back within a few connect
+ *     attempts after the disruptions stop
+ *
+ * Seeds that break a rule get listed. Replay one with a trace of every
+ * event and state change: zq3_fsm_sim -c <scenario> -s <seed> -v
+ *
+ * Usage: zq3_fsm_sim [-n runs] [-c scenario] [-s seed] [-v]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "zq3_fsm.h"
+
+
+#define BROKER_TIMEOUT_MS (10000)  // CONFIG_ZQ3_BROKER_TIMEOUT_MS
+#define SYNC_TIMEOUT_MS   (1500)   // CONFIG_ZQ3_SYNC_TIMEOUT_MS
+#define BACKOFF_MAX_MS    (60000)  // like zq3_broker.c
+#define BROKERS           (3)
+#define RECOVER_TRIES     (30)     // READY must be back within this many
+#define RECOVER_LIMIT_MS  (3600000) // or this long
+#define PENDING_MAX       (64)
+#define SHOW_FAILS        (10)
+
+// Things the fake world does later
+typedef enum {
+	W_WIFI_UP,      // wifi connected (arg: wifi generation)
+	W_WIFI_DOWN,    // wifi dropped after a roam (arg: wifi generation)
+	W_CONN_DONE,    // connect worker finished (arg: job)
+	W_CONNACK,      // arg: connection generation
+	W_SUBACK,
+	W_VALUE,
+	W_DISRUPT,      // arg: which disruption
+	W_MQTT_UP,      // second half of `aio dn` + `aio up`
+} world_kind;
+
+// Disruptions
+enum { D_WIFI_DOWN, D_ROAM, D_WIFI_FAIL, D_BROKER_DROP, D_PRESS, D_FAILBACK,
+	D_SHELL, D_KINDS };
+
+static const char *const disrupt_names[D_KINDS] = {
+	"wifi down", "roam", "wifi fail", "broker drop", "press", "failback",
+	"aio dn+up",
+};
+
+typedef struct {
+	int64_t at;
+	uint64_t order;     // random tie breaker for events at the same time
+	world_kind kind;
+	int arg;
+} world_event;
+
+typedef struct {
+	const char *name;
+	int disrupt_s;         // disruptions happen in the first disrupt_s
+	int gap_ms;            // mean time between disruptions
+	int weight[D_KINDS];   // how likely each disruption is
+	int conn_fail;         // % of connect attempts that fail
+	int lost;              // % of broker replies that never come
+	int session;           // % of CONNACKs with session present
+} scenario;
+
+static const scenario scenarios[] = {
+	{"clean", 0, 0, {0}, 0, 0, 50},
+	{"lossy", 0, 0, {0}, 20, 20, 50},
+	{"wifi-flaps", 60, 4000, {4, 4, 1, 0, 0, 0, 0}, 5, 5, 50},
+	{"broker-drops", 60, 3000, {0, 0, 0, 4, 1, 2, 1}, 10, 10, 50},
+	{"chaos", 60, 1500, {3, 3, 1, 3, 3, 2, 2}, 20, 20, 50},
+	{"chaos-fast", 30, 200, {3, 3, 1, 3, 3, 2, 2}, 20, 20, 50},
+};
+#define SCENARIOS ((int)(sizeof(scenarios) / sizeof(scenarios[0])))
+
+typedef struct {
+	double *v;
+	size_t n, cap;
+} samples;
+
+// One run: the fake world around one state machine
+static struct {
+	const scenario *sc;
+	zq3_fsm fsm;
+	uint64_t rng;
+	bool verbose;
+	int64_t now;
+	world_event pending[PENDING_MAX];
+	int count;
+	// Wifi
+	bool wifi_up;
+	bool wifi_joining;
+	int wifi_gen;
+	// Connect worker and broker connection
+	int job;               // latest connect attempt
+	int done;              // latest one the worker finished
+	bool worker_cancel;
+	bool conn_open;
+	bool conn_dead;        // open, but wifi dropped under it
+	int conn_gen;
+	int broker;
+	int failures;
+	bool subscribed[BROKERS]; // broker's session has our topics
+	int sub_broker;        // broker of the last SUBACK (firmware's hash)
+	int sync_gen;          // connection that got asked for current values
+	// Toggle
+	bool publish_pending;
+	bool toggle;
+	// Results
+	int64_t first_ready;   // -1 = not yet
+	int64_t ready_at;      // last time READY was entered
+	int64_t last_disrupt;
+	int user_presses;
+	int tries;             // connect attempts after the disruptions
+	char fail[96];
+} w;
+
+
+/*
+* RANDOM NUMBERS (xorshift64*, so runs replay the same on every host)
+*/
+
+static uint32_t rnd(void) {
+	w.rng ^= w.rng >> 12;
+	w.rng ^= w.rng << 25;
+	w.rng ^= w.rng >> 27;
+	return (uint32_t)((w.rng * 2685821657736338717ULL) >> 32);
+}
+
+static bool chance(int percent) {
+	return (int)(rnd() % 100) < percent;
+}
+
+// Random latency from lo to hi ms, in 10 ms steps
+static int64_t latency(int lo, int hi) {
+	return lo + (rnd() % ((hi - lo) / 10 + 1)) * 10;
+}
+
+
+/*
+* WORLD EVENTS
+*/
+
+static void trace(const char *fmt, const char *a, const char *b) {
+	if (w.verbose) {
+		printf("%8.2f  ", w.now / 1000.0);
+		printf(fmt, a, b);
+		printf("\n");
+	}
+}
+
+static void fail(const char *msg) {
+	if (w.fail[0] == '\0') {
+		snprintf(w.fail, sizeof(w.fail), "%.2f s: %s in %s", w.now / 1000.0,
+			msg, zq3_fsm_state_name(w.fsm.state));
+	}
+	trace("RULE BROKEN: %s%s", msg, "");
+}
+
+static void later(int64_t delay, world_kind kind, int arg) {
+	if (w.count == PENDING_MAX) {
+		fail("world event list full");
+		return;
+	}
+	w.pending[w.count++] = (world_event){
+		.at = w.now + delay,
+		.order = ((uint64_t)rnd() << 32) | rnd(),
+		.kind = kind,
+		.arg = arg,
+	};
+}
+
+// Index of the next world event (-1 = none)
+static int next_event(void) {
+	int best = -1;
+	for (int i = 0; i < w.count; i++) {
+		world_event *e = &w.pending[i];
+		if (best < 0 || e->at < w.pending[best].at ||
+			(e->at == w.pending[best].at &&
+			e->order < w.pending[best].order))
+		{
+			best = i;
+		}
+	}
+	return best;
+}
+
+static void send(zq3_fsm_event ev, int arg) {
+	zq3_state from = w.fsm.state;
+	bool handled = zq3_fsm_dispatch(&w.fsm, ev, arg, w.now);
+	if (!handled && w.fsm.state == from) {
+		trace("  %s ignored%s", zq3_fsm_event_name(ev), "");
+	}
+}
+
+// The broker connection closed. Like mqtt_abort(), this sends DISCONNECT
+// right away, from inside whatever action closed it.
+static void close_conn(bool event) {
+	if (!w.conn_open) {
+		return;
+	}
+	w.conn_open = false;
+	w.conn_dead = false;
+	w.conn_gen++;
+	if (event) {
+		trace("  DISCONNECT%s%s", "", "");
+		send(ZQ3_EV_MQTT_ERR, 0);
+	}
+}
+
+// Wifi dropped. Nothing tells the MQTT client: the socket stays open, but
+// nothing more comes from the broker on it until somebody aborts it.
+static void lose_conn(void) {
+	w.conn_gen++;
+	w.conn_dead = w.conn_open;
+}
+
+// Broker replies only count on the connection they were sent on
+static void reply(world_kind kind) {
+	if (!chance(w.sc->lost)) {
+		later(latency(20, 400), kind, w.conn_gen);
+	}
+}
+
+
+/*
+* FAKE HOOKS (stand-ins for the ones in main.c)
+*/
+
+static int op_wifi_connect(void *arg) {
+	if (!w.wifi_up && !w.wifi_joining) {
+		w.wifi_joining = true;
+		later(latency(500, 3000), W_WIFI_UP, w.wifi_gen);
+	}
+	return 0;
+}
+
+static bool worker_busy(void) {
+	return w.done != w.job;
+}
+
+// Main loop code must leave the MQTT client alone while the worker has it
+static void check_owner(void) {
+	if (worker_busy()) {
+		fail("MQTT client touched while the worker owns it");
+	}
+}
+
+// Like zq3_conn_start(), a new attempt supersedes one that's still running
+static void op_connect(void *arg) {
+	if (w.now >= w.sc->disrupt_s * 1000LL && ++w.tries > RECOVER_TRIES) {
+		fail("READY didn't come back");
+	}
+	if (w.conn_open) {
+		fail("new connection while the old one is still open");
+	}
+	w.job++;
+	w.worker_cancel = false;
+	later(latency(100, 1500), W_CONN_DONE, w.job);
+}
+
+static void op_cancel(void *arg) {
+	if (worker_busy()) {
+		w.worker_cancel = true;
+	}
+}
+
+static void op_drop(void *arg) {
+	if (worker_busy()) {
+		op_cancel(arg);
+	} else {
+		close_conn(true);
+	}
+}
+
+static void op_disconnect(void *arg) {
+	check_owner();
+	close_conn(true);
+}
+
+static void op_first_broker(void *arg) {
+	w.broker = 0;
+}
+
+static int64_t op_failover(void *arg) {
+	if (w.conn_open) {
+		fail("failover with the old connection still open");
+	}
+	w.broker = (w.broker + 1) % BROKERS;
+	int64_t delay = 1000LL << (w.failures < 6 ? w.failures : 6);
+	w.failures++;
+	return delay < BACKOFF_MAX_MS ? delay : BACKOFF_MAX_MS;
+}
+
+// Like the firmware, trust a kept session only if the last SUBACK came
+// from the same broker
+static bool op_subscribed(void *arg) {
+	return w.sub_broker == w.broker;
+}
+
+static int op_subscribe(void *arg, bool resumed) {
+	check_owner();
+	if (w.fsm.state != CONNWAIT || !w.conn_open) {
+		fail("SUBSCRIBE without a new connection");
+	}
+	if (!resumed) {
+		w.sub_broker = -1;
+		reply(W_SUBACK);
+	}
+	return 0;
+}
+
+static int op_sync(void *arg, bool get_toggle) {
+	w.sync_gen = w.conn_gen;
+	if (get_toggle) {
+		reply(W_VALUE);
+	}
+	return 0;
+}
+
+static bool op_pending(void *arg) {
+	return w.publish_pending;
+}
+
+static void op_toggle(void *arg) {
+	w.toggle = !w.toggle;
+	w.publish_pending = true;
+}
+
+static void op_entered(void *arg, zq3_state from, zq3_state to) {
+	trace("  [%s] -> [%s]", zq3_fsm_state_name(from), zq3_fsm_state_name(to));
+	if (to != READY) {
+		return;
+	}
+	if (!w.conn_open || w.conn_dead) {
+		fail("READY without a live connection");
+	}
+	if (!w.subscribed[w.broker]) {
+		fail("READY without a subscription on this broker");
+	}
+	if (w.sync_gen != w.conn_gen) {
+		fail("READY without asking for current values");
+	}
+	w.failures = 0;
+	w.ready_at = w.now;
+	if (w.first_ready < 0) {
+		w.first_ready = w.now;
+	}
+}
+
+static const zq3_fsm_ops ops = {
+	.wifi_connect = op_wifi_connect,
+	.connect = op_connect,
+	.cancel = op_cancel,
+	.drop = op_drop,
+	.disconnect = op_disconnect,
+	.first_broker = op_first_broker,
+	.failover = op_failover,
+	.subscribed = op_subscribed,
+	.subscribe = op_subscribe,
+	.sync = op_sync,
+	.pending = op_pending,
+	.toggle = op_toggle,
+	.entered = op_entered,
+};
+
+
+/*
+* ONE RUN
+*/
+
+static void disrupt(int d) {
+	w.last_disrupt = w.now;
+	trace("disrupt: %s%s", disrupt_names[d], "");
+	switch (d) {
+	case D_WIFI_DOWN:
+		if (w.wifi_up) {
+			w.wifi_up = false;
+			w.wifi_gen++;
+			lose_conn();
+			send(ZQ3_EV_WIFI_DOWN, 0);
+			w.wifi_joining = true;
+			later(latency(500, 5000), W_WIFI_UP, w.wifi_gen);
+		}
+		break;
+	case D_ROAM:
+		// Like the main loop: ROAM, then the wifi manager's disconnect and
+		// reconnect events
+		if (w.wifi_up) {
+			send(ZQ3_EV_ROAM, 0);
+			later(10, W_WIFI_DOWN, w.wifi_gen);
+		}
+		break;
+	case D_WIFI_FAIL:
+		w.wifi_up = false;
+		w.wifi_joining = false;
+		w.wifi_gen++;
+		lose_conn();
+		send(ZQ3_EV_WIFI_FAIL, 0);
+		break;
+	case D_BROKER_DROP:
+		close_conn(true);
+		break;
+	case D_PRESS:
+		send(ZQ3_EV_PRESS, 0);
+		break;
+	case D_FAILBACK:
+		// The main loop only asks when READY on a fallback broker
+		if (w.fsm.state == READY && w.broker != 0) {
+			send(ZQ3_EV_FAILBACK, 0);
+		}
+		break;
+	case D_SHELL:
+		send(ZQ3_EV_MQTT_DOWN, 0);
+		later(latency(100, 2000), W_MQTT_UP, 0);
+		break;
+	}
+}
+
+// Schedule the next disruption (if it's still in the disruption window)
+static void next_disrupt(void) {
+	const scenario *sc = w.sc;
+	int total = 0;
+	for (int d = 0; d < D_KINDS; d++) {
+		total += sc->weight[d];
+	}
+	if (total == 0) {
+		return;
+	}
+	int64_t gap = latency(10, 2 * sc->gap_ms);
+	if (w.now + gap >= sc->disrupt_s * 1000LL) {
+		return;
+	}
+	int pick = rnd() % total;
+	int d = 0;
+	while (pick >= sc->weight[d]) {
+		pick -= sc->weight[d++];
+	}
+	later(gap, W_DISRUPT, d);
+}
+
+static void handle(world_event *e) {
+	switch (e->kind) {
+	case W_WIFI_UP:
+		if (e->arg != w.wifi_gen) {
+			break;
+		}
+		w.wifi_up = true;
+		w.wifi_joining = false;
+		trace("wifi up%s%s", "", "");
+		send(ZQ3_EV_WIFI_UP, 0);
+		break;
+	case W_WIFI_DOWN:
+		if (e->arg != w.wifi_gen || !w.wifi_up) {
+			break;
+		}
+		w.wifi_up = false;
+		w.wifi_gen++;
+		lose_conn();
+		trace("wifi down (roam)%s%s", "", "");
+		send(ZQ3_EV_WIFI_DOWN, 0);
+		w.wifi_joining = true;
+		later(latency(300, 2000), W_WIFI_UP, w.wifi_gen);
+		break;
+	case W_CONN_DONE: {
+		// Like zq3_conn, superseded attempts don't report, and a cancelled
+		// one finishes with -ECANCELED. If it connected anyway, the main
+		// loop drops the connection (DISCONNECT) before handling DONE.
+		if (e->arg != w.job) {
+			break;
+		}
+		w.done = w.job;
+		int err = 0;
+		if (!w.wifi_up || chance(w.sc->conn_fail)) {
+			err = -111;
+		}
+		if (w.worker_cancel) {
+			if (err == 0) {
+				w.conn_open = true;
+				trace("cancelled attempt connected anyway%s%s", "", "");
+				close_conn(true);
+			}
+			err = -125;
+		}
+		if (err == 0) {
+			w.conn_open = true;
+			w.conn_gen++;
+		}
+		trace("connect worker done: %s%s", err ? "failed" : "ok", "");
+		// The main loop only follows the worker in CONNECTING
+		if (w.fsm.state != CONNECTING) {
+			break;
+		}
+		if (err == 0) {
+			reply(W_CONNACK);
+		}
+		send(ZQ3_EV_CONN_DONE, err);
+		break;
+	}
+	case W_CONNACK:
+	case W_SUBACK:
+	case W_VALUE:
+		if (e->arg != w.conn_gen || !w.conn_open || w.conn_dead) {
+			break;
+		}
+		if (e->kind == W_CONNACK) {
+			bool kept = chance(w.sc->session);
+			if (!kept) {
+				w.subscribed[w.broker] = false;   // new session
+			}
+			trace("CONNACK%s%s", kept ? " (session present)" : "", "");
+			send(ZQ3_EV_CONNACK, kept);
+		} else if (e->kind == W_SUBACK) {
+			trace("SUBACK%s%s", "", "");
+			w.subscribed[w.broker] = true;
+			w.sub_broker = w.broker;
+			send(ZQ3_EV_SUBACK, 0);
+		} else {
+			trace("value%s%s", "", "");
+			send(ZQ3_EV_VALUE, 0);
+		}
+		break;
+	case W_DISRUPT:
+		disrupt(e->arg);
+		next_disrupt();
+		break;
+	case W_MQTT_UP:
+		// `aio up` only does something below CONNECTING
+		if (w.fsm.state < CONNECTING) {
+			send(ZQ3_EV_MQTT_UP, 0);
+		}
+		break;
+	}
+}
+
+// The user presses the button if the device is stuck waiting for that
+// (after a cancel or `aio dn`, MQTT_ERR doesn't retry by itself)
+static bool needs_user(void) {
+	zq3_state s = w.fsm.state;
+	return s == OFFLINE || s == WIFI_ERR ||
+		(s == MQTT_ERR && !w.fsm.failover);
+}
+
+// Returns false if the run broke a rule
+static bool run(const scenario *sc, uint64_t seed, bool verbose) {
+	memset(&w, 0, sizeof(w));
+	w.sc = sc;
+	w.rng = seed * 0x9e3779b97f4a7c15ULL + 1;
+	w.verbose = verbose;
+	w.first_ready = -1;
+	w.sub_broker = -1;
+	zq3_fsm_init(&w.fsm, &ops, NULL, BROKER_TIMEOUT_MS, SYNC_TIMEOUT_MS);
+	int64_t end = sc->disrupt_s * 1000LL;
+	int64_t limit = end + RECOVER_LIMIT_MS;
+
+	trace("press%s%s", "", "");
+	send(ZQ3_EV_PRESS, 0);
+	next_disrupt();
+	while (w.fail[0] == '\0') {
+		// The main loop publishes a local change once READY
+		if (w.fsm.state == READY && w.publish_pending && !w.conn_dead) {
+			w.publish_pending = false;
+		}
+		if (w.now >= end && w.fsm.state == READY) {
+			break;
+		}
+		int i = next_event();
+		bool timer = w.fsm.timer_at &&
+			(i < 0 || w.fsm.timer_at < w.pending[i].at ||
+			(w.fsm.timer_at == w.pending[i].at && chance(50)));
+		if (i < 0 && !timer) {
+			if (w.now < end) {
+				w.now = end;
+				continue;
+			}
+			if (needs_user()) {
+				w.user_presses++;
+				trace("user presses the button%s%s", "", "");
+				send(ZQ3_EV_PRESS, 0);
+				continue;
+			}
+			fail("nothing left to happen");
+			break;
+		}
+		int64_t at = timer ? w.fsm.timer_at : w.pending[i].at;
+		if (at > limit) {
+			fail("READY didn't come back");
+			break;
+		}
+		w.now = at;
+		if (timer) {
+			trace("timeout%s%s", "", "");
+			zq3_fsm_poll(&w.fsm, w.now);
+		} else {
+			world_event e = w.pending[i];
+			w.pending[i] = w.pending[--w.count];
+			handle(&e);
+		}
+		if (w.fsm.dropped) {
+			fail("state machine queue overflowed");
+		}
+	}
+	return w.fail[0] == '\0';
+}
+
+
+/*
+* REPORTS
+*/
+
+static void add_sample(samples *s, double v) {
+	if (s->n == s->cap) {
+		s->cap = s->cap ? s->cap * 2 : 1024;
+		s->v = realloc(s->v, s->cap * sizeof(double));
+	}
+	s->v[s->n++] = v;
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void print_samples(const char *name, samples *s) {
+	if (s->n == 0) {
+		printf("  %-14s no samples\n", name);
+		return;
+	}
+	qsort(s->v, s->n, sizeof(double), cmp_double);
+	printf("  %-14s n=%-6zu p50 %7.1f  p90 %7.1f  p99 %7.1f  max %7.1f ms\n",
+		name, s->n, s->v[s->n / 2], s->v[s->n * 9 / 10],
+		s->v[s->n * 99 / 100], s->v[s->n - 1]);
+}
+
+// Returns the number of runs that broke a rule
+static int bench(const scenario *sc, int runs, uint64_t seed0) {
+	samples first = {0}, recover = {0};
+	uint64_t events = 0, ignored = 0, presses = 0;
+	int fails = 0;
+	printf("%s:\n", sc->name);
+	for (int r = 0; r < runs; r++) {
+		uint64_t seed = seed0 + r;
+		if (!run(sc, seed, false)) {
+			if (fails++ < SHOW_FAILS) {
+				printf("  FAIL seed %llu: %s\n", (unsigned long long)seed,
+					w.fail);
+			}
+			continue;
+		}
+		add_sample(&first, w.first_ready);
+		if (sc->disrupt_s > 0) {
+			int64_t t = w.ready_at - w.last_disrupt;
+			add_sample(&recover, t > 0 ? t : 0);
+		}
+		events += w.fsm.events;
+		ignored += w.fsm.ignored;
+		presses += w.user_presses;
+	}
+	print_samples("first READY", &first);
+	if (sc->disrupt_s > 0) {
+		print_samples("back to READY", &recover);
+	}
+	printf("  %d runs, %d broke rules, %llu events (%llu ignored), "
+		"%llu user presses\n", runs, fails, (unsigned long long)events,
+		(unsigned long long)ignored, (unsigned long long)presses);
+	free(first.v);
+	free(recover.v);
+	return fails;
+}
+
+int main(int argc, char *argv[]) {
+	int runs = 2000;
+	const char *only = NULL;
+	uint64_t seed = 1;
+	bool seed_set = false;
+	bool verbose = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:c:s:v")) != -1) {
+		switch (opt) {
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 'c':
+			only = optarg;
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			seed_set = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (runs < 1 || optind != argc) {
+		goto usage;
+	}
+
+	int fails = 0;
+	bool found = false;
+	for (int i = 0; i < SCENARIOS; i++) {
+		const scenario *sc = &scenarios[i];
+		if (only && strcmp(only, sc->name) != 0) {
+			continue;
+		}
+		found = true;
+		if (verbose) {
+			// Replay one run with a trace
+			bool ok = run(sc, seed, true);
+			printf("%s seed %llu: %s\n", sc->name, (unsigned long long)seed,
+				ok ? "ok" : w.fail);
+			fails += !ok;
+		} else {
+			fails += bench(sc, seed_set ? 1 : runs, seed);
+		}
+	}
+	if (!found) {
+		fprintf(stderr, "unknown scenario '%s'\n", only);
+		goto usage;
+	}
+	return fails ? 1 : 0;
+
+usage:
+	fprintf(stderr, "usage: zq3_fsm_sim [-n runs] [-c scenario] [-s seed] "
+		"[-v]\nscenarios:");
+	for (int i = 0; i < SCENARIOS; i++) {
+		fprintf(stderr, " %s", scenarios[i].name);
+	}
+	fprintf(stderr, "\n");
+	return 2;
+}
@@ -0,0 +1,297 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Host test for the OTA chunk bitmap, sector erases, and resume
+ *
+ * This runs the firmware's zq3_chunks.c against a fake NOR flash slot, the
+ * same way zq3_ota.c does: ask zq3_chunks_want() about each chunk, erase
+ * the sector if it says so, write, then zq3_chunks_mark(). The fake flash
+ * only lets writes clear bits, like the real one, so writing over data
+ * that needed an erase first shows up as a broken rule. Each run sends a
+ * random image (random size and chunk size) in one of these ways:
+ *
+ *   in-order     chunks 0, 1, 2, ...
+ *   shuffled     every chunk once, in random order
+ *   duplicates   every chunk one to three times, in random order
+ *   reboot       shuffled with duplicates, and the device reboots now and
+ *                then. Like zq3_ota.c, the map gets saved every SAVE_CHUNKS
+ *                chunks, and after a reboot it gets loaded from the last
+ *                save (or starts over if there isn't one). The flash keeps
+ *                everything written before the reboot, including chunks
+ *                the saved map doesn't know about.
+ *
+ * Every run must end with the image in flash, each sector erased no more
+ * often than needed, and every duplicate chunk skipped.
+ *
+ * Usage: zq3_ota_test [-n runs] [-s seed]
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "zq3_chunks.h"
+
+
+#define SLOT_SIZE    (256 * 1024)
+#define SAVE_CHUNKS  (16)      // CONFIG_ZQ3_OTA_SAVE_CHUNKS (smaller, to
+                               // make reboots lose some chunks)
+#define SENDS_MAX    (3 * CONFIG_ZQ3_OTA_MAX_CHUNKS)
+
+typedef enum {
+	IN_ORDER,
+	SHUFFLED,
+	DUPLICATES,
+	REBOOT,
+	MODES,
+} send_mode;
+
+static const char *mode_names[MODES] = {
+	"in-order", "shuffled", "duplicates", "reboot",
+};
+
+static struct {
+	uint8_t image[SLOT_SIZE];
+	uint8_t flash[SLOT_SIZE];
+	zq3_chunks map;
+	zq3_chunks saved;        // the zq3/otamap setting
+	bool have_saved;
+	uint32_t saved_at;
+	uint32_t sends[SENDS_MAX];
+	int send_count;
+	uint32_t erases;
+	uint32_t dupes;
+	uint32_t reboots;
+	const char *broken;      // first broken rule in this run
+} t;
+
+
+/*
+* FAKE FLASH
+*/
+
+static void fail(const char *rule) {
+	if (!t.broken) {
+		t.broken = rule;
+	}
+}
+
+static void flash_erase(uint32_t off) {
+	if (off % ZQ3_CHUNKS_SECTOR) {
+		fail("erase not on a sector boundary");
+	}
+	memset(t.flash + off, 0xff, ZQ3_CHUNKS_SECTOR);
+	t.erases++;
+}
+
+// NOR flash: a write can only turn 1 bits into 0 bits
+static void flash_write(uint32_t off, const uint8_t *data, uint32_t len) {
+	for (uint32_t i = 0; i < len; i++) {
+		if ((t.flash[off + i] & data[i]) != data[i]) {
+			fail("write over data that needed an erase");
+		}
+		t.flash[off + i] &= data[i];
+	}
+}
+
+
+/*
+* DEVICE (what zq3_ota.c does with each chunk)
+*/
+
+static void begin(uint32_t size, uint32_t chunk, const uint8_t *sha256) {
+	if (zq3_chunks_same(&t.map, size, chunk, sha256)) {
+		return;   // resume
+	}
+	if (zq3_chunks_begin(&t.map, size, chunk, sha256, SLOT_SIZE) != 0) {
+		fail("good begin message refused");
+	}
+	t.saved = t.map;
+	t.have_saved = true;
+	t.saved_at = 0;
+}
+
+static void receive(uint32_t n) {
+	uint32_t off = n * t.map.chunk;
+	uint32_t len = t.map.size - off < t.map.chunk ? t.map.size - off :
+		t.map.chunk;
+	uint32_t erase_off = 0;
+	int want = zq3_chunks_want(&t.map, n, len, &erase_off);
+	if (want == -EALREADY) {
+		t.dupes++;
+		return;
+	}
+	if (want < 0) {
+		fail("chunk of the image refused");
+		return;
+	}
+	if (want == 1) {
+		if (erase_off > off || off - erase_off >= ZQ3_CHUNKS_SECTOR) {
+			fail("erase of a sector the chunk isn't in");
+		}
+		flash_erase(erase_off);
+	}
+	flash_write(off, t.image + off, len);
+	zq3_chunks_mark(&t.map, n);
+	if (t.map.received - t.saved_at >= SAVE_CHUNKS) {
+		t.saved = t.map;
+		t.saved_at = t.map.received;
+	}
+}
+
+// Power cycle: RAM is gone, flash and settings stay
+static void reboot(void) {
+	t.reboots++;
+	memset(&t.map, 0, sizeof(t.map));
+	if (t.have_saved && zq3_chunks_load(&t.map, &t.saved,
+		sizeof(t.saved)) != 0)
+	{
+		fail("saved map didn't load");
+	}
+	// The flash is left as it was, with the chunks since the last save
+}
+
+
+/*
+* RUNS
+*/
+
+static void shuffle(uint32_t *v, int n) {
+	for (int i = n - 1; i > 0; i--) {
+		int j = rand() % (i + 1);
+		uint32_t tmp = v[i];
+		v[i] = v[j];
+		v[j] = tmp;
+	}
+}
+
+// Bad input the map has to refuse
+static void check_refusals(uint32_t chunk) {
+	uint32_t off;
+	if (zq3_chunks_want(&t.map, t.map.chunks, chunk, &off) != -ENOENT) {
+		fail("chunk past the end accepted");
+	}
+	if (t.map.chunks > 1 &&
+		!zq3_chunks_has(&t.map, 0) &&
+		zq3_chunks_want(&t.map, 0, chunk - 1, &off) != -EMSGSIZE)
+	{
+		fail("short chunk accepted");
+	}
+	zq3_chunks bad = t.map;
+	bad.received++;
+	zq3_chunks copy;
+	if (zq3_chunks_load(&copy, &bad, sizeof(bad)) != -EINVAL) {
+		fail("damaged map loaded");
+	}
+	if (zq3_chunks_load(&copy, &t.map, sizeof(t.map) - 1) != -EINVAL) {
+		fail("short map loaded");
+	}
+}
+
+static bool run(send_mode mode, int seed) {
+	srand(seed);
+	memset(&t, 0, sizeof(t));
+	memset(t.flash, 0x5a, sizeof(t.flash));   // old junk in the slot
+	uint32_t chunk = 256u << (rand() % 5);
+	uint32_t max = CONFIG_ZQ3_OTA_MAX_CHUNKS * chunk;
+	uint32_t size = 1 + rand() % (max < SLOT_SIZE ? max : SLOT_SIZE);
+	uint8_t sha256[32];
+	for (uint32_t i = 0; i < size; i++) {
+		t.image[i] = rand();
+	}
+	for (int i = 0; i < 32; i++) {
+		sha256[i] = rand();
+	}
+	begin(size, chunk, sha256);
+	uint32_t chunks = t.map.chunks;
+	check_refusals(chunk);
+
+	int copies = (mode == DUPLICATES || mode == REBOOT) ? 3 : 1;
+	for (uint32_t n = 0; n < chunks; n++) {
+		int k = (copies == 1) ? 1 : 1 + rand() % copies;
+		for (int i = 0; i < k; i++) {
+			t.sends[t.send_count++] = n;
+		}
+	}
+	if (mode != IN_ORDER) {
+		shuffle(t.sends, t.send_count);
+	}
+	int expected_dupes = t.send_count - chunks;
+	for (int i = 0; i < t.send_count; i++) {
+		receive(t.sends[i]);
+		if (mode == REBOOT && rand() % 50 == 0) {
+			reboot();
+			begin(size, chunk, sha256);
+			// The sender starts over, and the device skips what it has
+			uint32_t kept = t.map.received;
+			uint32_t dupes = t.dupes;
+			for (uint32_t n = 0; n < chunks; n++) {
+				receive(n);
+			}
+			if (t.dupes - dupes != kept) {
+				fail("resume wrote chunks the saved map had");
+			}
+		}
+	}
+
+	// Sectors that got erased more than once are from reboots, which lose
+	// the chunks written since the last save
+	uint32_t sectors = (size + ZQ3_CHUNKS_SECTOR - 1) / ZQ3_CHUNKS_SECTOR;
+	if (t.map.received != chunks || zq3_chunks_next(&t.map) != chunks) {
+		fail("chunks missing at the end");
+	}
+	if (memcmp(t.flash, t.image, size) != 0) {
+		fail("flash doesn't match the image");
+	}
+	if (t.reboots == 0 && t.erases != sectors) {
+		fail("sector erased more than once");
+	}
+	if (mode != REBOOT && t.dupes != expected_dupes) {
+		fail("duplicate chunk written again");
+	}
+	if (t.broken) {
+		printf("  seed %d: %s (%u chunks of %u, %u reboots)\n", seed,
+			t.broken, chunks, chunk, t.reboots);
+	}
+	return t.broken == NULL;
+}
+
+
+/*
+* MAIN
+*/
+
+int main(int argc, char *argv[]) {
+	int opt;
+	int runs = 200;
+	int seed = 1;
+	while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+		switch (opt) {
+		case 'n': runs = atoi(optarg); break;
+		case 's': seed = atoi(optarg); runs = 1; break;
+		default:
+			fprintf(stderr, "usage: zq3_ota_test [-n runs] [-s seed]\n");
+			return 2;
+		}
+	}
+	int failed = 0;
+	for (int m = 0; m < MODES; m++) {
+		int bad = 0;
+		uint32_t erases = 0, dupes = 0, reboots = 0;
+		for (int i = 0; i < runs; i++) {
+			bad += !run(m, seed + i);
+			erases += t.erases;
+			dupes += t.dupes;
+			reboots += t.reboots;
+		}
+		printf("%-10s %d runs, %u erases, %u dupes skipped, %u reboots: "
+			"%s\n", mode_names[m], runs, erases, dupes, reboots,
+			bad ? "FAIL" : "ok");
+		failed += bad;
+	}
+	return failed ? 1 : 0;
+}
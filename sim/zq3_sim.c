@@ -0,0 +1,864 @@
+/*
+ * SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Fleet simulator: thousands of zq3 MQTT clients in one Linux process
+ *
+ * Each simulated client runs the firmware's connection state machine
+ * (zq3_fsm.c) with hooks that stand in for main.c: a non-blocking socket
+ * instead of the connect worker, a small MQTT 3.1.1 client instead of the
+ * Zephyr one, and backoff like zq3_broker_failover(). Like the firmware,
+ * clients keep a persistent session (so a reconnect can resume without
+ * SUBSCRIBE) unless -c asks for a clean one. Clients parse the broker url
+ * with the firmware's zq3_url.c. Sockets share one epoll loop.
+ *
+ * A script says when clients press the button (publish the toggle) and
+ * when some of them lose wifi (outages, to make reconnect storms):
+ *
+ *   # time_s  action  args
+ *   0    press 10          each READY client presses about every 10 s
+ *   60   outage 100 5      100% of clients lose wifi for 5 s
+ *   120  end
+ *
+ * Each client subscribes to its own topic, so every publish comes back
+ * from the broker. The payload carries the send time, which gives the
+ * broker round trip latency. The simulator speaks plain MQTT 3.1.1 (no TLS),
+ * so point it at a local mosquitto (or tools/fault_proxy.py).
+ *
+ * After subscribing, the firmware waits for the toggle's current value
+ * (SYNCWAIT). --sync says how the sim gets it:
+ *
+ *   retain   seed a retained value before SUBSCRIBE, so the broker sends it
+ *            right after the SUBACK (default, works with mosquitto)
+ *   get      publish to <topic>/get like the firmware, for brokers that
+ *            answer that the way Adafruit IO does
+ *   none     skip the wait, as if the value came right away
+ *
+ * Usage: zq3_sim [-n clients] [-r connects/s] [-j jitter%] [-c] [-s script]
+ *        [--sync retain|get|none] url
+ * Example: ./zq3_sim -n 2000 -r 200 'mqtt://:@localhost:1883/sim/{n}'
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "zq3_fsm.h"
+#include "zq3_state.h"
+#include "zq3_url.h"
+
+
+#define KEEPALIVE_S     (60)      // CONFIG_ZQ3_KEEPALIVE_MIN_S (first ping)
+#define PING_EARLY_MS   (5000)    // like zq3_mqtt_keepalive()
+#define SYNC_TIMEOUT_MS (1500)    // CONFIG_ZQ3_SYNC_TIMEOUT_MS
+#define BROKER_TIMEOUT_MS (10000) // CONFIG_ZQ3_BROKER_TIMEOUT_MS
+#define TCP_TIMEOUT_MS  (10000)   // give up on the TCP connect
+#define BROKER_MAX      (3)       // CONFIG_ZQ3_BROKER_MAX
+#define BACKOFF_MAX_MS  (60000)   // like zq3_broker.c
+#define RX_MAX          (512)
+#define SCRIPT_MAX      (64)
+#define REPORT_MS       (10000)
+#define MIN(a, b)       ((a) < (b) ? (a) : (b))
+
+typedef enum { SYNC_RETAIN, SYNC_GET, SYNC_NONE, SYNC_MODES } sync_mode;
+
+static const char *sync_names[SYNC_MODES] = {"retain", "get", "none"};
+
+enum { PKT_CONNECT = 1, PKT_CONNACK, PKT_PUBLISH, PKT_PUBACK,
+	PKT_SUBSCRIBE = 8, PKT_SUBACK, PKT_PINGREQ = 12, PKT_PINGRESP,
+	PKT_DISCONNECT };
+
+typedef struct {
+	int id;
+	zq3_fsm fsm;          // the firmware's connection state machine
+	int fd;
+	bool connected;       // CONNECT sent
+	bool subscribed;      // got a SUBACK (the broker's session has our topic)
+	bool resumed;         // this connection kept the broker's session
+	bool wifi_up;
+	int64_t wifi_at;      // uptime when wifi comes back (0 = not pending)
+	char topic[ZQ3_URL_FIELD_MAX + 16];
+	char client_id[24];
+	uint8_t rx[RX_MAX];
+	int rx_len;
+	int64_t attempt_at;   // uptime when this connection attempt started
+	int64_t open_by;      // TCP connect timeout (0 = not connecting)
+	int64_t ping_at;      // uptime to send the next PINGREQ
+	int64_t press_at;     // uptime of the next button press (0 = none)
+	int failures;         // since the last READY, for backoff
+	uint16_t next_id;
+	bool toggle;
+} sim_client;
+
+typedef struct {
+	double *v;
+	size_t n, cap;
+} samples;
+
+typedef struct {
+	int64_t at;
+	char action[16];
+	double a, b;
+} script_step;
+
+static struct {
+	zq3_url url;
+	struct sockaddr_in addr;
+	sim_client *clients;
+	int count;
+	int rate;              // new clients started per second
+	int jitter;            // backoff jitter (percent)
+	bool clean;            // clean session (persistent session is default)
+	sync_mode sync;        // how clients get the value in SYNCWAIT
+	double press_s;        // mean time between presses (0 = off)
+	script_step script[SCRIPT_MAX];
+	int steps;
+	int epfd;
+	int64_t t0;
+	int started;
+	// Counters (since start, and at the last report)
+	uint64_t attempts, connacks, failures, publishes, echoes;
+	uint64_t last_connacks, last_publishes, last_echoes;
+	samples connect_ms;    // TCP connect start to CONNACK
+	samples ready_ms;      // TCP connect start to READY
+	samples echo_ms;       // publish to echo from the broker
+} sim;
+
+
+static int64_t now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000 - sim.t0;
+}
+
+static int64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void add_sample(samples *s, double v) {
+	if (s->n == s->cap) {
+		s->cap = s->cap ? s->cap * 2 : 1024;
+		s->v = realloc(s->v, s->cap * sizeof(double));
+	}
+	s->v[s->n++] = v;
+}
+
+static int cmp_double(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+static void print_samples(const char *name, samples *s) {
+	if (s->n == 0) {
+		printf("%-18s no samples\n", name);
+		return;
+	}
+	qsort(s->v, s->n, sizeof(double), cmp_double);
+	printf("%-18s n=%-7zu p50 %7.1f  p90 %7.1f  p99 %7.1f  max %7.1f ms\n",
+		name, s->n, s->v[s->n / 2], s->v[s->n * 9 / 10],
+		s->v[s->n * 99 / 100], s->v[s->n - 1]);
+}
+
+// Random time until the next press (exponential, mean press_s)
+static int64_t next_press(void) {
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	return now_ms() + (int64_t)(-sim.press_s * 1000 * log1p(-u));
+}
+
+
+/*
+* MQTT 3.1.1 PACKETS (just what the firmware uses)
+*/
+
+static int put_len(uint8_t *p, int len) {
+	int n = 0;
+	do {
+		p[n] = len % 128;
+		len /= 128;
+		if (len > 0) {
+			p[n] |= 0x80;
+		}
+		n++;
+	} while (len > 0);
+	return n;
+}
+
+static int put_str(uint8_t *p, const char *s) {
+	int len = strlen(s);
+	p[0] = len >> 8;
+	p[1] = len & 0xff;
+	memcpy(p + 2, s, len);
+	return len + 2;
+}
+
+// Send a packet with fixed header byte b0 and body (all or nothing)
+static int send_packet(sim_client *c, uint8_t b0, const uint8_t *body,
+	int len)
+{
+	uint8_t buf[RX_MAX + 8];
+	buf[0] = b0;
+	int n = 1 + put_len(buf + 1, len);
+	memcpy(buf + n, body, len);
+	n += len;
+	return send(c->fd, buf, n, MSG_NOSIGNAL) == n ? 0 : -EIO;
+}
+
+static int send_connect(sim_client *c) {
+	uint8_t body[RX_MAX];
+	static const uint8_t head[] = {0, 4, 'M', 'Q', 'T', 'T', 4};
+	int n = sizeof(head);
+	memcpy(body, head, n);
+	// Like the firmware, keep a persistent session unless told otherwise
+	// (CONFIG_ZQ3_MQTT_PERSISTENT_SESSION)
+	uint8_t flags = sim.clean ? 0x02 : 0;
+	flags |= strlen(sim.url.user) ? 0x80 : 0;
+	flags |= strlen(sim.url.pass) ? 0x40 : 0;
+	body[n++] = flags;
+	body[n++] = KEEPALIVE_S >> 8;
+	body[n++] = KEEPALIVE_S & 0xff;
+	n += put_str(body + n, c->client_id);
+	if (strlen(sim.url.user)) {
+		n += put_str(body + n, sim.url.user);
+	}
+	if (strlen(sim.url.pass)) {
+		n += put_str(body + n, sim.url.pass);
+	}
+	return send_packet(c, PKT_CONNECT << 4, body, n);
+}
+
+static int send_subscribe(sim_client *c) {
+	uint8_t body[RX_MAX];
+	body[0] = 0;
+	body[1] = 1;            // packet id 1 is for SUBSCRIBE, like the app
+	int n = 2 + put_str(body + 2, c->topic);
+	body[n++] = 1;          // QoS 1
+	return send_packet(c, (PKT_SUBSCRIBE << 4) | 0x02, body, n);
+}
+
+static int send_publish(sim_client *c, const char *topic, const char *payload,
+	int qos, bool retain)
+{
+	uint8_t body[RX_MAX];
+	int n = put_str(body, topic);
+	if (qos) {
+		c->next_id = (c->next_id < 2) ? 2 : c->next_id;
+		body[n++] = c->next_id >> 8;
+		body[n++] = c->next_id & 0xff;
+		c->next_id++;
+	}
+	int len = strlen(payload);
+	memcpy(body + n, payload, len);
+	return send_packet(c, (PKT_PUBLISH << 4) | (qos << 1) | retain, body,
+		n + len);
+}
+
+
+/*
+* CLIENT HOOKS (stand-ins for the ones in main.c)
+*
+* Each client runs the firmware's state machine (zq3_fsm.c). These hooks do
+* what the firmware's do, but with a non-blocking socket instead of the
+* connect worker and the Zephyr MQTT library. Events that the hooks cause
+* (like DISCONNECT when a connection gets dropped) go through the state
+* machine's queue, the same as in the firmware.
+*/
+
+static void event(sim_client *c, zq3_fsm_event ev, int arg) {
+	zq3_fsm_dispatch(&c->fsm, ev, arg, now_ms());
+}
+
+static void close_socket(sim_client *c) {
+	if (c->fd >= 0) {
+		epoll_ctl(sim.epfd, EPOLL_CTL_DEL, c->fd, NULL);
+		close(c->fd);
+		c->fd = -1;
+	}
+	c->rx_len = 0;
+	c->connected = false;
+	c->open_by = 0;
+}
+
+// The connection closed or broke. Like mqtt_abort() or a socket error in
+// the Zephyr MQTT library, this means DISCONNECT.
+static void lost(sim_client *c) {
+	bool was_connected = c->connected;
+	close_socket(c);
+	if (was_connected) {
+		event(c, ZQ3_EV_MQTT_ERR, 0);
+	}
+}
+
+// TCP connect didn't work out, so the connect "worker" is done
+static void connect_failed(sim_client *c, int err) {
+	close_socket(c);
+	event(c, ZQ3_EV_CONN_DONE, err);
+}
+
+static int op_wifi_connect(void *arg) {
+	sim_client *c = arg;
+	if (!c->wifi_up && c->wifi_at == 0) {
+		c->wifi_at = now_ms();   // sim wifi joins right away
+	}
+	return 0;
+}
+
+// Like the connect worker, this finishes with CONN_DONE once CONNECT is
+// sent (or the TCP connect fails)
+static void op_connect(void *arg) {
+	sim_client *c = arg;
+	close_socket(c);
+	c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (c->fd < 0) {
+		if (errno == EMFILE) {
+			fprintf(stderr, "out of file descriptors (ulimit -n)\n");
+		}
+		connect_failed(c, -errno);
+		return;
+	}
+	int one = 1;
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	sim.attempts++;
+	c->attempt_at = now_ms();
+	int err = connect(c->fd, (struct sockaddr *)&sim.addr, sizeof(sim.addr));
+	if (err && errno != EINPROGRESS) {
+		connect_failed(c, -errno);
+		return;
+	}
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLOUT,
+		.data.ptr = c,
+	};
+	epoll_ctl(sim.epfd, EPOLL_CTL_ADD, c->fd, &ev);
+	c->open_by = now_ms() + TCP_TIMEOUT_MS;
+}
+
+static void op_cancel(void *arg) {
+	sim_client *c = arg;
+	if (c->fd >= 0 && !c->connected) {
+		connect_failed(c, -ECANCELED);
+	}
+}
+
+static void op_drop(void *arg) {
+	sim_client *c = arg;
+	if (c->connected) {
+		lost(c);
+	} else {
+		op_cancel(arg);
+	}
+}
+
+static void op_disconnect(void *arg) {
+	sim_client *c = arg;
+	if (c->connected) {
+		send_packet(c, PKT_DISCONNECT << 4, NULL, 0);
+	}
+	lost(c);
+}
+
+static void op_first_broker(void *arg) {
+	// The sim only has one broker
+}
+
+// Back off like zq3_broker_failover() with only zq3/url set (plus optional
+// jitter)
+static int64_t op_failover(void *arg) {
+	sim_client *c = arg;
+	c->failures++;
+	int round = c->failures / BROKER_MAX;
+	int64_t delay = MIN(1000LL << MIN(round, 6), BACKOFF_MAX_MS);
+	if (sim.jitter) {
+		delay += delay * (rand() % (2 * sim.jitter + 1) - sim.jitter) / 100;
+	}
+	return delay;
+}
+
+// Like the firmware's topic hash: a kept session only has our topic if it
+// got a SUBACK on this connection or an earlier one
+static bool op_subscribed(void *arg) {
+	sim_client *c = arg;
+	return c->subscribed;
+}
+
+static int op_subscribe(void *arg, bool resumed) {
+	sim_client *c = arg;
+	c->resumed = resumed;
+	if (resumed) {
+		return 0;
+	}
+	c->subscribed = false;
+	// The payload has no send time, so it doesn't count as an echo
+	if (sim.sync == SYNC_RETAIN && send_publish(c, c->topic, "0", 0, true)) {
+		return -EIO;
+	}
+	return send_subscribe(c);
+}
+
+// Ask for the current value (see --sync). With retain, a new subscription
+// already brings the retained value, and a resumed session gets it by
+// subscribing again (MQTT 3.1.1 section 3.8.4). With none, the sync timer
+// is 0, so the next tick ends SYNCWAIT.
+static int op_sync(void *arg, bool get_toggle) {
+	sim_client *c = arg;
+	if (!get_toggle) {
+		return 0;
+	}
+	if (sim.sync == SYNC_RETAIN) {
+		return c->resumed ? send_subscribe(c) : 0;
+	}
+	if (sim.sync == SYNC_GET) {
+		char get[sizeof(c->topic) + 4];
+		snprintf(get, sizeof(get), "%s/get", c->topic);
+		return send_publish(c, get, "", 0, false);
+	}
+	return 0;
+}
+
+static bool op_pending(void *arg) {
+	return false;   // sim clients only press when they're READY
+}
+
+static void op_toggle(void *arg) {
+	sim_client *c = arg;
+	char payload[32];
+	c->toggle = !c->toggle;
+	snprintf(payload, sizeof(payload), "%d %lld", c->toggle,
+		(long long)now_us());
+	if (send_publish(c, c->topic, payload, 1, false) == 0) {
+		sim.publishes++;
+	}
+}
+
+static void op_entered(void *arg, zq3_state from, zq3_state to) {
+	sim_client *c = arg;
+	if (to == MQTT_ERR) {
+		sim.failures++;
+	}
+	if (to != READY) {
+		c->press_at = 0;
+		return;
+	}
+	add_sample(&sim.ready_ms, now_ms() - c->attempt_at);
+	c->failures = 0;
+	c->press_at = sim.press_s > 0 ? next_press() : 0;
+}
+
+static const zq3_fsm_ops ops = {
+	.wifi_connect = op_wifi_connect,
+	.connect = op_connect,
+	.cancel = op_cancel,
+	.drop = op_drop,
+	.disconnect = op_disconnect,
+	.first_broker = op_first_broker,
+	.failover = op_failover,
+	.subscribed = op_subscribed,
+	.subscribe = op_subscribe,
+	.sync = op_sync,
+	.pending = op_pending,
+	.toggle = op_toggle,
+	.entered = op_entered,
+};
+
+
+/*
+* CLIENT EVENTS
+*/
+
+static void on_publish(sim_client *c, uint8_t b0, const uint8_t *p, int len) {
+	if (len < 2) {
+		return;
+	}
+	int qos = (b0 >> 1) & 3;
+	int tlen = (p[0] << 8) | p[1];
+	int off = 2 + tlen + (qos ? 2 : 0);
+	if (off > len) {
+		return;
+	}
+	if (qos) {
+		uint8_t ack[2] = {p[2 + tlen], p[3 + tlen]};
+		send_packet(c, PKT_PUBACK << 4, ack, 2);
+	}
+	char payload[32] = {0};
+	memcpy(payload, p + off, MIN(len - off, (int)sizeof(payload) - 1));
+	long long sent_us = 0;
+	if (sscanf(payload, "%*d %lld", &sent_us) == 1) {
+		sim.echoes++;
+		add_sample(&sim.echo_ms, (now_us() - sent_us) / 1000.0);
+	}
+	event(c, ZQ3_EV_VALUE, 0);
+}
+
+static void on_packet(sim_client *c, uint8_t b0, const uint8_t *p, int len) {
+	switch (b0 >> 4) {
+	case PKT_CONNACK:
+		if (len < 2 || p[1] != 0) {
+			lost(c);   // refused
+			return;
+		}
+		sim.connacks++;
+		add_sample(&sim.connect_ms, now_ms() - c->attempt_at);
+		c->ping_at = now_ms() + KEEPALIVE_S * 1000 - PING_EARLY_MS;
+		event(c, ZQ3_EV_CONNACK, p[0] & 1);
+		break;
+	case PKT_SUBACK:
+		c->subscribed = true;
+		event(c, ZQ3_EV_SUBACK, 0);
+		break;
+	case PKT_PUBLISH:
+		on_publish(c, b0, p, len);
+		break;
+	default:
+		break;   // PUBACK, PINGRESP
+	}
+}
+
+static void on_readable(sim_client *c) {
+	while (c->fd >= 0) {
+		ssize_t n = recv(c->fd, c->rx + c->rx_len, RX_MAX - c->rx_len, 0);
+		if (n == 0 || (n < 0 && errno != EAGAIN)) {
+			lost(c);
+			return;
+		}
+		if (n < 0) {
+			return;
+		}
+		c->rx_len += n;
+		// Handle every whole packet in the buffer
+		while (c->rx_len >= 2) {
+			int len = 0, mult = 1, i = 1;
+			while (i < c->rx_len && i < 5) {
+				len += (c->rx[i] & 0x7f) * mult;
+				mult *= 128;
+				if (!(c->rx[i++] & 0x80)) {
+					break;
+				}
+			}
+			if ((c->rx[i - 1] & 0x80) || c->rx_len < i + len) {
+				break;
+			}
+			if (i + len > RX_MAX) {
+				lost(c);
+				return;
+			}
+			on_packet(c, c->rx[0], c->rx + i, len);
+			if (c->fd < 0) {
+				return;
+			}
+			memmove(c->rx, c->rx + i + len, c->rx_len - i - len);
+			c->rx_len -= i + len;
+		}
+		if (c->rx_len == RX_MAX) {
+			lost(c);
+			return;
+		}
+	}
+}
+
+static void on_event(sim_client *c, uint32_t events) {
+	if (c->fd >= 0 && !c->connected && (events & (EPOLLOUT | EPOLLERR))) {
+		int err = 0;
+		socklen_t len = sizeof(err);
+		getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+		struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+		if (err || epoll_ctl(sim.epfd, EPOLL_CTL_MOD, c->fd, &ev) ||
+			send_connect(c))
+		{
+			connect_failed(c, err ? -err : -EIO);
+			return;
+		}
+		c->connected = true;
+		c->open_by = 0;
+		event(c, ZQ3_EV_CONN_DONE, 0);
+		return;
+	}
+	if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+		on_readable(c);
+	}
+}
+
+// Timers: wifi coming back, TCP connect timeout, the state machine's timers,
+// keepalive, button presses
+static void on_tick(sim_client *c, int64_t now) {
+	if (c->wifi_at && now >= c->wifi_at) {
+		c->wifi_at = 0;
+		c->wifi_up = true;
+		event(c, ZQ3_EV_WIFI_UP, 0);
+	}
+	if (c->open_by && now >= c->open_by) {
+		connect_failed(c, -ETIMEDOUT);
+	}
+	zq3_fsm_poll(&c->fsm, now);
+	if (!c->connected) {
+		return;
+	}
+	if (now >= c->ping_at) {
+		send_packet(c, PKT_PINGREQ << 4, NULL, 0);
+		c->ping_at = now + KEEPALIVE_S * 1000 - PING_EARLY_MS;
+	}
+	if (c->fsm.state == READY && c->press_at && now >= c->press_at) {
+		event(c, ZQ3_EV_PRESS, 0);
+		c->press_at = next_press();
+	}
+}
+
+
+/*
+* SCRIPT & REPORTS
+*/
+
+static const char *default_script =
+	"0 press 10\n"
+	"60 outage 100 5\n"
+	"120 end\n";
+
+static int load_script(const char *text) {
+	sim.steps = 0;
+	const char *line = text;
+	while (line && *line && sim.steps < SCRIPT_MAX) {
+		script_step *s = &sim.script[sim.steps];
+		const char *end = strchr(line, '\n');
+		int len = end ? end - line : (int)strlen(line);
+		char buf[80];
+		double t;
+		snprintf(buf, sizeof(buf), "%.*s", len, line);
+		s->a = s->b = 0;
+		if (buf[0] != '#' &&
+			sscanf(buf, "%lf %15s %lf %lf", &t, s->action, &s->a, &s->b) >= 2)
+		{
+			s->at = (int64_t)(t * 1000);
+			sim.steps++;
+		}
+		line = end ? end + 1 : NULL;
+	}
+	return sim.steps;
+}
+
+// Run script steps that are due. Returns false at "end".
+static bool run_script(int64_t now) {
+	static int next = 0;
+	while (next < sim.steps && now >= sim.script[next].at) {
+		script_step *s = &sim.script[next++];
+		printf("%6.1f s: %s %g %g\n", now / 1000.0, s->action, s->a, s->b);
+		if (strcmp(s->action, "end") == 0) {
+			return false;
+		} else if (strcmp(s->action, "press") == 0) {
+			sim.press_s = s->a;
+			for (int i = 0; i < sim.count; i++) {
+				sim_client *c = &sim.clients[i];
+				c->press_at = (s->a > 0 && c->fsm.state == READY) ?
+					next_press() : 0;
+			}
+		} else if (strcmp(s->action, "outage") == 0) {
+			// Wifi drops without a DISCONNECT, then comes back
+			for (int i = 0; i < sim.count; i++) {
+				sim_client *c = &sim.clients[i];
+				if (i < sim.started && rand() % 100 < s->a) {
+					close_socket(c);
+					c->wifi_up = false;
+					c->wifi_at = now + (int64_t)(s->b * 1000) + 1;
+					event(c, ZQ3_EV_WIFI_DOWN, 0);
+				}
+			}
+		}
+	}
+	return true;
+}
+
+static void report(int64_t now) {
+	int ready_count = 0;
+	for (int i = 0; i < sim.count; i++) {
+		ready_count += sim.clients[i].fsm.state == READY;
+	}
+	double secs = REPORT_MS / 1000.0;
+	printf("%6.1f s: ready %d/%d, connects %.1f/s, publishes %.1f/s, "
+		"echoes %.1f/s\n", now / 1000.0, ready_count, sim.count,
+		(sim.connacks - sim.last_connacks) / secs,
+		(sim.publishes - sim.last_publishes) / secs,
+		(sim.echoes - sim.last_echoes) / secs);
+	sim.last_connacks = sim.connacks;
+	sim.last_publishes = sim.publishes;
+	sim.last_echoes = sim.echoes;
+}
+
+static void summary(int64_t now) {
+	double secs = now / 1000.0;
+	printf("\n%d clients for %.1f s\n", sim.count, secs);
+	printf("Connect attempts %llu, CONNACKs %llu, failures %llu\n",
+		(unsigned long long)sim.attempts, (unsigned long long)sim.connacks,
+		(unsigned long long)sim.failures);
+	printf("Publishes %llu (%.1f/s), echoes %llu (%.1f/s)\n",
+		(unsigned long long)sim.publishes, sim.publishes / secs,
+		(unsigned long long)sim.echoes, sim.echoes / secs);
+	print_samples("Connect (CONNACK)", &sim.connect_ms);
+	print_samples("Connect to READY", &sim.ready_ms);
+	print_samples("Publish to echo", &sim.echo_ms);
+}
+
+
+/*
+* MAIN
+*/
+
+static char *read_file(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		return NULL;
+	}
+	static char buf[8192];
+	size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+	buf[n] = '\0';
+	fclose(f);
+	return buf;
+}
+
+// Give client n its own topic: replace "{n}" in the url's topic, or add "/n"
+static void make_topic(sim_client *c) {
+	const char *t = sim.url.topic;
+	const char *mark = strstr(t, "{n}");
+	if (mark) {
+		snprintf(c->topic, sizeof(c->topic), "%.*s%d%s", (int)(mark - t), t,
+			c->id, mark + 3);
+	} else {
+		snprintf(c->topic, sizeof(c->topic), "%s/%d", t, c->id);
+	}
+	snprintf(c->client_id, sizeof(c->client_id), "zq3-sim-%d", c->id);
+}
+
+int main(int argc, char *argv[]) {
+	static const struct option long_opts[] = {
+		{"sync", required_argument, NULL, 'y'},
+		{NULL, 0, NULL, 0},
+	};
+	int opt;
+	const char *script = default_script;
+	sim.count = 100;
+	sim.rate = 50;
+	while ((opt = getopt_long(argc, argv, "n:r:j:cs:y:", long_opts, NULL))
+		!= -1)
+	{
+		switch (opt) {
+		case 'n': sim.count = atoi(optarg); break;
+		case 'r': sim.rate = atoi(optarg); break;
+		case 'j': sim.jitter = atoi(optarg); break;
+		case 'c': sim.clean = true; break;
+		case 's':
+			script = read_file(optarg);
+			if (!script) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 'y':
+			for (sim.sync = 0; sim.sync < SYNC_MODES; sim.sync++) {
+				if (strcmp(optarg, sync_names[sim.sync]) == 0) {
+					break;
+				}
+			}
+			if (sim.sync == SYNC_MODES) {
+				goto usage;
+			}
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || sim.count < 1 || sim.rate < 1) {
+		goto usage;
+	}
+	if (zq3_url_split(argv[optind], &sim.url) != 0) {
+		return 1;
+	}
+	if (sim.url.tls) {
+		fprintf(stderr, "mqtts:// isn't supported (use mqtt://)\n");
+		return 1;
+	}
+	load_script(script);
+
+	struct addrinfo hint = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+	struct addrinfo *res;
+	if (getaddrinfo(sim.url.host, NULL, &hint, &res) != 0) {
+		fprintf(stderr, "can't resolve %s\n", sim.url.host);
+		return 1;
+	}
+	sim.addr = *(struct sockaddr_in *)res->ai_addr;
+	sim.addr.sin_port = htons(sim.url.port ? sim.url.port : 1883);
+	freeaddrinfo(res);
+
+	// Thousands of sockets need more than the usual 1024 file descriptors
+	struct rlimit rl;
+	getrlimit(RLIMIT_NOFILE, &rl);
+	rl.rlim_cur = rl.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rl);
+
+	sim.clients = calloc(sim.count, sizeof(sim_client));
+	for (int i = 0; i < sim.count; i++) {
+		sim.clients[i].id = i;
+		sim.clients[i].fd = -1;
+		zq3_fsm_init(&sim.clients[i].fsm, &ops, &sim.clients[i],
+			BROKER_TIMEOUT_MS, sim.sync == SYNC_NONE ? 0 : SYNC_TIMEOUT_MS);
+		make_topic(&sim.clients[i]);
+	}
+	sim.epfd = epoll_create1(0);
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	sim.t0 = ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+	srand(ts.tv_nsec);
+
+	printf("%d clients -> %s:%d, %d connects/s, %s session, sync %s\n",
+		sim.count, sim.url.host, ntohs(sim.addr.sin_port), sim.rate,
+		sim.clean ? "clean" : "persistent", sync_names[sim.sync]);
+	int64_t next_report = REPORT_MS;
+	struct epoll_event events[256];
+	while (1) {
+		int n = epoll_wait(sim.epfd, events, 256, 5);
+		for (int i = 0; i < n; i++) {
+			on_event(events[i].data.ptr, events[i].events);
+		}
+		int64_t now = now_ms();
+		// Ramp up at the connect rate (each client "presses the button to
+		// start wifi" at its turn)
+		while (sim.started < sim.count && sim.started < now * sim.rate / 1000) {
+			event(&sim.clients[sim.started++], ZQ3_EV_PRESS, 0);
+		}
+		for (int i = 0; i < sim.started; i++) {
+			on_tick(&sim.clients[i], now);
+		}
+		if (!run_script(now)) {
+			break;
+		}
+		if (now >= next_report) {
+			report(now);
+			next_report += REPORT_MS;
+		}
+	}
+	summary(now_ms());
+	for (int i = 0; i < sim.count; i++) {
+		if (sim.clients[i].fd >= 0) {
+			send_packet(&sim.clients[i], PKT_DISCONNECT << 4, NULL, 0);
+			close_socket(&sim.clients[i]);
+		}
+	}
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: zq3_sim [-n clients] [-r connects/s] "
+		"[-j jitter%%] [-c] [-s script]\n"
+		"               [--sync retain|get|none] url\n");
+	return 2;
+}
@@ -0,0 +1,79 @@
+# SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+# SPDX-License-Identifier: MIT
+#
+# Read or set the toggle switch over the LAN control UDP port
+#
+# This talks to the device directly (no MQTT broker). The token must match
+# the device's zq3/lantok setting. See app/src/zq3_lan.h for the packet
+# layout. Each run does a hello request to get the device's boot nonce and
+# sequence number, then sends the command and prints the round trip time.
+#
+# Usage: python3 lan_ctl.py <host> <token> <get|on|off|flip> [count]
+#
+# Examples:
+#   python3 tools/lan_ctl.py 192.168.0.123 my-lan-secret-1234 get
+#   python3 tools/lan_ctl.py 192.168.0.123 my-lan-secret-1234 flip 20
+
+import hashlib
+import hmac
+import socket
+import struct
+import sys
+import time
+
+
+PORT = 5680       # CONFIG_ZQ3_LAN_PORT
+VERSION = 1
+HDR = struct.Struct(">BcccII")
+MAC_LEN = 16
+
+
+def pack(token, cmd, value, nonce, seq):
+    hdr = HDR.pack(VERSION, cmd, value, b"\0", nonce, seq)
+    return hdr + hmac.new(token, hdr, hashlib.sha256).digest()[:MAC_LEN]
+
+def unpack(token, pkt):
+    if len(pkt) != HDR.size + MAC_LEN:
+        raise ValueError("bad response length")
+    hdr, mac = pkt[:HDR.size], pkt[HDR.size:]
+    good = hmac.new(token, hdr, hashlib.sha256).digest()[:MAC_LEN]
+    if not hmac.compare_digest(mac, good):
+        raise ValueError("bad response MAC (wrong token?)")
+    _, cmd, value, _, nonce, seq = HDR.unpack(hdr)
+    return cmd, value, nonce, seq
+
+def request(sock, addr, token, cmd, value, nonce, seq):
+    start = time.monotonic()
+    sock.sendto(pack(token, cmd, value, nonce, seq), addr)
+    pkt, _ = sock.recvfrom(64)
+    ms = (time.monotonic() - start) * 1000
+    return unpack(token, pkt), ms
+
+def main(argv):
+    if len(argv) not in (3, 4) or argv[2] not in ("get", "on", "off", "flip"):
+        sys.exit("usage: lan_ctl.py <host> <token> <get|on|off|flip> [count]")
+    host, token, action = argv[0], argv[1].encode("utf-8"), argv[2]
+    count = int(argv[3]) if len(argv) == 4 else 1
+    addr = (host, PORT)
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.settimeout(1.0)
+    (cmd, _, nonce, seq), ms = request(sock, addr, token, b"h", b"?", 0, 0)
+    print(f"hello: nonce {nonce:08x}, seq {seq} ({ms:.1f} ms)")
+    value = b"?"
+    for _ in range(count):
+        seq += 1
+        if action == "get":
+            cmd, value = b"g", b"?"
+        elif action == "flip":
+            cmd, value = b"s", b"0" if value == b"1" else b"1"
+        else:
+            cmd, value = b"s", b"1" if action == "on" else b"0"
+        (rcmd, value, _, _), ms = request(sock, addr, token, cmd, value,
+            nonce, seq)
+        print(f"{rcmd.decode()} {value.decode()} ({ms:.1f} ms)")
+        if rcmd == b"E":
+            sys.exit("device rejected request")
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,109 @@
+# SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+# SPDX-License-Identifier: MIT
+#
+# Send a signed firmware image to the device over MQTT (OTA update)
+#
+# The device must be running a `make app-ota` build with the zq3/ota setting
+# holding the same topic prefix. This publishes a begin message, waits for
+# the device's status to find the first chunk it needs, then publishes the
+# rest of the chunks (QoS 1) and waits for the device to verify the image.
+# Running it again after an interrupted transfer resumes where it stopped.
+# With --boot, it tells the device to reboot into the new image.
+#
+# This needs paho-mqtt (`pip install paho-mqtt`) and a broker that allows
+# messages as big as the chunk size (mosquitto is fine). With MQTT 5
+# (zq3/mqttv = 5), the device's CONNECT sets Maximum Packet Size to fit a
+# 4096 byte chunk, and the broker drops anything bigger without telling
+# either side. See app/src/zq3_ota.h for the topics.
+#
+# Usage: python3 ota_send.py <host> <prefix> <image> [--chunk N] [--boot]
+#
+# Example:
+#   python3 tools/ota_send.py 192.168.0.50 zq3/ota/zq3-a1b2c3 \
+#       build/app/zephyr/zephyr.signed.bin --boot
+
+import argparse
+import hashlib
+import threading
+import time
+
+import paho.mqtt.client as mqtt
+
+
+class Device:
+    def __init__(self, host, port, prefix):
+        self.prefix = prefix
+        self.status = None
+        self.changed = threading.Condition()
+        self.client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+        self.client.max_inflight_messages_set(8)
+        self.client.on_message = self.on_message
+        self.client.connect(host, port)
+        self.client.subscribe(prefix + "/status", qos=1)
+        self.client.loop_start()
+
+    def on_message(self, client, userdata, msg):
+        state, received, chunks, next_missing, err = msg.payload.split()
+        with self.changed:
+            self.status = (state.decode(), int(received), int(chunks),
+                int(next_missing), int(err))
+            self.changed.notify_all()
+
+    def wait(self, states, timeout):
+        with self.changed:
+            self.changed.wait_for(
+                lambda: self.status and self.status[0] in states, timeout)
+            return self.status
+
+    def publish(self, sub, payload):
+        return self.client.publish(self.prefix + "/" + sub, payload, qos=1)
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Send firmware over MQTT")
+    ap.add_argument("host")
+    ap.add_argument("prefix", help="topic prefix (device's zq3/ota setting)")
+    ap.add_argument("image", help="signed image (zephyr.signed.bin)")
+    ap.add_argument("--port", type=int, default=1883)
+    ap.add_argument("--chunk", type=int, default=1024,
+        help="chunk size: 256, 512, 1024, 2048, or 4096")
+    ap.add_argument("--boot", action="store_true",
+        help="reboot into the new image when it's verified")
+    args = ap.parse_args()
+
+    image = open(args.image, "rb").read()
+    sha = hashlib.sha256(image).hexdigest()
+    chunks = (len(image) + args.chunk - 1) // args.chunk
+    dev = Device(args.host, args.port, args.prefix)
+
+    dev.publish("begin", f"{len(image)} {args.chunk} {sha} raw")
+    status = dev.wait(("receiving", "verifying", "ready", "failed"), 10)
+    if not status:
+        raise SystemExit("no status from device (is zq3/ota set?)")
+    if status[0] == "failed":
+        raise SystemExit(f"device refused the image: {status[4]}")
+    first = status[3]
+    print(f"{len(image)} bytes in {chunks} chunks, starting at chunk {first}")
+
+    # paho keeps up to 8 QoS 1 chunks in flight and queues the rest
+    start = time.monotonic()
+    sent = [dev.publish(f"c/{n}", image[n * args.chunk:(n + 1) * args.chunk])
+        for n in range(first, chunks)]
+    for i, info in enumerate(sent):
+        info.wait_for_publish()
+        if (first + i) % 100 == 0:
+            print(f"chunk {first + i}")
+    status = dev.wait(("ready", "failed"), 60)
+    secs = max(time.monotonic() - start, 0.001)
+    size = len(image) - first * args.chunk
+    print(f"sent {size} bytes in {secs:.1f} s ({size / 1024 / secs:.1f} KB/s)")
+    if not status or status[0] != "ready":
+        raise SystemExit(f"device didn't verify the image: {status}")
+    print("device verified the image")
+    if args.boot:
+        dev.publish("boot", "").wait_for_publish()
+        print("device is rebooting into the new image")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,45 @@
+# SPDX-FileCopyrightText: Copyright 2025 Sam Blenny
+# SPDX-License-Identifier: MIT
+#
+# Print `aio cred ...` shell commands to provision a TLS credential
+#
+# This converts a PEM or DER certificate (or private key) to DER, then prints
+# the Zephyr shell commands to save it in the device's NVM flash. The hex data
+# is split into short lines so each command fits in the shell's line buffer.
+#
+# Usage: python3 provision_cred.py <ca0|ca1|ca2|crt|key> <file.pem|file.der>
+#
+# Example:
+#   python3 tools/provision_cred.py ca0 ca.crt > cred.txt
+# Then paste the lines from cred.txt into the serial console (or use your
+# serial terminal's send-file feature).
+
+import base64
+import sys
+
+
+NAMES = ("ca0", "ca1", "ca2", "crt", "key")
+HEX_PER_LINE = 160  # 80 bytes per `aio cred hex` command
+
+
+def to_der(data):
+    if not data.lstrip().startswith(b"-----BEGIN"):
+        return data
+    lines = data.decode("ascii").splitlines()
+    body = [s.strip() for s in lines if s.strip() and not s.startswith("-----")]
+    return base64.b64decode("".join(body), validate=True)
+
+def main(argv):
+    if len(argv) != 2 or argv[0] not in NAMES:
+        sys.exit("usage: provision_cred.py <ca0|ca1|ca2|crt|key> <file>")
+    name, path = argv
+    der = to_der(open(path, "rb").read())
+    hexdata = der.hex()
+    print("aio cred begin")
+    for i in range(0, len(hexdata), HEX_PER_LINE):
+        print(f"aio cred hex {hexdata[i:i+HEX_PER_LINE]}")
+    print(f"aio cred save {name}")
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])